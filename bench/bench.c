@@ -0,0 +1,162 @@
+/* Benchmark driver. Runs the phases of magpie (read, compile, run,
+   simplify and print) on an agp file and a script, and writes one JSON
+   object per run to stdout: wall and CPU seconds per phase, throughput,
+   sizes, and the peak resident set size of the process so far.
+
+   bench [options] file.magpie file.agp
+     -t N        threads (default 1)
+     -e ENGINE   list or tree (default list)
+     -s          simplify before printing
+     -n N        runs (default 1)
+     -l LABEL    label for the output (default the agp file name)
+
+   The graph is printed to /dev/null. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "klib/ketopt.h"
+#include "agp-graph.h"
+#include "script.h"
+
+typedef struct {
+  double wall, cpu;
+} bench_time_t;
+
+static double __clock(clockid_t id){
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bench_time_t __now(void){
+  bench_time_t t = { __clock(CLOCK_MONOTONIC),
+                     __clock(CLOCK_PROCESS_CPUTIME_ID) };
+  return t;
+}
+
+/* time since start, and restart */
+static bench_time_t __lap(bench_time_t * start){
+  bench_time_t now = __now();
+  bench_time_t lap = { now.wall - start->wall, now.cpu - start->cpu };
+  *start = now;
+  return lap;
+}
+
+static FILE * __open(const char * path, const char * mode){
+  FILE * file = fopen(path, mode);
+  if(!file){
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  return file;
+}
+
+#define __phase(name, t) \
+  printf(",\"" name "_s\":%.6f,\"" name "_cpu_s\":%.6f", (t).wall, (t).cpu)
+
+int main(int argc, char ** argv){
+  int threads = 1, simplify = 0, runs = 1, run;
+  agp_engine_t engine = AGP_ENGINE_LIST;
+  const char * label = NULL;
+  ketopt_t opt = KETOPT_INIT;
+  int c;
+
+  while((c = ketopt(&opt, argc, argv, 1, "t:e:sn:l:", NULL)) >= 0){
+    switch(c){
+    case 't': threads = atoi(opt.arg); break;
+    case 's': simplify = 1;            break;
+    case 'n': runs = atoi(opt.arg);    break;
+    case 'l': label = opt.arg;         break;
+    case 'e':
+      engine = strcmp(opt.arg, "tree") == 0 ? AGP_ENGINE_TREE :
+        AGP_ENGINE_LIST;
+      break;
+    default:
+      fprintf(stderr, "Unknown option\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(argc - opt.ind != 2 || threads < 1 || runs < 1){
+    fprintf(stderr, "Usage: bench [-t threads] [-e list|tree] [-s] "
+            "[-n runs] [-l label] file.magpie file.agp\n");
+    return EXIT_FAILURE;
+  }
+
+  const char * script_path = argv[opt.ind], * agp_path = argv[opt.ind + 1];
+  struct stat st;
+  if(stat(agp_path, &st) != 0){
+    perror(agp_path);
+    return EXIT_FAILURE;
+  }
+  if(!label)
+    label = agp_path;
+
+  for(run = 1; run <= runs; run++){
+    bench_time_t start = __now(), read, compile, execute, simple, print;
+    FILE * file;
+    khiter_t k;
+    int combined = 0;
+
+    file = __open(agp_path, "r");
+    agp_graph_t * graph = agp_graph_read_threads(file, threads);
+    fclose(file);
+    agp_graph_set_engine(graph, engine);
+    read = __lap(&start);
+
+    size_t records = 0, objects = kh_size(graph->objects);
+    for (k = kh_begin(graph->objects); k != kh_end(graph->objects); k++)
+      if (kh_exist(graph->objects, k))
+        records += kh_value(graph->objects, k)->count;
+
+    file = __open(script_path, "r");
+    script_t * script = script_compile(file);
+    fclose(file);
+    compile = __lap(&start);
+
+    script_run_threads(script, graph, threads);
+    execute = __lap(&start);
+
+    if(simplify)
+      combined = agp_graph_simplify(graph);
+    simple = __lap(&start);
+
+    file = __open("/dev/null", "w");
+    int bytes = agp_graph_print_threads(graph, file, threads);
+    fclose(file);
+    print = __lap(&start);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"label\":\"%s\",\"run\":%d,\"threads\":%d,\"engine\":\"%s\"",
+           label, run, threads,
+           engine == AGP_ENGINE_TREE ? "tree" : "list");
+    printf(",\"agp_bytes\":%lld,\"records\":%zu,\"objects\":%zu"
+           ",\"operations\":%zu,\"combined\":%d,\"output_bytes\":%d",
+           (long long) st.st_size, records, objects, script->n, combined,
+           bytes);
+    __phase("read", read);
+    __phase("compile", compile);
+    __phase("run", execute);
+    __phase("simplify", simple);
+    __phase("print", print);
+    printf(",\"read_mb_s\":%.2f,\"run_ops_s\":%.1f,\"print_mb_s\":%.2f",
+           st.st_size / 1e6 / read.wall,
+           execute.wall > 0 ? script->n / execute.wall : 0,
+           bytes / 1e6 / print.wall);
+    printf(",\"peak_rss_kb\":%ld}\n", usage.ru_maxrss);
+    fflush(stdout);
+
+    script_destroy(script);
+    agp_graph_destroy(graph);
+    str_pool_destroy();
+  }
+
+  return EXIT_SUCCESS;
+}
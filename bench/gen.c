@@ -0,0 +1,306 @@
+/* Synthetic agp files and scripts for benchmarking. Output only
+   depends on the options and the seed.
+
+   gen agp [options] > file.agp
+     -s N        scaffolds (default 1000)
+     -c N[-M]    sequences per scaffold (default 10-50)
+     -n N        length of names (default 12)
+     -p F        fraction of sequences carrying on the contig before
+                 them, which simplify can join (default 0.1)
+     -r N        seed (default 1)
+
+   gen script [options] file.agp > file.magpie
+     -o N        operations (default 1000)
+     -m A,B,C,D,E
+                 weights of MOVE, REV, REVCOMP, CREATE and SPLIT
+                 (default 40,20,20,5,15)
+     -l N[-M]    sequences per segment (default 1-5)
+     -r N        seed (default 1)
+
+   Scripts are made by applying each operation to the graph before
+   writing it, so every operation is valid where it stands. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "klib/ketopt.h"
+#include "agp-graph.h"
+#include "script.h"
+
+static uint64_t __state;
+
+static uint64_t __random(void){
+  uint64_t x = (__state += 0x9E3779B97F4A7C15ULL);
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/* uniform in [lo, hi] */
+static unsigned long __between(unsigned long lo, unsigned long hi){
+  return lo + __random() % (hi - lo + 1);
+}
+
+static double __uniform(void){
+  return (__random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void __range(const char * arg, unsigned long * lo, unsigned long * hi){
+  char * end;
+
+  *lo = *hi = strtoul(arg, &end, 10);
+  if(*end == '-')
+    *hi = strtoul(end + 1, &end, 10);
+
+  if(*end || *lo == 0 || *hi < *lo){
+    fprintf(stderr, "Expected N or N-M with 0 < N <= M: %s\n", arg);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* prefix and a zero padded number, padded out to len characters */
+static void __name(char * out, size_t size, const char * prefix,
+                   unsigned long i, int len){
+  int width = len - (int) strlen(prefix);
+  snprintf(out, size, "%s%0*lu", prefix, width > 1 ? width : 1, i);
+}
+
+static void __gen_agp(int argc, char ** argv){
+  unsigned long scaffolds = 1000, lo = 10, hi = 50, i, j;
+  unsigned long contigs = 0, cstart = 0, cend = 0;
+  char orientation = '+';
+  int len = 12;
+  double pieces = 0.1;
+  char object[256], contig[256];
+  ketopt_t opt = KETOPT_INIT;
+  int c;
+
+  __state = 1;
+  while((c = ketopt(&opt, argc, argv, 1, "s:c:n:p:r:", NULL)) >= 0){
+    switch(c){
+    case 's': scaffolds = strtoul(opt.arg, NULL, 10);  break;
+    case 'c': __range(opt.arg, &lo, &hi);              break;
+    case 'n': len = atoi(opt.arg);                     break;
+    case 'p': pieces = atof(opt.arg);                  break;
+    case 'r': __state = strtoull(opt.arg, NULL, 10);   break;
+    default:
+      fprintf(stderr, "Unknown option for gen agp\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for(i = 0; i < scaffolds; i++){
+    unsigned long n = __between(lo, hi), pos = 0, num = 1;
+    __name(object, sizeof(object), "scf", i, len);
+
+    for(j = 0; j < n; j++){
+      unsigned long length = __between(1000, 100000);
+
+      if(j > 0){
+        /* alternate gap types, as scaffolders do */
+        unsigned long gap = j % 2 ? 100 : __between(10, 1000);
+        printf("%s\t%lu\t%lu\t%lu\t%c\t%lu\tscaffold\tyes\t%s\n", object,
+               pos + 1, pos + gap, num++, j % 2 ? 'U' : 'N', gap,
+               j % 2 ? "proximity_ligation" : "paired-ends");
+        pos += gap;
+      }
+
+      if(j > 0 && orientation == '+' && __uniform() < pieces){
+        /* the next piece of the same contig */
+        cstart = cend + 1;
+      } else {
+        __name(contig, sizeof(contig), "ctg", contigs++, len);
+        cstart = 1;
+        orientation = __random() & 1 ? '+' : '-';
+      }
+      cend = cstart + length - 1;
+
+      printf("%s\t%lu\t%lu\t%lu\tW\t%s\t%lu\t%lu\t%c\n", object, pos + 1,
+             pos + length, num++, contig, cstart, cend, orientation);
+      pos += length;
+    }
+  }
+}
+
+/* Scripts. Sequences are picked from every sequence record made so
+   far; records are never freed by edits (only gaps are), so the pool
+   stays valid as the graph changes. */
+typedef struct {
+  agp_scaffold_t ** records;
+  size_t n, m;
+} pool_t;
+
+static void __pool_add(pool_t * pool, agp_scaffold_t * record){
+  if(pool->n == pool->m){
+    pool->m = pool->m ? pool->m * 2 : 1024;
+    pool->records = realloc(pool->records, sizeof(agp_scaffold_t*) * pool->m);
+    if(!pool->records){
+      fprintf(stderr, "Out of memory while generating script\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pool->records[pool->n++] = record;
+}
+
+static agp_scaffold_t * __pick(pool_t * pool){
+  return pool->records[__random() % pool->n];
+}
+
+static agp_component_ref_t __ref(agp_scaffold_t * record){
+  agp_component_ref_t ref = { { record->component.seq.name,
+                                record->component.seq.start,
+                                record->component.seq.end }, 0 };
+  return ref;
+}
+
+/* segment of up to length sequences starting at a random one */
+static void __segment(agp_graph_t * graph, pool_t * pool, script_op_t * op,
+                      unsigned long length){
+  agp_scaffold_t * left = __pick(pool), * right = left, * cur = left;
+
+  while(length > 1 && (cur = agp_graph_neighbor(graph, cur, 1)) != NULL)
+    if(cur->type == 'W'){
+      right = cur;
+      length--;
+    }
+
+  op->left = __ref(left);
+  op->range = SCRIPT_SINGLE;
+  if(right != left){
+    op->right = __ref(right);
+    op->range = cur || __random() % 4 ? SCRIPT_THRU : SCRIPT_THRU_END;
+  }
+}
+
+static void __gen_script(int argc, char ** argv){
+  unsigned long ops = 1000, lo = 1, hi = 5, weights[5] = {40, 20, 20, 5, 15};
+  unsigned long total = 0, created = 0, i;
+  ketopt_t opt = KETOPT_INIT;
+  int c, v;
+
+  __state = 1;
+  while((c = ketopt(&opt, argc, argv, 1, "o:m:l:r:", NULL)) >= 0){
+    switch(c){
+    case 'o': ops = strtoul(opt.arg, NULL, 10);        break;
+    case 'l': __range(opt.arg, &lo, &hi);              break;
+    case 'r': __state = strtoull(opt.arg, NULL, 10);   break;
+    case 'm':
+      if(sscanf(opt.arg, "%lu,%lu,%lu,%lu,%lu", weights, weights + 1,
+                weights + 2, weights + 3, weights + 4) != 5){
+        fprintf(stderr, "Expected five verb weights: %s\n", opt.arg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      fprintf(stderr, "Unknown option for gen script\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for(v = 0; v < 5; v++)
+    total += weights[v];
+  if(opt.ind + 1 != argc || total == 0){
+    fprintf(stderr, "Usage: gen script [options] file.agp\n");
+    exit(EXIT_FAILURE);
+  }
+
+  FILE * file = fopen(argv[opt.ind], "r");
+  if(!file){
+    perror(argv[opt.ind]);
+    exit(EXIT_FAILURE);
+  }
+  agp_graph_t * graph = agp_graph_read(file);
+  fclose(file);
+  agp_graph_set_engine(graph, AGP_ENGINE_TREE);
+
+  pool_t pool = {0};
+  agp_object_t ** objects = agp_graph_sorted_objects(graph);
+  agp_graph_flatten(graph);
+  for(i = 0; i < kh_size(graph->objects); i++){
+    agp_scaffold_t * cur;
+    for(cur = objects[i]->head; cur; cur = cur->next)
+      if(cur->type == 'W')
+        __pool_add(&pool, cur);
+  }
+  free(objects);
+
+  if(pool.n == 0){
+    fprintf(stderr, "No sequences in %s\n", argv[opt.ind]);
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < ops; i++){
+    script_op_t op;
+    char error[1024], name[64];
+    str_id_t names[3];
+    int tries;
+
+    for(tries = 0; tries < 1000; tries++){
+      unsigned long r = __random() % total;
+      for(v = 0; r >= weights[v]; v++)
+        r -= weights[v];
+
+      memset(&op, 0, sizeof(op));
+      op.verb = (script_verb_t) v;
+      op.line = i + 1;
+      op.column = 1;
+
+      if(op.verb == SCRIPT_SPLIT){
+        agp_scaffold_t * record = __pick(&pool);
+        if(record->component.seq.end - record->component.seq.start < 2)
+          continue;
+        op.target = __ref(record);
+        op.pos = __between(record->component.seq.start + 1,
+                           record->component.seq.end - 1);
+      } else {
+        __segment(graph, &pool, &op, __between(lo, hi));
+      }
+
+      if(op.verb == SCRIPT_MOVE){
+        op.target = __ref(__pick(&pool));
+        op.direction = __random() & 1 ? 1 : -1;
+      }
+
+      if(op.verb == SCRIPT_CREATE){
+        snprintf(name, sizeof(name), "new%lu", created);
+        op.object = str_pool_intern(name, strlen(name));
+      }
+
+      if(script_op_check(&op, graph, names, error, sizeof(error)) >= 0)
+        break;
+    }
+
+    if(tries == 1000){
+      fprintf(stderr, "No valid operation found after %d tries, at "
+              "operation %lu\n", tries, i + 1);
+      exit(EXIT_FAILURE);
+    }
+
+    script_op_run(&op, graph);
+    script_op_write(&op, stdout);
+
+    if(op.verb == SCRIPT_CREATE)
+      created++;
+    if(op.verb == SCRIPT_SPLIT)
+      __pool_add(&pool, agp_graph_component_at(graph, op.target.key.name,
+                                               op.pos + 1));
+  }
+
+  free(pool.records);
+  agp_graph_destroy(graph);
+}
+
+int main(int argc, char ** argv){
+  if(argc >= 2 && strcmp(argv[1], "agp") == 0)
+    __gen_agp(argc - 1, argv + 1);
+  else if(argc >= 2 && strcmp(argv[1], "script") == 0)
+    __gen_script(argc - 1, argv + 1);
+  else {
+    fprintf(stderr, "Usage: gen agp|script [options]\n");
+    return EXIT_FAILURE;
+  }
+
+  str_pool_destroy();
+  return EXIT_SUCCESS;
+}
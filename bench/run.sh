@@ -0,0 +1,39 @@
+#!/bin/sh
+# Generate the benchmark data (once) and run the driver on every data
+# set with both engines. One JSON object per line goes to stdout.
+#
+#   BENCH_DATA     where data sets are kept (default bench/data)
+#   BENCH_THREADS  threads for the driver (default 1)
+#   BENCH_RUNS     runs of each data set (default 1)
+#   BENCH_SETS     names of the data sets to run (default all)
+set -e
+
+data=${BENCH_DATA:-bench/data}
+threads=${BENCH_THREADS:-1}
+runs=${BENCH_RUNS:-1}
+
+mkdir -p "$data"
+
+# name, scaffolds, sequences per scaffold, name length, operations,
+# sequences per segment
+while read -r name scaffolds sequences length ops segment; do
+  case " ${BENCH_SETS:-$name} " in *" $name "*) ;; *) continue ;; esac
+
+  agp="$data/$name.agp"
+  script="$data/$name.magpie"
+
+  [ -s "$agp" ] || bench/gen agp -s "$scaffolds" -c "$sequences" \
+                               -n "$length" > "$agp"
+  [ -s "$script" ] || bench/gen script -o "$ops" -l "$segment" \
+                                  "$agp" > "$script"
+
+  for engine in list tree; do
+    bench/bench -l "$name" -e "$engine" -t "$threads" -n "$runs" -s \
+                "$script" "$agp"
+  done
+done <<EOF
+small   1000   10-50      12 1000  1-5
+many    50000  10-50      16 10000 1-5
+long    50     2000-4000  12 10000 1-50
+names   20000  10-50      64 5000  1-5
+EOF
@@ -3,260 +3,1174 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
 
 #include "klib/khash.h"
+#include "parallel.h"
+#include "agp-tree.h"
+#include "error.h"
 
 
 #define __link_segments(l,r) (l)->next = (r); (r)->prev = (l);
-#define __create_key(comp) \
-            snprintf((comp).key, 1024, "%s:%lu-%lu",  \
-                     (comp).name, (comp).start, (comp).end);
+#define __intern(str) str_pool_intern((str), strlen(str))
+
+#define __lock(agp)   do { if((agp)->shared)                            \
+      pthread_mutex_lock(&(agp)->lock); } while(0)
+#define __unlock(agp) do { if((agp)->shared)                            \
+      pthread_mutex_unlock(&(agp)->lock); } while(0)
+
+/* count a record visited by a list walk, see agp_graph_count_walks */
+#define __walk(agp) do { if((agp)->walked) (*(agp)->walked)++; } while(0)
+
+__KHASH_IMPL(agp_object,  ,
+             str_id_t, agp_object_t*,
+             1, kh_int_hash_func, kh_int_hash_equal)
+
+#define __component_hash(key)                                           \
+  kh_int64_hash_func((((uint64_t) (key).name * 0x9E3779B97F4A7C15ULL) ^   \
+                      (uint64_t) (key).start * 0xC2B2AE3D27D4EB4FULL) +   \
+                     (uint64_t) (key).end)
+#define __component_equal(a, b)                                         \
+  ((a).name == (b).name && (a).start == (b).start && (a).end == (b).end)
+
+__KHASH_IMPL(agp_component,  ,
+             agp_component_key_t, agp_scaffold_t*,
+             1, __component_hash, __component_equal)
+
+__KHASH_IMPL(agp_contig,  ,
+             str_id_t, agp_contig_index_t*,
+             1, kh_int_hash_func, kh_int_hash_equal)
+
+#define __seq_key(seq)                                                  \
+  ((agp_component_key_t) { (seq)->name, (seq)->start, (seq)->end })
+
+agp_scaffold_t * agp_graph_alloc(agp_graph_t * agp){
+  agp_slab_t * slab = &agp->records;
+  agp_scaffold_t * record;
+
+  __lock(agp);
+
+  /* reuse released records first */
+  if(slab->free){
+    record = slab->free;
+    slab->free = record->next;
+    __unlock(agp);
+    return record;
+  }
 
+  if(slab->n_blocks == 0 || slab->used == AGP_SLAB_BLOCK){
+    if(slab->n_blocks == slab->m_blocks){
+      slab->m_blocks = slab->m_blocks ? slab->m_blocks * 2 : 16;
+      slab->blocks = realloc(slab->blocks,
+                             sizeof(agp_scaffold_t*) * slab->m_blocks);
+    }
 
-__KHASH_IMPL(agp_graph,  ,
-             kh_cstr_t, agp_scaffold_t*,
-             1, kh_str_hash_func, kh_str_hash_equal)
-  
-agp_graph_t * agp_graph_read(FILE * file){
-  agp_graph_t * graph = malloc(sizeof(agp_graph_t));
-  agp_scaffold_t * record = malloc(sizeof(agp_scaffold_t));
+    agp_scaffold_t * block = malloc(sizeof(agp_scaffold_t) * AGP_SLAB_BLOCK);
+    if(!block || !slab->blocks){
+      error_fail("Out of memory while allocating agp records\n");
+    }
 
-  graph->objects    = kh_init(agp_graph);
-  graph->components = kh_init(agp_graph);
-  
-  while(fscanf(file, "%255s\t%lu\t%lu\t%u\t%c\t",
-               record->object.name,
-               &(record->object.start),
-               &(record->object.end),
-               &(record->num),
-               &(record->type)) == 5){
-
-    switch(record->type) {
-    case 'U':
-    case 'N':
-      if(fscanf(file, "%u\t%127s\t%4s\t%127s\n",
-                &(record->component.gap.length),
-                record->component.gap.type,
-                record->component.gap.linkage,
-                record->component.gap.evidence) != 4){
-        fprintf(stderr, "Can't parse agp file: Malformed gap line\n");
-        exit(EXIT_FAILURE);
-      }
-      break;
+    slab->blocks[slab->n_blocks++] = block;
+    slab->used = 0;
+  }
 
-    case 'W':
-      if(fscanf(file, "%255s\t%lu\t%lu\t%c\n",
-                record->component.seq.name,
-                &(record->component.seq.start),
-                &(record->component.seq.end),
-                &(record->component.seq.orientation)) != 4) {
-        fprintf(stderr, "Can't parse agp file: Malformed non-gap line\n");
-        exit(EXIT_FAILURE);
-      }
-      break;
-      
-    default:
-      fprintf(stderr, "Cannot deal with any entry type other"
-              " than W,U,N: %c\n", record->type);
-      exit(EXIT_FAILURE);
+  record = slab->blocks[slab->n_blocks - 1] + slab->used++;
+  __unlock(agp);
+
+  return record;
+}
+
+/* give a record a node of its own, for the tree engine */
+static void __node_alloc(agp_graph_t * agp, agp_scaffold_t * record){
+  agp_node_slab_t * slab = &agp->nodes;
+
+  __lock(agp);
+
+  if(slab->n_free > 0){
+    record->tree.node = slab->free[--slab->n_free];
+    __unlock(agp);
+    return;
+  }
+
+  if(slab->n_blocks == 0 || slab->used == AGP_SLAB_BLOCK){
+    if(slab->n_blocks == slab->m_blocks){
+      slab->m_blocks = slab->m_blocks ? slab->m_blocks * 2 : 16;
+      slab->blocks = realloc(slab->blocks,
+                             sizeof(agp_tree_node_t*) * slab->m_blocks);
     }
 
-    snprintf(record->component.seq.key, 1024, "%s:%lu-%lu",
-             record->component.seq.name,
-             record->component.seq.start,
-             record->component.seq.end);
-    record->next = NULL;
-    record->prev = NULL;
-
-    int ret;
-    khiter_t k;
-
-    /* Add current record to the end of the object (scaffold) linked
-       list */
-    k = kh_put(agp_graph, graph->objects,
-               record->object.name, &ret);
-    if(ret != 0){
-      kh_value( graph->objects,k) = record;
-    }else{
-      agp_scaffold_t * cur = kh_value(graph->objects, k);
-      while(cur->next != NULL) cur = cur->next;
-      cur->next = record;
-      record->prev = cur;
+    agp_tree_node_t * block = malloc(sizeof(agp_tree_node_t) * AGP_SLAB_BLOCK);
+    if(!block || !slab->blocks){
+      error_fail("Out of memory while allocating tree nodes\n");
     }
 
-    /* If sequence, add current record to the component (sequence)
-       lookup hash */
-    if(record->type == 'W'){
-      int ret;
-      k = kh_put(agp_graph, graph->components,
-                 record->component.seq.key, &ret);
-      
-      if(ret == 0){
-        fprintf(stderr, "Can't parse agp file: sequence component "
-                "segment found more than once\n");
-        exit(EXIT_FAILURE);
+    slab->blocks[slab->n_blocks++] = block;
+    slab->used = 0;
+  }
+
+  record->tree.node = slab->blocks[slab->n_blocks - 1] + slab->used++;
+  __unlock(agp);
+}
+
+static void __node_free_all(agp_graph_t * agp){
+  size_t i;
+
+  for(i = 0; i < agp->nodes.n_blocks; i++)
+    free(agp->nodes.blocks[i]);
+  free(agp->nodes.blocks);
+  free(agp->nodes.free);
+  memset(&agp->nodes, 0, sizeof(agp->nodes));
+}
+
+void agp_graph_release(agp_graph_t * agp, agp_scaffold_t * record){
+  agp_node_slab_t * nodes = &agp->nodes;
+
+  __lock(agp);
+  record->prev = NULL;
+  record->next = agp->records.free;
+  agp->records.free = record;
+
+  /* records on trees give their node back */
+  if(agp->engine == AGP_ENGINE_TREE){
+    if(nodes->n_free == nodes->m_free){
+      nodes->m_free = nodes->m_free ? nodes->m_free * 2 : 64;
+      nodes->free = realloc(nodes->free,
+                            sizeof(agp_tree_node_t*) * nodes->m_free);
+      if(!nodes->free){
+        error_fail("Out of memory while releasing tree nodes\n");
       }
-      kh_value(graph->components, k) = record;
     }
-    
-    record = malloc(sizeof(agp_scaffold_t));
+    nodes->free[nodes->n_free++] = record->tree.node;
   }
+  __unlock(agp);
+}
+
+agp_graph_t * agp_graph_init(void){
+  agp_graph_t * graph = calloc(1, sizeof(agp_graph_t));
+
+  graph->objects    = kh_init(agp_object);
+  graph->components = kh_init(agp_component);
+  graph->contigs    = kh_init(agp_contig);
+
+  graph->gap_type     = __intern("scaffold");
+  graph->gap_evidence = __intern("na");
+  pthread_mutex_init(&graph->lock, NULL);
 
-    free(record);
   return graph;
 }
 
-void agp_graph_destroy(agp_graph_t* agp){
 
-  khiter_t k;
-  agp_scaffold_t *record, *next;
-
-  for (k = kh_begin(agp->components);
-       k != kh_end(agp->components);
-       k++){  // traverse hash
-    if (kh_exist(agp->components, k)){
-      record = kh_value(agp->components, k);
-        free(record);
+/* keep the object's count and length in step with its records */
+static inline void __object_add(agp_object_t * object,
+                                agp_scaffold_t * record){
+  record->object = object;
+  object->count++;
+  object->length += agp_record_length(record);
+}
+
+static inline void __object_sub(agp_object_t * object,
+                                agp_scaffold_t * record){
+  object->count--;
+  object->length -= agp_record_length(record);
+}
+
+/* Object order. The natural key of a name is the name with every run
+   of digits (leading zeros dropped) written as '0', its length in two
+   bytes and the digits, so comparing keys bytewise compares the runs
+   as numbers. '0' compares to any other character the way a digit
+   would, so the rest of the name keeps its lexical order */
+static void __key_make(agp_graph_t * agp, agp_object_t * object){
+  const char * name = str_pool_get(object->name);
+  size_t len = str_pool_len(object->name), i, j, n = 0;
+
+  if(agp->order.order == AGP_ORDER_LEXICAL){
+    object->key     = name;
+    object->key_len = len;
+    return;
+  }
+
+  char * key = malloc(len * 3 + 1);
+  if(!key){
+    error_fail("Out of memory while ordering objects\n");
+  }
+
+  for(i = 0; i < len; i = j){
+    if(name[i] < '0' || name[i] > '9'){
+      key[n++] = name[i];
+      j = i + 1;
+      continue;
     }
-    
+
+    while(i < len - 1 && name[i] == '0' &&
+          name[i + 1] >= '0' && name[i + 1] <= '9')
+      i++;
+    for(j = i; j < len && name[j] >= '0' && name[j] <= '9'; j++);
+
+    key[n++] = '0';
+    key[n++] = (char) ((j - i) >> 8);
+    key[n++] = (char) ((j - i) & 0xff);
+    memcpy(key + n, name + i, j - i);
+    n += j - i;
   }
 
-  kh_destroy(agp_graph, agp->objects);
-  kh_destroy(agp_graph, agp->components);
-  free(agp);
+  object->key     = key;
+  object->key_len = n;
+}
+
+static void __key_free(agp_graph_t * agp, agp_object_t * object){
+  if(agp->order.order == AGP_ORDER_NATURAL)
+    free((char*) object->key);
 }
 
-int __agp_cmp_scaffolds(const void* a, const void* b) {
-    agp_scaffold_t *left = *(agp_scaffold_t**)a;
-    agp_scaffold_t *right = *(agp_scaffold_t**)b;
+/* names that only differ in leading zeros have the same natural key */
+static int __order_cmp(const agp_object_t * a, const agp_object_t * b){
+  size_t len = a->key_len < b->key_len ? a->key_len : b->key_len;
+  int cmp = memcmp(a->key, b->key, len);
 
-    return strncmp(left->object.name, right->object.name, 256);
+  if(cmp == 0 && a->key_len != b->key_len)
+    cmp = a->key_len < b->key_len ? -1 : 1;
+  if(cmp == 0)
+    cmp = strcmp(str_pool_get(a->name), str_pool_get(b->name));
+  return cmp;
 }
 
-agp_scaffold_t ** __sorted_objects(agp_graph_t* agp){
-  int i=0;
-  khiter_t k;
-  agp_scaffold_t ** objects =
-    malloc(sizeof(agp_scaffold_t*) * kh_size(agp->objects));
-
-  for (k = kh_begin(agp->objects);
-       k != kh_end(agp->objects);
-       k++){  // traverse hash
-    if (kh_exist(agp->objects, k)){
-      objects[i++] = kh_value(agp->objects, k);
+static int __order_qsort_cmp(const void * a, const void * b){
+  return __order_cmp(*(agp_object_t * const *) a,
+                     *(agp_object_t * const *) b);
+}
+
+static void __order_add(agp_graph_t * agp, agp_object_t * object){
+  agp_object_order_t * order = &agp->order;
+
+  if(order->n == order->m){
+    order->m = order->m ? order->m * 2 : 64;
+    order->objects = realloc(order->objects,
+                             sizeof(agp_object_t*) * order->m);
+    if(!order->objects){
+      error_fail("Out of memory while ordering objects\n");
     }
   }
 
-  qsort(objects, i, sizeof(agp_scaffold_t*), __agp_cmp_scaffolds);
+  __key_make(agp, object);
+  object->rank = order->n;
+  order->objects[order->n++] = object;
+}
 
-  return objects;
+/* fill the holes, sort the objects added since the last update and
+   merge them with the sorted ones */
+static void __order_update(agp_graph_t * agp){
+  agp_object_order_t * order = &agp->order;
+  size_t i, j, k, sorted;
+  khiter_t it;
+
+  if(!order->built){
+    order->built = 1;
+    for (it = kh_begin(agp->objects); it != kh_end(agp->objects); it++)
+      if (kh_exist(agp->objects, it))
+        __order_add(agp, kh_value(agp->objects, it));
+  }
+
+  if(order->sorted == order->n && order->holes == 0)
+    return;
+
+  for(i = j = sorted = 0; i < order->n; i++)
+    if(order->objects[i]){
+      if(i < order->sorted) sorted++;
+      order->objects[j++] = order->objects[i];
+    }
+  order->n = j;
+  order->holes = 0;
+
+  qsort(order->objects + sorted, order->n - sorted, sizeof(agp_object_t*),
+        __order_qsort_cmp);
+
+  if(sorted > 0 && sorted < order->n){
+    agp_object_t ** merged = malloc(sizeof(agp_object_t*) * order->n);
+    if(!merged){
+      error_fail("Out of memory while ordering objects\n");
+    }
+
+    for(i = 0, j = sorted, k = 0; k < order->n; k++)
+      if(j == order->n || (i < sorted &&
+                           __order_cmp(order->objects[i],
+                                       order->objects[j]) < 0))
+        merged[k] = order->objects[i++];
+      else
+        merged[k] = order->objects[j++];
+
+    free(order->objects);
+    order->objects = merged;
+    order->m = order->n;
+  }
+
+  for(i = 0; i < order->n; i++)
+    order->objects[i]->rank = i;
+  order->sorted = order->n;
 }
 
-int __agp_print_record(FILE* file, agp_scaffold_t* record){
-  int ret = 0;
-  ret += fprintf(file, "%s\t%lu\t%lu\t%u\t%c\t",
-                 record->object.name,
-                 record->object.start,
-                 record->object.end,
-                 record->num,
-                 record->type);
+/* new, empty object. NULL if the name is already taken */
+static agp_object_t * __object_create(agp_graph_t * agp, str_id_t name){
+  int ret;
+  agp_object_t * object = NULL;
+
+  __lock(agp);
+  khiter_t k = kh_put(agp_object, agp->objects, name, &ret);
+
+  if(ret != 0){
+    object = calloc(1, sizeof(agp_object_t));
+    object->name = name;
+    kh_value(agp->objects, k) = object;
+    if(agp->order.built)
+      __order_add(agp, object);
+  }
+  __unlock(agp);
 
-  switch(record->type) {
-  case 'U':
-  case 'N':
-    ret += fprintf(file, "%u\t%s\t%s\t%s\n",
-                   record->component.gap.length,
-                   record->component.gap.type,
-                   record->component.gap.linkage,
-                   record->component.gap.evidence);
-    break;
+  return object;
+}
 
-  default:
-      ret += fprintf(file, "%s\t%lu\t%lu\t%c\n",
-                     record->component.seq.name,
-                     record->component.seq.start,
-                     record->component.seq.end,
-                     record->component.seq.orientation);
+static void __object_delete(agp_graph_t * agp, agp_object_t * object){
+  __lock(agp);
+  khiter_t k = kh_get(agp_object, agp->objects, object->name);
+  kh_del(agp_object, agp->objects, k);
 
+  if(agp->order.built){
+    agp->order.objects[object->rank] = NULL;
+    agp->order.holes++;
   }
+  __unlock(agp);
 
-  return ret;
+  if(object->key)
+    __key_free(agp, object);
+  free(object);
 }
 
-int agp_graph_print (agp_graph_t * agp, FILE* out){
-  int size = kh_size(agp->objects);
-  int ret = 0;
-  agp_scaffold_t ** objects = __sorted_objects(agp);  
+agp_object_t * agp_graph_object(agp_graph_t * agp, str_id_t name){
+  agp_object_t * object = NULL;
 
-  int i;
-  for(i = 0; i < size; i++){
-    int num = 1;
-    int pos = 0;
+  __lock(agp);
+  khiter_t k = kh_get(agp_object, agp->objects, name);
+  if(k != kh_end(agp->objects))
+    object = kh_val(agp->objects, k);
+  __unlock(agp);
 
-    agp_scaffold_t* record = objects[i];
-    while(record != NULL){
+  return object;
+}
 
-      /* Adjust record for any changes made */
-      record->num = num++;
-      record->object.start = ++pos;
+int agp_graph_shared(agp_graph_t * agp, agp_object_t * object){
+  return agp->base && agp_graph_object(agp->base, object->name) == object;
+}
 
-      if(record->type == 'U' || record->type == 'N')
-        pos += record->component.gap.length -1 ;
-      else
-        pos += (record->component.seq.end - record->component.seq.start);
+/* contig index. Components of a contig are few, so records are kept
+   sorted by insertion */
+#define __index_before(a, b)                                            \
+  ((a)->component.seq.start < (b)->component.seq.start ||              \
+   ((a)->component.seq.start == (b)->component.seq.start &&            \
+    (a)->component.seq.end < (b)->component.seq.end))
+
+/* position of the first record not before record */
+static size_t __index_find(agp_contig_index_t * index,
+                           agp_scaffold_t * record){
+  size_t lo = 0, hi = index->n;
+
+  while(lo < hi){
+    size_t mid = lo + (hi - lo) / 2;
+    if(__index_before(index->records[mid], record))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* index of a contig, or NULL. A fork looks in its base for the
+   contigs it hasn't changed */
+static agp_contig_index_t * __index_lookup(agp_graph_t * agp,
+                                           str_id_t contig){
+  khiter_t k = kh_get(agp_contig, agp->contigs, contig);
+
+  if(k != kh_end(agp->contigs))
+    return kh_value(agp->contigs, k);
+  return agp->base ? __index_lookup(agp->base, contig) : NULL;
+}
+
+/* index of a contig to change, made if needed. A fork starts from a
+   copy of its base's. The caller holds the lock */
+static agp_contig_index_t * __index_get(agp_graph_t * agp, str_id_t contig){
+  int ret;
+  khiter_t k = kh_put(agp_contig, agp->contigs, contig, &ret);
+
+  if(ret != 0){
+    agp_contig_index_t * index = calloc(1, sizeof(agp_contig_index_t));
+    agp_contig_index_t * base =
+      agp->base ? __index_lookup(agp->base, contig) : NULL;
+
+    if(base && base->n){
+      index->records = malloc(sizeof(agp_scaffold_t*) * base->n);
+      if(!index->records){
+        error_fail("Out of memory while indexing contigs\n");
+      }
+      memcpy(index->records, base->records,
+             sizeof(agp_scaffold_t*) * base->n);
+      index->n = index->m = base->n;
+    }
+    kh_value(agp->contigs, k) = index;
+  }
+
+  return kh_value(agp->contigs, k);
+}
 
-      record->object.end = pos;
+static void __index_add(agp_graph_t * agp, agp_scaffold_t * record){
+  __lock(agp);
+  agp_contig_index_t * index = __index_get(agp, record->component.seq.name);
 
-      ret += __agp_print_record(out, record);
-      record = record->next;
+  if(index->n == index->m){
+    index->m = index->m ? index->m * 2 : 4;
+    index->records = realloc(index->records,
+                             sizeof(agp_scaffold_t*) * index->m);
+    if(!index->records){
+      error_fail("Out of memory while indexing contigs\n");
     }
+  }
+
+  size_t i = __index_find(index, record);
+  memmove(index->records + i + 1, index->records + i,
+          sizeof(agp_scaffold_t*) * (index->n - i));
+  index->records[i] = record;
+  index->n++;
+  __unlock(agp);
+}
 
+static void __index_remove(agp_graph_t * agp, agp_scaffold_t * record){
+  __lock(agp);
+  khiter_t k = kh_get(agp_contig, agp->contigs, record->component.seq.name);
+
+  if(k != kh_end(agp->contigs)){
+    agp_contig_index_t * index = kh_value(agp->contigs, k);
+
+    size_t i = __index_find(index, record);
+    while(i < index->n && index->records[i] != record)
+      i++;
+
+    if(i < index->n){
+      memmove(index->records + i, index->records + i + 1,
+              sizeof(agp_scaffold_t*) * (index->n - i - 1));
+      index->n--;
+    }
   }
 
+  __unlock(agp);
+}
+
+/* drop a sequence component from the hash and contig index. A fork
+   keeps the key, as NULL, so it isn't found in the base */
+static void __component_remove(agp_graph_t * agp, agp_scaffold_t * record){
+  __lock(agp);
+  khiter_t k = kh_get(agp_component, agp->components,
+                      __seq_key(&record->component.seq));
+
+  if(k != kh_end(agp->components) && kh_val(agp->components, k) == record){
+    if(agp->base)
+      kh_val(agp->components, k) = NULL;
+    else
+      kh_del(agp_component, agp->components, k);
+  }
+  __unlock(agp);
+
+  __index_remove(agp, record);
+}
+
+/* put a sequence component in the hash. A key that is already taken
+   keeps its record, and -1 is returned. For a fork, a key is taken if
+   it holds a record, or if the base still has it */
+static int __component_put(agp_graph_t * agp, agp_scaffold_t * record){
+  agp_component_key_t key = __seq_key(&record->component.seq);
+  int ret;
+
+  __lock(agp);
+  khiter_t k = kh_put(agp_component, agp->components, key, &ret);
+
+  if(ret == 0 && !kh_val(agp->components, k))
+    ret = 1;
+  else if(ret != 0 && agp->base && agp_graph_component(agp->base, key)){
+    kh_del(agp_component, agp->components, k);
+    ret = 0;
+  }
+
+  if(ret != 0)
+    kh_value(agp->components, k) = record;
+  __unlock(agp);
+
+  return ret == 0 ? -1 : 0;
+}
+
+/* (re)add a sequence component, to the hash and the contig index */
+static int __component_add(agp_graph_t * agp, agp_scaffold_t * record){
+  int ret = __component_put(agp, record);
+
+  __index_add(agp, record);
   return ret;
 }
 
-agp_scaffold_t* agp_graph_component(agp_graph_t* agp, char* comp){
+/* tree engine helpers */
+
+/* make a record a tree of its own, with a new node */
+static void __tree_node(agp_graph_t * agp, agp_scaffold_t * record){
+  __node_alloc(agp, record);
+  agp_tree_node(record);
+}
+
+static void __tree_set_root(agp_object_t * object, agp_scaffold_t * root){
+  object->root   = root;
+  object->count  = agp_tree_size(root);
+  object->length = root ? root->tree.node->span : 0;
+  if(root) root->object = object;
+}
+
+/* tree over the list of an object, with new nodes */
+static void __tree_build(agp_graph_t * agp, agp_object_t * object){
+  agp_scaffold_t * cur;
+
+  for(cur = object->head; cur != NULL; cur = cur->next)
+    __node_alloc(agp, cur);
+  __tree_set_root(object, agp_tree_build(object->head));
+}
+
+/* object holding a record, and its position there */
+static agp_object_t * __tree_locate(agp_scaffold_t * record, size_t * rank){
+  agp_scaffold_t * root;
+  *rank = agp_tree_rank(record, &root);
+  return root->object;
+}
+
+/* cut an object around the records [i, j]: before, the flanking
+   records, the segment and after. The flanks must be gaps */
+static agp_scaffold_t * __tree_cut(agp_object_t * object, size_t i, size_t j,
+                                   agp_scaffold_t ** before,
+                                   agp_scaffold_t * flanks[2],
+                                   agp_scaffold_t ** after){
+  agp_scaffold_t * rest, * segment;
+
+  agp_tree_split(object->root, j + 1, &rest, after);
+  agp_tree_split(rest, i, before, &segment);
+
+  flanks[0] = flanks[1] = NULL;
+  if(*before)
+    agp_tree_split(*before, agp_tree_size(*before) - 1, before, &flanks[0]);
+  if(*after)
+    agp_tree_split(*after, 1, &flanks[1], after);
+
+  if((flanks[0] && !agp_is_gap(flanks[0])) ||
+     (flanks[1] && !agp_is_gap(flanks[1]))) {
+    error_fail("AGP file must be Sequence - Gap - Sequence. The range "
+               "specified isn't flanked by gaps\n");
+  }
+
+  return segment;
+}
+
+/* Forks. The base is flattened, renumbered and ordered when it gets
+   its first fork, so that forks only ever read it: with the tree
+   engine, nothing is left to push down its trees */
+agp_graph_t * agp_graph_fork(agp_graph_t * base){
+  pthread_mutex_lock(&base->lock);
+  if(base->forks++ == 0){
+    agp_graph_renumber(base);
+    __order_update(base);
+  }
+  pthread_mutex_unlock(&base->lock);
+
+  agp_graph_t * fork = agp_graph_init();
+  fork->base        = base;
+  fork->engine      = base->engine;
+  fork->order.order = base->order.order;
+
+  /* the object hash is copied as it is */
+  khash_t(agp_object) * from = base->objects, * to = fork->objects;
+  khint_t n = kh_n_buckets(from);
+
+  if(n > 0){
+    if(kh_resize(agp_object, to, n) != 0 || kh_n_buckets(to) != n){
+      error_fail("Out of memory while forking the graph\n");
+    }
+    memcpy(to->flags, from->flags, __ac_fsize(n) * sizeof(khint32_t));
+    memcpy(to->keys, from->keys, n * sizeof(*to->keys));
+    memcpy(to->vals, from->vals, n * sizeof(*to->vals));
+    to->size       = from->size;
+    to->n_occupied = from->n_occupied;
+  }
+
+  return fork;
+}
+
+/* point a fork's component hash and contig index at the copy of a
+   record of its base */
+static void __component_copy(agp_graph_t * agp, agp_scaffold_t * record,
+                             agp_scaffold_t * copy){
+  int ret;
+
+  __lock(agp);
+  khiter_t k = kh_put(agp_component, agp->components,
+                      __seq_key(&copy->component.seq), &ret);
+  kh_value(agp->components, k) = copy;
+
+  agp_contig_index_t * index = __index_get(agp, copy->component.seq.name);
+  size_t i = __index_find(index, record);
+  while(i < index->n && index->records[i] != record)
+    i++;
+  if(i < index->n)
+    index->records[i] = copy;
+  __unlock(agp);
+}
+
+agp_object_t * agp_graph_own(agp_graph_t * agp, str_id_t name){
+  agp_object_t * shared = agp_graph_object(agp, name);
+  agp_scaffold_t * cur, * copy, * last = NULL;
+
+  if(!shared || !agp_graph_shared(agp, shared))
+    return shared;
+
+  agp_object_t * object = calloc(1, sizeof(agp_object_t));
+  if(!object){
+    error_fail("Out of memory while copying %s\n", str_pool_get(name));
+  }
+  object->name = name;
+
+  __lock(agp);
+  kh_value(agp->objects, kh_get(agp_object, agp->objects, name)) = object;
+  __unlock(agp);
+
+  /* the base's lists are up to date, whatever its engine */
+  for(cur = shared->head; cur != NULL; cur = cur->next){
+    copy = agp_graph_alloc(agp);
+    *copy = *cur;
+    copy->prev = last;
+    copy->next = NULL;
+
+    if(last)
+      last->next = copy;
+    else
+      object->head = copy;
+    last = copy;
+
+    __object_add(object, copy);
+    if(copy->type == 'W')
+      __component_copy(agp, cur, copy);
+  }
+  object->tail = last;
+
+  if(agp->engine == AGP_ENGINE_TREE)
+    __tree_build(agp, object);
+
+  return object;
+}
+
+void agp_graph_set_engine(agp_graph_t * agp, agp_engine_t engine){
+  khiter_t k;
+
+  if(agp->engine == engine)
+    return;
+
+  if(engine == AGP_ENGINE_LIST)
+    agp_graph_flatten(agp);
+
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++){
+    if (!kh_exist(agp->objects, k)) continue;
+    agp_object_t * object = kh_value(agp->objects, k);
+
+    /* objects of the base are flat, and have trees if the base does */
+    if(agp_graph_shared(agp, object)){
+      if(engine == AGP_ENGINE_LIST || agp->base->engine == AGP_ENGINE_TREE)
+        continue;
+      object = agp_graph_own(agp, object->name);
+    }
+
+    if(engine == AGP_ENGINE_TREE)
+      __tree_build(agp, object);
+    else
+      object->root = NULL;
+  }
+
+  if(engine == AGP_ENGINE_LIST)
+    __node_free_all(agp);
+  agp->engine = engine;
+}
+
+void agp_graph_flatten(agp_graph_t * agp){
+  khiter_t k;
+
+  if(agp->engine != AGP_ENGINE_TREE)
+    return;
+
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++)
+    if (kh_exist(agp->objects, k))
+      agp_graph_flatten_object(agp, kh_value(agp->objects, k));
+}
+
+void agp_graph_count_walks(agp_graph_t * agp, size_t * counter){
+  agp->walked = counter;
+  agp_tree_visits = counter;
+}
+
+void agp_graph_flatten_object(agp_graph_t * agp, agp_object_t * object){
+  if(agp->engine == AGP_ENGINE_TREE && !agp_graph_shared(agp, object))
+    agp_tree_flatten(object->root, object);
+}
+
+void agp_graph_remove_object(agp_graph_t * agp, str_id_t name){
+  agp_object_t * object = agp_graph_own(agp, name);
+  if(!object)
+    return;
+
+  agp_graph_flatten_object(agp, object);
+
+  agp_scaffold_t * cur = object->head;
+  while(cur){
+    agp_scaffold_t * next = cur->next;
+    if(cur->type == 'W')
+      __component_remove(agp, cur);
+    agp_graph_release(agp, cur);
+    cur = next;
+  }
+
+  __object_delete(agp, object);
+}
+
+agp_object_t * agp_graph_record_object(agp_graph_t * agp,
+                                       agp_scaffold_t * record){
+  if(agp->engine == AGP_ENGINE_TREE){
+    while(record->tree.node->parent)
+      record = record->tree.node->parent;
+  }
+  return record->object;
+}
+
+agp_scaffold_t * agp_graph_last(agp_graph_t * agp, agp_scaffold_t * record){
+  agp_object_t * object = agp_graph_record_object(agp, record);
+
+  if(agp->engine == AGP_ENGINE_TREE)
+    return agp_tree_at(object->root, object->count - 1);
+  return object->tail;
+}
+
+agp_scaffold_t * agp_graph_first(agp_graph_t * agp, agp_object_t * object){
+  if(agp->engine == AGP_ENGINE_TREE)
+    return agp_tree_at(object->root, 0);
+  return object->head;
+}
+
+agp_scaffold_t * agp_graph_neighbor(agp_graph_t * agp,
+                                    agp_scaffold_t * record,
+                                    int direction){
+  if(agp->engine == AGP_ENGINE_TREE){
+    size_t i;
+    agp_object_t * object = __tree_locate(record, &i);
+
+    if(direction == 1)
+      return i + 1 < object->count ? agp_tree_at(object->root, i + 1) : NULL;
+    return i > 0 ? agp_tree_at(object->root, i - 1) : NULL;
+  }
+
+  return direction == 1 ? record->next : record->prev;
+}
+
+long agp_graph_distance(agp_graph_t * agp, agp_scaffold_t * left,
+                        agp_scaffold_t * right){
+  if(agp->engine == AGP_ENGINE_TREE){
+    agp_scaffold_t * roots[2];
+    size_t i = agp_tree_rank(left, &roots[0]);
+    size_t j = agp_tree_rank(right, &roots[1]);
+
+    if(roots[0] != roots[1] || j < i)
+      return -1;
+    return (long) (j - i + 1);
+  }
+
+  long ret = 1;
+  agp_scaffold_t* cur = left;
+  while(cur && cur != right){
+    ret++;
+    __walk(agp);
+    cur = cur->next;
+  }
+
+  return cur ? ret : -1;
+}
+
+int agp_graph_append(agp_graph_t * graph, str_id_t name,
+                     agp_scaffold_t * record){
+  /* If sequence, add current record to the component (sequence)
+     lookup hash */
+  if(record->type == 'W'){
+    if(__component_put(graph, record) != 0)
+      return -1;
+    __index_add(graph, record);
+  }
+
+  /* Add current record to the end of the object (scaffold) linked
+     list */
+  agp_object_t * object = agp_graph_own(graph, name);
+  if(!object)
+    object = __object_create(graph, name);
+
+  if(graph->engine == AGP_ENGINE_TREE){
+    __tree_node(graph, record);
+    __tree_set_root(object, agp_tree_join(object->root, record));
+    return 0;
+  }
+
+  record->next = NULL;
+  record->prev = object->tail;
+
+  if(object->tail)
+    object->tail->next = record;
+  else
+    object->head = record;
+  object->tail = record;
+
+  __object_add(object, record);
+
+  return 0;
+}
+
+void agp_graph_destroy(agp_graph_t* agp){
+  size_t i;
+  khiter_t k;
+
+  /* every record, linked or released, lives in one of the blocks */
+  for(i = 0; i < agp->records.n_blocks; i++)
+    free(agp->records.blocks[i]);
+  free(agp->records.blocks);
+  if(agp->records.mapped)
+    munmap(agp->records.mapped, agp->records.mapped_size);
+  __node_free_all(agp);
+
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++)
+    if (kh_exist(agp->objects, k) &&
+        !agp_graph_shared(agp, kh_value(agp->objects, k))){
+      if(kh_value(agp->objects, k)->key)
+        __key_free(agp, kh_value(agp->objects, k));
+      free(kh_value(agp->objects, k));
+    }
+  free(agp->order.objects);
+
+  for (k = kh_begin(agp->contigs); k != kh_end(agp->contigs); k++)
+    if (kh_exist(agp->contigs, k)){
+      free(kh_value(agp->contigs, k)->records);
+      free(kh_value(agp->contigs, k));
+    }
+
+  kh_destroy(agp_object, agp->objects);
+  kh_destroy(agp_component, agp->components);
+  kh_destroy(agp_contig, agp->contigs);
+  pthread_mutex_destroy(&agp->lock);
+
+  if(agp->base){
+    pthread_mutex_lock(&agp->base->lock);
+    agp->base->forks--;
+    pthread_mutex_unlock(&agp->base->lock);
+  }
+  free(agp);
+}
+
+/* bytes of a khash table */
+#define __hash_bytes(h)                                                 \
+  (kh_n_buckets(h) * (sizeof(*(h)->keys) + sizeof(*(h)->vals)) +        \
+   (kh_n_buckets(h) < 16 ? 1 : kh_n_buckets(h) >> 4) * sizeof(khint32_t))
+
+agp_graph_stats_t agp_graph_stats(agp_graph_t * agp){
+  agp_graph_stats_t stats;
+  agp_scaffold_t * cur;
+  khiter_t k;
+  size_t records = 0;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.objects   = kh_size(agp->objects);
+  stats.sequences = kh_size(agp->components);
+  stats.contigs   = kh_size(agp->contigs);
+
+  stats.object_buckets    = kh_n_buckets(agp->objects);
+  stats.component_buckets = kh_n_buckets(agp->components);
+  stats.contig_buckets    = kh_n_buckets(agp->contigs);
+
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++)
+    if (kh_exist(agp->objects, k))
+      records += kh_value(agp->objects, k)->count;
+  stats.gaps = records - stats.sequences;
+
+  for(cur = agp->records.free; cur != NULL; cur = cur->next)
+    stats.released++;
+
+  stats.bytes = agp->records.n_blocks * AGP_SLAB_BLOCK * sizeof(agp_scaffold_t) +
+    agp->nodes.n_blocks * AGP_SLAB_BLOCK * sizeof(agp_tree_node_t) +
+    agp->nodes.m_free * sizeof(agp_tree_node_t*) + agp->records.mapped_size + stats.objects * sizeof(agp_object_t) +
+    __hash_bytes(agp->objects) + __hash_bytes(agp->components) +
+    __hash_bytes(agp->contigs) + agp->order.m * sizeof(agp_object_t*);
+
+  for (k = kh_begin(agp->contigs); k != kh_end(agp->contigs); k++)
+    if (kh_exist(agp->contigs, k))
+      stats.bytes += sizeof(agp_contig_index_t) +
+        kh_value(agp->contigs, k)->m * sizeof(agp_scaffold_t*);
+
+  return stats;
+}
+
+/* A fork sorts the objects it made or copied, and merges them with
+   the objects it still shares, in the order of its base */
+static agp_object_t ** __fork_sorted_objects(agp_graph_t * agp){
+  agp_object_order_t * order = &agp->base->order;
+  size_t n = kh_size(agp->objects), own = 0, i, j, k;
+  agp_object_t ** objects = malloc(sizeof(agp_object_t*) * (n + 1));
+  agp_object_t ** sorted  = malloc(sizeof(agp_object_t*) * (n + 1));
+  khiter_t it;
+
+  if(!objects || !sorted){
+    error_fail("Out of memory while ordering objects\n");
+  }
+
+  for (it = kh_begin(agp->objects); it != kh_end(agp->objects); it++){
+    if (!kh_exist(agp->objects, it)) continue;
+    agp_object_t * object = kh_value(agp->objects, it);
+
+    if(agp_graph_shared(agp, object))
+      continue;
+    if(!object->key)
+      __key_make(agp, object);
+    objects[own++] = object;
+  }
+  qsort(objects, own, sizeof(agp_object_t*), __order_qsort_cmp);
+
+  for(i = 0, j = 0, k = 0; k < n; k++){
+    while(j < order->n &&
+          agp_graph_object(agp, order->objects[j]->name) != order->objects[j])
+      j++;
+
+    if(j == order->n || (i < own &&
+                         __order_cmp(objects[i], order->objects[j]) < 0))
+      sorted[k] = objects[i++];
+    else
+      sorted[k] = order->objects[j++];
+  }
+
+  free(objects);
+  return sorted;
+}
+
+agp_object_t ** agp_graph_sorted_objects(agp_graph_t* agp){
+  if(agp->base)
+    return __fork_sorted_objects(agp);
+  __order_update(agp);
+
+  agp_object_t ** objects =
+    malloc(sizeof(agp_object_t*) * (agp->order.n + 1));
+  memcpy(objects, agp->order.objects, sizeof(agp_object_t*) * agp->order.n);
+
+  return objects;
+}
+
+void agp_graph_set_order(agp_graph_t * agp, agp_order_t order){
+  agp_object_order_t * index = &agp->order;
+  size_t i;
+
+  if(index->order == order)
+    return;
+
+  /* keys are made again, and everything sorted on next use */
+  for(i = 0; i < index->n; i++)
+    if(index->objects[i]){
+      __key_free(agp, index->objects[i]);
+      index->objects[i]->key = NULL;
+    }
+  free(index->objects);
+  memset(index, 0, sizeof(*index));
+  index->order = order;
+}
+
+agp_scaffold_t* agp_graph_component(agp_graph_t* agp,
+                                    agp_component_key_t key){
   khiter_t k;
   agp_scaffold_t * ret = NULL;
 
-  k = kh_get(agp_graph, agp->components, comp);
+  __lock(agp);
+  k = kh_get(agp_component, agp->components, key);
   if(k != kh_end(agp->components))
     ret = kh_val(agp->components, k);
+  else if(agp->base)
+    ret = agp_graph_component(agp->base, key);
+  __unlock(agp);
 
   return ret;
 }
 
-agp_scaffold_t *  __agp_create_gap(char* object){
-    agp_scaffold_t * gap = malloc(sizeof(agp_scaffold_t));
+static int __parse_position(const char* s, const char* end,
+                            unsigned long* value){
+  if(s == end)
+    return -1;
+
+  *value = 0;
+  for(; s < end; s++){
+    unsigned int digit = (unsigned char) *s - '0';
+    if(digit > 9 || *value > (ULONG_MAX - digit) / 10)
+      return -1;
+    *value = *value * 10 + digit;
+  }
+
+  return 0;
+}
+
+int agp_component_key_parse(const char* token, agp_component_key_t* key){
+  const char * colon = strrchr(token, ':');
+  if(!colon)
+    return -1;
+
+  const char * dash = strchr(colon, '-');
+  if(!dash)
+    return -1;
+
+  key->name = str_pool_find(token, colon - token);
+  if(key->name == STR_ID_NONE)
+    return -1;
 
-    strncpy(gap->object.name, object, 255);
+  if(__parse_position(colon + 1, dash, &key->start) != 0 ||
+     __parse_position(dash + 1, dash + strlen(dash), &key->end) != 0)
+    return -1;
+
+  return 0;
+}
+
+agp_scaffold_t* agp_graph_component_at(agp_graph_t* agp, str_id_t contig,
+                                       unsigned long pos){
+  agp_scaffold_t * ret = NULL;
+
+  __lock(agp);
+  agp_contig_index_t * index = __index_lookup(agp, contig);
+  if(!index){
+    __unlock(agp);
+    return NULL;
+  }
+
+  /* last component starting at or before pos */
+  size_t lo = 0, hi = index->n;
+  while(lo < hi){
+    size_t mid = lo + (hi - lo) / 2;
+    if(index->records[mid]->component.seq.start <= pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  while(lo > 0){
+    agp_scaffold_t * record = index->records[--lo];
+    if(record->component.seq.end >= pos){
+      ret = record;
+      break;
+    }
+  }
+  __unlock(agp);
+
+  return ret;
+}
+
+int agp_component_ref_parse(const char* token, agp_component_ref_t* ref){
+  const char * at = strrchr(token, '@');
+
+  ref->at = 0;
+  if(agp_component_key_parse(token, &ref->key) == 0)
+    return 0;
+  if(!at)
+    return -1;
+
+  ref->at = 1;
+  ref->key.name = str_pool_find(token, at - token);
+  if(ref->key.name == STR_ID_NONE ||
+     __parse_position(at + 1, at + strlen(at), &ref->key.start) != 0 ||
+     ref->key.start == 0)
+    return -1;
+  ref->key.end = ref->key.start;
+
+  return 0;
+}
+
+agp_scaffold_t* agp_graph_resolve(agp_graph_t* agp,
+                                  const agp_component_ref_t* ref){
+  if(ref->at)
+    return agp_graph_component_at(agp, ref->key.name, ref->key.start);
+  return agp_graph_component(agp, ref->key);
+}
+
+/* the gap put between records joined by an edit */
+static void __gap_defaults(agp_graph_t * agp, agp_scaffold_t * gap){
     gap->type = 'U';
     gap->component.gap.length = 100;
-    strcpy(gap->component.gap.type,     "scaffold");
+    gap->component.gap.type     = agp->gap_type;
     strcpy(gap->component.gap.linkage,  "yes");
-    strcpy(gap->component.gap.evidence, "na");
+    gap->component.gap.evidence = agp->gap_evidence;
+}
+
+/* default gap, already counted in the given object */
+agp_scaffold_t *  __agp_create_gap(agp_graph_t * agp, agp_object_t * object){
+    agp_scaffold_t * gap = agp_graph_alloc(agp);
+
+    __gap_defaults(agp, gap);
 
     gap->next = NULL;
     gap->prev = NULL;
-    
+
+    __object_add(object, gap);
+    if(agp->engine == AGP_ENGINE_TREE)
+      __tree_node(agp, gap);
+
     return gap;
 }
 
 /* remove the segment between left and right from the graph, returning
    the start (left) of the isolated segment; */
+static agp_scaffold_t * __tree_isolate(agp_graph_t *agp,
+                                       agp_scaffold_t * left,
+                                       agp_scaffold_t * right){
+  size_t i, j;
+  agp_object_t * object = __tree_locate(left, &i);
+  agp_scaffold_t *before, *after, *flanks[2];
+
+  __tree_locate(right, &j);
+  agp_scaffold_t * segment = __tree_cut(object, i, j, &before, flanks, &after);
+
+  if(flanks[0]) agp_graph_release(agp, flanks[0]);
+  if(flanks[1]) agp_graph_release(agp, flanks[1]);
+
+  if(before && after)
+    before = agp_tree_join(agp_tree_join(before,
+                                         __agp_create_gap(agp, object)),
+                           after);
+  else if(!before)
+    before = after;
+
+  if(before)
+    __tree_set_root(object, before);
+  else
+    __object_delete(agp, object);
+
+  segment->object = NULL;
+  return segment;
+}
+
 agp_scaffold_t * agp_graph_isolate(agp_graph_t *agp,
                                    agp_scaffold_t * left,
                                    agp_scaffold_t * right){
+  if(agp->engine == AGP_ENGINE_TREE)
+    return __tree_isolate(agp, left, right);
+
+  agp_object_t * object = left->object;
+
   /* Get flanking gaps */
   agp_scaffold_t * flanks [2] = {left->prev, right->next};
   agp_scaffold_t * seqs   [2] = {NULL, NULL};
   
   if((flanks[0] && flanks[0]->type != 'N' && flanks[0]->type != 'U') ||
      (flanks[1] && flanks[1]->type != 'N' && flanks[1]->type != 'U')) {
-    fprintf(stderr, "AGP file must be Sequence - Gap - Sequence. The range "
-            "specified isn't flanked by gaps\n");
-    exit(EXIT_FAILURE);
+    error_fail("AGP file must be Sequence - Gap - Sequence. The range "
+               "specified isn't flanked by gaps\n");
   }
 
   /* if left gap exists, delete gap, get seq, break connections */
@@ -268,7 +1182,8 @@ agp_scaffold_t * agp_graph_isolate(agp_graph_t *agp,
     left->prev = NULL;
 
     /* free flanking gap */
-    free(flanks[0]);
+    __object_sub(object, flanks[0]);
+    agp_graph_release(agp, flanks[0]);
   }
   
   /* if right gap exists, delete and get seq */
@@ -280,29 +1195,37 @@ agp_scaffold_t * agp_graph_isolate(agp_graph_t *agp,
     right->next = NULL;
 
     /* free flanking gap */
-    free(flanks[1]);
+    __object_sub(object, flanks[1]);
+    agp_graph_release(agp, flanks[1]);
     
   }
+
+  /* the segment no longer belongs to any object */
+  agp_scaffold_t * cur;
+  for(cur = left; cur != NULL; cur = cur->next){
+    __walk(agp);
+    __object_sub(object, cur);
+    cur->object = NULL;
+  }
   
   /* Selected components are either the start of the object, or the
      entire object. If the entire object, seqs[1] will be null and the
      object will need to be deleted. */
   if(!seqs[0]){
-    khiter_t k;
-    k = kh_get(agp_graph, agp->objects, left->object.name);
-
     if(seqs[1])
-      kh_val(agp->objects, k) = seqs[1];
+      object->head = seqs[1];
     else
-      kh_del(agp_graph, agp->objects, k);
-  } 
+      __object_delete(agp, object);
+  } else if(!seqs[1]){
+    object->tail = seqs[0];
+  }
 
 
   /* Selected components are in middle object, need to connect the two
      with new gap */                    
   if(seqs[0] && seqs[1]) {
 
-    agp_scaffold_t * gap = __agp_create_gap(left->object.name);
+    agp_scaffold_t * gap = __agp_create_gap(agp, object);
 
     gap->prev = seqs[0]; 
     seqs[0]->next = gap;
@@ -317,11 +1240,59 @@ agp_scaffold_t * agp_graph_isolate(agp_graph_t *agp,
 
 
                                            
+static void __flank_error(agp_scaffold_t * target){
+  error_fail("AGP file must be Sequence - Gap - Sequence. The after contig"
+             "specified isn't flanked by gaps: %s:%lu-%lu\n",
+             str_pool_get(target->component.seq.name),
+             target->component.seq.start, target->component.seq.end);
+}
+
+/* The flanking gap, if any, is replaced by gap, segment, gap. Without
+   one, the segment is joined to the target with a single gap */
+static void __tree_insert(agp_graph_t *agp,
+                          agp_scaffold_t * segment,
+                          agp_scaffold_t * target,
+                          int direction){
+  size_t t;
+  agp_object_t * object = __tree_locate(target, &t);
+  agp_scaffold_t *before, *after, *flank = NULL;
+
+  if(direction == 1){ /*AFTER*/
+    agp_tree_split(object->root, t + 1, &before, &after);
+    if(after) agp_tree_split(after, 1, &flank, &after);
+  } else {            /*BEFORE*/
+    agp_tree_split(object->root, t, &before, &after);
+    if(before)
+      agp_tree_split(before, agp_tree_size(before) - 1, &before, &flank);
+  }
+
+  if(flank && !agp_is_gap(flank)) __flank_error(target);
+  if(flank) agp_graph_release(agp, flank);
+
+  if(direction == 1 || flank)
+    before = agp_tree_join(before, __agp_create_gap(agp, object));
+  before = agp_tree_join(before, segment);
+  if(direction == -1 || flank)
+    before = agp_tree_join(before, __agp_create_gap(agp, object));
+
+  __tree_set_root(object, agp_tree_join(before, after));
+}
+
 /* insert isolated segment after the given scaffold */
 void agp_graph_insert(agp_graph_t *agp,
                       agp_scaffold_t * segment,
                       agp_scaffold_t * target,
                       int direction){
+  agp_object_t * object = target->object;
+
+  if(direction != 1 && direction != -1){
+    error_fail("Unexpected direction: %d\n", direction);
+  }
+
+  if(agp->engine == AGP_ENGINE_TREE){
+    __tree_insert(agp, segment, target, direction);
+    return;
+  }
  
   /* Get flanking component */
   agp_scaffold_t * flank;
@@ -329,32 +1300,29 @@ void agp_graph_insert(agp_graph_t *agp,
   case 1: flank = target->next; break;
   case -1: flank = target->prev; break;
   default: 
-    fprintf(stderr, "Unexpected direction: %d\n", direction);
-    exit(EXIT_FAILURE);
+    error_fail("Unexpected direction: %d\n", direction);
   }
 
   /* make sure component is a gap if exists */
-  if(flank && flank->type != 'N' && flank->type != 'U') {
-    fprintf(stderr, "AGP file must be Sequence - Gap - Sequence. The after contig"
-            "specified isn't flanked by gaps: %s\n", target->component.seq.key);
-    exit(EXIT_FAILURE);
-  }
+  if(flank && flank->type != 'N' && flank->type != 'U')
+    __flank_error(target);
 
 
   agp_scaffold_t * end = segment;
-  /* rename all object names to correct value */
+  /* move segment into the target's object */
   while(end->next != NULL){
-    strncpy(end->object.name, target->object.name, 255);
+    __walk(agp);
+    __object_add(object, end);
     end = end->next;
   }
-  strncpy(end->object.name, target->object.name, 255);  
+  __object_add(object, end);
   
   
   agp_scaffold_t * seq = NULL;
   /* If gap exists after given contig, get next sequence, break
      object, and remove gap. */
   if(flank) {
-    seq  = __agp_create_gap(target->object.name);
+    seq  = __agp_create_gap(agp, object);
         
     agp_scaffold_t * tmp;
     switch(direction){
@@ -372,11 +1340,12 @@ void agp_graph_insert(agp_graph_t *agp,
       break;
     }
 
-    free(flank);
+    __object_sub(object, flank);
+    agp_graph_release(agp, flank);
   }
 
   /* link segment and target */
-  agp_scaffold_t * gap = __agp_create_gap(target->object.name);
+  agp_scaffold_t * gap = __agp_create_gap(agp, object);
   if(direction == 1){ /*AFTER*/
     /* target -> gap */
     gap->prev = target; 
@@ -387,13 +1356,12 @@ void agp_graph_insert(agp_graph_t *agp,
     /* segment (end) -> target (end) */
     end->next = seq;
     if(seq) seq->prev = end;
+    else object->tail = end;
   } else if (direction == -1){ /*BEFORE*/
 
-    /* if the target is the start of the object, update hash */
+    /* if the target is the start of the object, update head */
     if(!seq) {
-      khiter_t k;
-      k = kh_get(agp_graph, agp->objects, segment->object.name);
-      kh_val(agp->objects, k) = segment;
+      object->head = segment;
     } else {
       /* seq -> seg */
       seq->next = segment;
@@ -410,19 +1378,52 @@ void agp_graph_insert(agp_graph_t *agp,
 
 }
 
+/* flanking gaps are replaced by default gaps, as with lists */
+static void __tree_reverse(agp_graph_t *agp,
+                           agp_scaffold_t * left,
+                           agp_scaffold_t * right,
+                           int complement){
+  size_t i, j;
+  agp_object_t * object = __tree_locate(left, &i);
+  agp_scaffold_t *before, *after, *flanks[2];
+
+  __tree_locate(right, &j);
+  agp_scaffold_t * segment = __tree_cut(object, i, j, &before, flanks, &after);
+
+  agp_tree_reverse(segment, complement);
+
+  if(flanks[0]){
+    agp_graph_release(agp, flanks[0]);
+    before = agp_tree_join(before, __agp_create_gap(agp, object));
+  }
+  if(flanks[1]){
+    agp_graph_release(agp, flanks[1]);
+    after = agp_tree_join(__agp_create_gap(agp, object), after);
+  }
+
+  __tree_set_root(object,
+                  agp_tree_join(agp_tree_join(before, segment), after));
+}
+
 void agp_graph_reverse(agp_graph_t *agp,
                        agp_scaffold_t * left,
                        agp_scaffold_t * right,
                        int complement){
+  if(agp->engine == AGP_ENGINE_TREE){
+    __tree_reverse(agp, left, right, complement);
+    return;
+  }
+
+  agp_object_t * object = left->object;
+
   /* Get flanking gaps */
   agp_scaffold_t * flanks [2] = {left->prev, right->next};
   agp_scaffold_t * seqs   [2] = {NULL, NULL};
   
   if((flanks[0] && flanks[0]->type != 'N' && flanks[0]->type != 'U') ||
      (flanks[1] && flanks[1]->type != 'N' && flanks[1]->type != 'U')) {
-    fprintf(stderr, "AGP file must be Sequence - Gap - Sequence. The range "
-            "specified isn't flanked by gaps\n");
-    exit(EXIT_FAILURE);
+    error_fail("AGP file must be Sequence - Gap - Sequence. The range "
+               "specified isn't flanked by gaps\n");
   }
 
   /* if left gap exists, delete gap, get seq, break connections */
@@ -434,7 +1435,8 @@ void agp_graph_reverse(agp_graph_t *agp,
     left->prev = NULL;
 
     /* free flanking gap */
-    free(flanks[0]);
+    __object_sub(object, flanks[0]);
+    agp_graph_release(agp, flanks[0]);
   }
   
   /* if right gap exists, delete and get seq */
@@ -446,7 +1448,8 @@ void agp_graph_reverse(agp_graph_t *agp,
     right->next = NULL;
 
     /* free flanking gap */
-    free(flanks[1]);
+    __object_sub(object, flanks[1]);
+    agp_graph_release(agp, flanks[1]);
     
   }
 
@@ -455,6 +1458,7 @@ void agp_graph_reverse(agp_graph_t *agp,
   agp_scaffold_t* cur = left;
   while(cur) {
     agp_scaffold_t* tmp = cur->next;
+    __walk(agp);
     cur->next = cur->prev;
     cur->prev = tmp;
 
@@ -472,11 +1476,9 @@ void agp_graph_reverse(agp_graph_t *agp,
   /* Selected components are either the start of the object, or the
      entire object. */
   if(!seqs[0]){
-    khiter_t k;
-    k = kh_get(agp_graph, agp->objects, right->object.name);
-    kh_val(agp->objects, k) = right;
+    object->head = right;
   } else{
-    agp_scaffold_t * gap = __agp_create_gap(right->object.name);
+    agp_scaffold_t * gap = __agp_create_gap(agp, object);
 
     gap->prev = seqs[0]; 
     seqs[0]->next = gap;
@@ -487,13 +1489,15 @@ void agp_graph_reverse(agp_graph_t *agp,
 
   /* Selected components are not at the end of the object */
   if(seqs[1]){
-    agp_scaffold_t * gap = __agp_create_gap(left->object.name);
+    agp_scaffold_t * gap = __agp_create_gap(agp, object);
 
     gap->next = seqs[1]; 
     seqs[1]->prev = gap;
 
     left->next = gap;
     gap->prev = left;
+  } else {
+    object->tail = left;
   }
 
 
@@ -503,92 +1507,175 @@ void agp_graph_reverse(agp_graph_t *agp,
 void agp_graph_split(agp_graph_t *agp,
                      agp_scaffold_t * segment,
                      unsigned long position){
-  int ret;
-  khiter_t k;
+  agp_object_t * object = segment->object;
 
   /* validate position is between segments start/end */
   if(position >= segment->component.seq.end ||
      position <= segment->component.seq.start) {
-        fprintf(stderr, "Position (%lu) must be between start (%lu) "
-                "and end (%lu) of segment\n", position,
-                segment->component.seq.start,
-                segment->component.seq.end);
-    exit(EXIT_FAILURE);
+        error_fail("Position (%lu) must be between start (%lu) "
+                   "and end (%lu) of segment\n", position,
+                   segment->component.seq.start,
+                   segment->component.seq.end);
   }
 
-  /* remove segment from component hash */
-  k = kh_get(agp_graph, agp->components, segment->component.seq.key);
-  kh_del(agp_graph, agp->components, k);
+  /* remove segment from component hash and contig index */
+  __component_remove(agp, segment);
+
+  /* take the segment out of its tree, it goes back in split */
+  size_t i;
+  agp_scaffold_t *before, *after;
+  if(agp->engine == AGP_ENGINE_TREE){
+    object = __tree_locate(segment, &i);
+    agp_tree_split(object->root, i, &before, &after);
+    agp_tree_split(after, 1, &segment, &after);
+  }
 
   /* create gap to insert between split segment */
-  agp_scaffold_t * gap = __agp_create_gap(segment->object.name);
+  agp_scaffold_t * gap = __agp_create_gap(agp, object);
 
   /*copy segment*/
-  agp_scaffold_t * new = malloc(sizeof(agp_scaffold_t));
+  agp_scaffold_t * new = agp_graph_alloc(agp);
   memcpy(new, segment, sizeof(agp_scaffold_t));
 
   /* change start/end for segments */
+  __object_sub(object, segment);
   segment->component.seq.end = position;
   new->component.seq.start = position + 1;
+  __object_add(object, segment);
+  __object_add(object, new);
+
+  if(agp->engine == AGP_ENGINE_TREE){
+    agp_tree_node(segment);
+    __tree_node(agp, new);
+    before = agp_tree_join(before, segment);
+    before = agp_tree_join(before, gap);
+    before = agp_tree_join(before, new);
+    __tree_set_root(object, agp_tree_join(before, after));
+  } else {
+    if(new->next) new->next->prev = new;
+
+    if(object->tail == segment)
+      object->tail = new;
+
+    /* link segments */
+    __link_segments(segment, gap);
+    __link_segments(gap, new);
+  }
 
-  /* link segments */
-  __link_segments(segment, gap);
-  __link_segments(gap, new);
-
-  /* create new keys */
-  __create_key(segment->component.seq);
-  __create_key(new->component.seq);
+  /* add both segments to the hash */
+  if(__component_add(agp, segment) != 0 || __component_add(agp, new) != 0){
+    error_fail("Can't parse agp file: sequence component "
+               "segment found more than once\n");
+  }
+}
 
-  /* add start segment to hash */
-  k = kh_put(agp_graph, agp->components,
-             segment->component.seq.key, &ret);
+void agp_graph_unsplit(agp_graph_t *agp, agp_scaffold_t * segment){
+  agp_scaffold_t * gap = agp_graph_neighbor(agp, segment, 1);
+  agp_scaffold_t * new = gap ? agp_graph_neighbor(agp, gap, 1) : NULL;
+
+  if(!gap || !agp_is_gap(gap) || !new || new->type != 'W' ||
+     new->component.seq.name != segment->component.seq.name ||
+     new->component.seq.orientation != segment->component.seq.orientation ||
+     new->component.seq.start != segment->component.seq.end + 1){
+    error_fail("Cannot join %s:%lu-%lu: it isn't followed by the rest "
+               "of its sequence\n",
+               str_pool_get(segment->component.seq.name),
+               segment->component.seq.start, segment->component.seq.end);
+  }
 
-  if(ret == 0){
-    fprintf(stderr, "Can't parse agp file: sequence component "
-            "segment found more than once\n");
-    exit(EXIT_FAILURE);
+  __component_remove(agp, segment);
+  __component_remove(agp, new);
+
+  agp_object_t * object = segment->object;
+  /* the three records come out of the tree, the segment goes back */
+  size_t i;
+  agp_scaffold_t *before, *after, *cut;
+  if(agp->engine == AGP_ENGINE_TREE){
+    object = __tree_locate(segment, &i);
+    agp_tree_split(object->root, i, &before, &after);
+    agp_tree_split(after, 3, &cut, &after);
+  } else {
+    segment->next = new->next;
+    if(new->next)
+      new->next->prev = segment;
+    else
+      object->tail = segment;
   }
 
-  kh_value(agp->components, k) = segment;
+  __object_sub(object, segment);
+  __object_sub(object, gap);
+  __object_sub(object, new);
+  segment->component.seq.end = new->component.seq.end;
+  __object_add(object, segment);
+
+  agp_graph_release(agp, gap);
+  agp_graph_release(agp, new);
 
-  /* add end segment to hash */
-  k = kh_put(agp_graph, agp->components,
-             new->component.seq.key, &ret);
+  if(agp->engine == AGP_ENGINE_TREE){
+    agp_tree_node(segment);
+    __tree_set_root(object, agp_tree_join(agp_tree_join(before, segment),
+                                          after));
+  }
 
-  if(ret == 0){
-    fprintf(stderr, "Can't parse agp file: sequence component "
-            "segment found more than once\n");
-    exit(EXIT_FAILURE);
+  if(__component_add(agp, segment) != 0){
+    error_fail("Can't parse agp file: sequence component "
+               "segment found more than once\n");
   }
+}
+
+void agp_graph_set_gap(agp_graph_t *agp, agp_scaffold_t * gap,
+                       char type, const agp_gapinfo_t * info){
+  agp_object_t * object = gap->object;
+  size_t i;
 
-  kh_value(agp->components, k) = new;
+  if(agp->engine == AGP_ENGINE_TREE)
+    object = __tree_locate(gap, &i);
+
+  __object_sub(object, gap);
+  gap->type = type;
+  gap->component.gap = *info;
+  __object_add(object, gap);
+
+  if(agp->engine == AGP_ENGINE_TREE){
+    agp_tree_update(gap);
+    __tree_set_root(object, object->root);
+  }
 }
 
 
 void agp_graph_create(agp_graph_t *agp,
                       char* object,
                       agp_scaffold_t * segment){
+  agp_graph_create_object(agp, __intern(object), segment);
+}
 
+void agp_graph_create_object(agp_graph_t *agp,
+                             str_id_t object,
+                             agp_scaffold_t * segment){
+
+  agp_object_t * created = __object_create(agp, object);
+
+  if(!created){
+    error_fail("Cannot create object: %s already exists\n",
+               str_pool_get(object));
+  }
+
+  if(agp->engine == AGP_ENGINE_TREE){
+    __tree_set_root(created, segment);
+    return;
+  }
 
   agp_scaffold_t * cur = segment;
-  /* rename all object names to correct value */
+  /* move segment into the new object */
   while(cur->next != NULL){
-    strncpy(cur->object.name, object, 255);
+    __walk(agp);
+    __object_add(created, cur);
     cur = cur->next;
   }
-  strncpy(cur->object.name, object, 255);  
-
-  khiter_t k;
-  int ret;
-  k = kh_put(agp_graph, agp->objects,
-             segment->object.name, &ret);
-    
-  if(ret == 0){
-    fprintf(stderr, "Cannot create object: %s already exists\n", object);
-    exit(EXIT_FAILURE);
-  }
-  kh_value(agp->objects, k) = segment;
+  __object_add(created, cur);
 
+  created->head = segment;
+  created->tail = cur;
 }
 
 agp_scaffold_t * __next_sequence(agp_scaffold_t* cur){
@@ -607,7 +1694,7 @@ int __is_contiguous(agp_scaffold_t* a, agp_scaffold_t* b){
   if(a->type != 'W' || a->type != b->type)
     return 0;
        
-  if(strcmp(a->component.seq.name, b->component.seq.name) != 0)
+  if(a->component.seq.name != b->component.seq.name)
     return 0;
 
   if(a->component.seq.orientation != b->component.seq.orientation)
@@ -623,47 +1710,146 @@ int __is_contiguous(agp_scaffold_t* a, agp_scaffold_t* b){
   return (diff == 1);
 }
 
-int agp_graph_simplify(agp_graph_t* agp){
-  int size = kh_size(agp->objects);
-  int ret = 0;
-  agp_scaffold_t ** objects = __sorted_objects(agp);  
+/* Simplifying. Objects are independent, so each is merged in a single
+   pass over its records, spread over threads. A run of contiguous
+   sequences becomes its first record: the gaps inside the run and the
+   other sequences are released, and the gap after each merged
+   sequence is reset to the default gap (as isolating it would do). The
+   component hash and contig index are only touched once per record of
+   the run. */
+typedef struct {
+  agp_graph_t * graph;
+  agp_object_t ** objects;
+  int * combined;
+} agp_simplify_job_t;
+
+/* give back the records from head to tail, already unlinked, at once */
+static void __release_segment(agp_graph_t * agp, agp_scaffold_t * head,
+                              agp_scaffold_t * tail){
+  __lock(agp);
+  tail->next = agp->records.free;
+  agp->records.free = head;
+  __unlock(agp);
+}
 
-  int i;
-  for(i = 0; i < size; i++){
-    agp_scaffold_t* cur = objects[i];
-    agp_scaffold_t* next = __next_sequence(cur);
-    while(cur != NULL && next != NULL){
-      if(__is_contiguous(cur, next)){
-        ret++;
-        cur->next = next->next;
-        if(next->next) next->next->prev = cur;
-
-        /* set start and end according to orientation */
-        if(cur->component.seq.orientation == '-')
-          cur->component.seq.start = next->component.seq.start;
-        else
-          cur->component.seq.end = next->component.seq.end;
-
-        /* free gaps and next */
-        agp_scaffold_t *s,*t;
-        s = agp_graph_isolate(agp, next, next);
-        while(s){
-          t = s->next;
-          free(s);
-          s = t;
-        }
-
-
-      }else{
-        cur = next;
+/* merge the runs of one object. Returns the number of sequences merged
+   into another, or -1 if a merged sequence isn't flanked by gaps */
+static int __simplify_object(agp_graph_t * agp, agp_object_t * object){
+  agp_scaffold_t * cur = object->head, * next, * rec;
+  agp_scaffold_t * released = NULL, * last = NULL;
+  int combined = 0;
+
+  while(cur != NULL && (next = __next_sequence(cur)) != NULL){
+    if(!__is_contiguous(cur, next)){
+      cur = next;
+      continue;
+    }
+
+    /* the run starting at cur is keyed by its final extent */
+    __component_remove(agp, cur);
+    __object_sub(object, cur);
+
+    do {
+      agp_scaffold_t * after = next->next;
+
+      if(!agp_is_gap(next->prev) || (after && !agp_is_gap(after)))
+        return -1;
+
+      __component_remove(agp, next);
+      if(cur->component.seq.orientation == '-')
+        cur->component.seq.start = next->component.seq.start;
+      else
+        cur->component.seq.end = next->component.seq.end;
+
+      /* drop the gaps before next, and next */
+      for(rec = cur->next; rec != after; rec = rec->next){
+        __walk(agp);
+        __object_sub(object, rec);
+      }
+      if(last) last->next = cur->next;
+      else released = cur->next;
+      last = next;
+      cur->next = after;
+
+      if(after && after->next){
+        __object_sub(object, after);
+        __gap_defaults(agp, after);
+        __object_add(object, after);
+        after->prev = cur;
+      } else if(after){
+        /* a gap at the end of the object goes too */
+        __object_sub(object, after);
+        last->next = after;
+        last = after;
+        cur->next = NULL;
       }
 
+      combined++;
       next = __next_sequence(cur);
-    }
+    } while(next != NULL && __is_contiguous(cur, next));
+
+    __object_add(object, cur);
+    __component_add(agp, cur);
+    if(cur->next == NULL)
+      object->tail = cur;
+  }
+
+  if(released){
+    last->next = NULL;
+    __release_segment(agp, released, last);
+  }
+
+  return combined;
+}
+
+static void __simplify_task(void * data, size_t i){
+  agp_simplify_job_t * job = data;
+  job->combined[i] = __simplify_object(job->graph, job->objects[i]);
+}
+
+int agp_graph_simplify(agp_graph_t* agp){
+  return agp_graph_simplify_threads(agp, 1);
+}
+
+/* 1 if simplifying would change the object */
+static int __simplifiable(agp_object_t * object){
+  agp_scaffold_t * cur, * next;
+
+  for(cur = object->head; cur && (next = __next_sequence(cur)); cur = next)
+    if(__is_contiguous(cur, next))
+      return 1;
+  return 0;
+}
+
+int agp_graph_simplify_threads(agp_graph_t* agp, int threads){
+  agp_engine_t engine = agp->engine;
+  agp_graph_set_engine(agp, AGP_ENGINE_LIST);
+
+  int size = kh_size(agp->objects);
+  int ret = 0, i;
+  agp_object_t ** objects = agp_graph_sorted_objects(agp);
+  int * combined = malloc(sizeof(int) * (size ? size : 1));
+  agp_simplify_job_t job = { agp, objects, combined };
+
+  /* a fork copies the objects it is going to merge */
+  for(i = 0; i < size; i++)
+    if(agp_graph_shared(agp, objects[i]) && __simplifiable(objects[i]))
+      objects[i] = agp_graph_own(agp, objects[i]->name);
+
+  agp->shared = threads > 1 && size > 1;
+  parallel_for(threads, size, __simplify_task, &job);
+  agp->shared = 0;
 
+  for(i = 0; i < size; i++){
+    if(combined[i] < 0){
+      error_fail("AGP file must be Sequence - Gap - Sequence. The "
+                 "range specified isn't flanked by gaps\n");
+    }
+    ret += combined[i];
   }
 
+  free(combined);
   free(objects);
+  agp_graph_set_engine(agp, engine);
   return ret;
-  
 }
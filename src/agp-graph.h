@@ -3,24 +3,34 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "klib/khash.h"
+#include "str-pool.h"
 
+/* names are interned in the global string pool (str-pool.h), so
+   records only hold ids */
 typedef struct {
-  char name [256], key[1024];
-  unsigned long start, end;
+  str_id_t name;
   char orientation;
+  unsigned long start, end;
 } agp_seqinfo_t;
 typedef struct {
   unsigned int length;
-  char type [128];
+  str_id_t type;
   char linkage[4];
-  char evidence [128];
+  str_id_t evidence;
 } agp_gapinfo_t;
-  
+
+
+struct AGP_OBJECT_S;
+struct AGP_TREE_NODE_S;
 
 typedef struct AGP_SCAFFOLD_S{
-  agp_seqinfo_t object;
+  /* owning object, and position on it (set by agp_graph_print) */
+  struct AGP_OBJECT_S * object;
+  unsigned long object_start, object_end;
+
   unsigned int num;
   char type;
   union {
@@ -29,25 +39,306 @@ typedef struct AGP_SCAFFOLD_S{
   } component;
 
   struct AGP_SCAFFOLD_S* next,*prev;
+
+  /* with the tree engine, the record's node in its object's tree
+     (agp-tree.h). Nodes are kept by the graph, so lists don't pay for
+     them; while the graph is a list, mark is free for whoever walks
+     all of it */
+  union {
+    struct AGP_TREE_NODE_S * node;
+    size_t mark;
+  } tree;
 } agp_scaffold_t;
 
-KHASH_DECLARE(agp_graph, kh_cstr_t, agp_scaffold_t*);
+#define agp_is_gap(r) ((r)->type == 'N' || (r)->type == 'U')
+
+/* bases covered by a record */
+static inline unsigned long agp_record_length(const agp_scaffold_t * record){
+  if(agp_is_gap(record))
+    return record->component.gap.length;
+  return record->component.seq.end - record->component.seq.start + 1;
+}
+
+/* Object (scaffold) header. Every record points to the header of the
+   object it belongs to, so moving records between objects only updates
+   that pointer, and appending is O(1) through tail. count and length
+   include gaps.
 
+   With the tree engine the records are kept in a tree under root
+   instead, and only the root's object pointer is kept up to date.
+   head, tail, next, prev and object are filled in by
+   agp_graph_flatten. */
+typedef struct AGP_OBJECT_S{
+  str_id_t name;
+  agp_scaffold_t *head, *tail;
+  agp_scaffold_t *root;
+  size_t count;
+  unsigned long length;
+
+  /* sort key and place in the object order (agp_object_order_t) */
+  const char * key;
+  size_t key_len, rank;
+} agp_object_t;
+
+/* sequence component key, written "name:start-end" in scripts */
+typedef struct {
+  str_id_t name;
+  unsigned long start, end;
+} agp_component_key_t;
+
+/* objects are keyed on the interned object name, components on their
+   (name, start, end) key */
+KHASH_DECLARE(agp_object, str_id_t, agp_object_t*);
+KHASH_DECLARE(agp_component, agp_component_key_t, agp_scaffold_t*);
+
+/* sequence components of one contig, sorted by start, for finding the
+   component holding a base */
 typedef struct {
-  khash_t(agp_graph) *objects, *components ;
+  agp_scaffold_t ** records;
+  size_t n, m;
+} agp_contig_index_t;
+
+KHASH_DECLARE(agp_contig, str_id_t, agp_contig_index_t*);
+
+/* records are carved out of large blocks owned by the graph, so the
+   whole graph is released at once. Records removed from the graph
+   (mostly gaps) are kept on a free list and reused. Records loaded
+   from a snapshot (agp-snapshot.h) stay in the snapshot's mapping,
+   which is unmapped with the graph. */
+#define AGP_SLAB_BLOCK 4096
+typedef struct {
+  agp_scaffold_t ** blocks;
+  size_t n_blocks, m_blocks, used;
+  agp_scaffold_t * free;
+
+  void * mapped;
+  size_t mapped_size;
+} agp_slab_t;
+
+/* nodes of the tree engine, in blocks like the records. They are
+   made by agp_graph_set_engine and by edits on trees, reused when
+   their records are released, and all freed when the graph goes back
+   to lists */
+typedef struct {
+  struct AGP_TREE_NODE_S ** blocks, ** free;
+  size_t n_blocks, m_blocks, used, n_free, m_free;
+} agp_node_slab_t;
+
+/* Objects are written in lexical order of their names, or in natural
+   order, where runs of digits compare as numbers (chr2 before chr10) */
+typedef enum { AGP_ORDER_LEXICAL, AGP_ORDER_NATURAL } agp_order_t;
+
+/* Objects in order. Built from the object hash when first needed, then
+   kept up to date by edits: new objects are appended after the first
+   sorted ones and merged in on the next agp_graph_sorted_objects, and
+   deleted ones leave a hole (NULL) until then. Keys are computed once
+   per object so sorting never goes back to the names */
+typedef struct {
+  agp_object_t ** objects;
+  size_t n, m, sorted, holes;
+  agp_order_t order;
+  int built;
+} agp_object_order_t;
+
+/* Linked lists make edits cost O(length of the segment). The tree
+   engine keeps each object in an implicit treap with lazy reverse and
+   complement flags, so edits cost O(log n) */
+typedef enum { AGP_ENGINE_LIST, AGP_ENGINE_TREE } agp_engine_t;
+
+typedef struct AGP_GRAPH_S {
+  khash_t(agp_object) *objects;
+  khash_t(agp_component) *components;
+  khash_t(agp_contig) *contigs;
+  agp_slab_t records;
+  agp_node_slab_t nodes;
+  agp_engine_t engine;
+  agp_object_order_t order;
+
+  /* strings of the gaps made by edits, interned up front so edits
+     never add to the string pool */
+  str_id_t gap_type, gap_evidence;
+
+  /* set while several threads edit the graph (see script_run_threads).
+     The hashes, the contig index and the slab are then guarded by
+     lock; objects are never shared between threads */
+  int shared;
+  pthread_mutex_t lock;
+
+  /* records visited by edits, if counting (see agp_graph_count_walks) */
+  size_t * walked;
+
+  /* Forks (see agp_graph_fork). A fork copies the object hash of its
+     base, but the objects and their records stay the base's until the
+     fork changes them. components and contigs only hold what the fork
+     changed, and the base is looked up for the rest; a component the
+     fork removed stays in its hash as NULL. forks counts the live forks
+     of a base */
+  struct AGP_GRAPH_S * base;
+  int forks;
 } agp_graph_t;
 
+/* read an agp file. Regular files are memory mapped and parsed in
+   place, anything else (pipes, stdin) is read in blocks. Gzip (and
+   BGZF) input is decompressed as it's read. Comment lines starting
+   with '#' are skipped. */
 agp_graph_t * agp_graph_read(FILE*);
 
+/* same as agp_graph_read, but large mapped files are tokenized on up to
+   threads threads. The result is identical to the serial reader */
+agp_graph_t * agp_graph_read_threads(FILE*, int threads);
+
+/* add the lines of an agp file held in memory (uncompressed) to the
+   graph. The buffer needn't end in a newline or be NUL terminated */
+void agp_graph_read_buffer(agp_graph_t*, const char* data, size_t size);
+
+/* empty graph, for building one record at a time */
+agp_graph_t * agp_graph_init(void);
+
+/* Copy-on-write fork of a graph, for trying a script without touching
+   (or reloading) the graph. Objects and records are shared with the
+   base until agp_graph_own copies them, which the script runner does
+   for every object an operation changes, so a fork costs its object
+   hash and the objects it changed. The first fork flattens and
+   renumbers the base; the base must not change while it has forks,
+   and forks are destroyed before it. Forks of one base can be used on
+   different threads at once. A fork keeps the order of its base */
+agp_graph_t * agp_graph_fork(agp_graph_t* base);
+
+/* give a fork its own copy of the named object before changing it,
+   and return it. Objects already its own, and objects of graphs that
+   aren't forks, are returned as they are (NULL if there is none) */
+agp_object_t * agp_graph_own(agp_graph_t*, str_id_t name);
+
+/* 1 if the object is still shared by a fork with its base. Its
+   records are then read only, and already numbered */
+int agp_graph_shared(agp_graph_t*, agp_object_t*);
+
+/* record storage owned by the graph. Released records must already be
+   unlinked from the graph */
+agp_scaffold_t * agp_graph_alloc(agp_graph_t*);
+void agp_graph_release(agp_graph_t*, agp_scaffold_t*);
+
+/* add an allocated record to the end of the named object, creating the
+   object if needed. Returns -1 if the record is a sequence component
+   already in the graph */
+int agp_graph_append(agp_graph_t*, str_id_t object, agp_scaffold_t*);
+
+/* object with the given name, or NULL */
+agp_object_t * agp_graph_object(agp_graph_t*, str_id_t name);
+
+/* switch the graph between engines. Graphs are read as lists */
+void agp_graph_set_engine(agp_graph_t*, agp_engine_t);
+
+/* fill in the list fields (head, tail, next, prev, object) from the
+   trees, so the graph can be walked as lists. Nothing to do for the
+   list engine. Any edit with the tree engine makes them stale again */
+void agp_graph_flatten(agp_graph_t*);
+
+/* count the records edits visit into counter (tree nodes with the
+   tree engine), or stop counting if it is NULL. Counting isn't thread
+   safe, so only count serial runs */
+void agp_graph_count_walks(agp_graph_t*, size_t* counter);
+
+/* same as agp_graph_flatten, for a single object */
+void agp_graph_flatten_object(agp_graph_t*, agp_object_t*);
+
+/* remove an object and release all its records. Nothing to do if there
+   is no such object */
+void agp_graph_remove_object(agp_graph_t*, str_id_t name);
+
+/* object holding a record, NULL for a record of an isolated segment */
+agp_object_t * agp_graph_record_object(agp_graph_t*, agp_scaffold_t*);
+
+/* last record of the object holding a record */
+agp_scaffold_t * agp_graph_last(agp_graph_t*, agp_scaffold_t*);
+
+/* first record of an object */
+agp_scaffold_t * agp_graph_first(agp_graph_t*, agp_object_t*);
+
+/* record next to a record in its object (direction 1), or before it
+   (direction -1). NULL at the ends of the object */
+agp_scaffold_t * agp_graph_neighbor(agp_graph_t*, agp_scaffold_t*,
+                                    int direction);
+
+/* number of records from left to right, both included, or -1 if right
+   doesn't follow left in the same object */
+long agp_graph_distance(agp_graph_t*, agp_scaffold_t* left,
+                        agp_scaffold_t* right);
+
 /* simplify graph by combining contiguous components.
    return number of components combined */
 int agp_graph_simplify(agp_graph_t*);
 
+/* same as agp_graph_simplify, with objects merged on up to threads
+   threads. The result is identical */
+int agp_graph_simplify_threads(agp_graph_t*, int threads);
+
+/* renumber and write the graph, objects in name order. Returns the
+   number of bytes written */
 int agp_graph_print(agp_graph_t*, FILE*);
+
+/* same as agp_graph_print, with objects formatted on up to threads
+   threads. The output is identical */
+int agp_graph_print_threads(agp_graph_t*, FILE*, int threads);
+
+/* same as agp_graph_print_threads, compressed to BGZF (see gzip.h),
+   with blocks also compressed on up to threads threads. Returns the
+   number of bytes before compression */
+int agp_graph_print_bgzf(agp_graph_t*, FILE*, int threads);
+
+/* set the part number and object positions of every record, as
+   printing does, without writing anything */
+void agp_graph_renumber(agp_graph_t*);
+
+/* renumber and write the records of a single object. Returns the
+   number of bytes written */
+int agp_graph_print_object(agp_graph_t*, agp_object_t*, FILE*);
+
+/* sizes of a graph, for --stats. bytes is what the graph holds:
+   records (released ones included), objects, hashes and the contig
+   index */
+typedef struct {
+  size_t objects, sequences, gaps, released, contigs;
+  size_t object_buckets, component_buckets, contig_buckets;
+  size_t bytes;
+} agp_graph_stats_t;
+
+agp_graph_stats_t agp_graph_stats(agp_graph_t*);
+
+/* objects in order (see agp_graph_set_order); the caller frees the
+   array */
+agp_object_t ** agp_graph_sorted_objects(agp_graph_t*);
+
+/* order objects are written in. Graphs start in lexical order */
+void agp_graph_set_order(agp_graph_t*, agp_order_t);
 void agp_graph_destroy(agp_graph_t*);
 
-agp_scaffold_t* agp_graph_component(agp_graph_t*, char* );
+agp_scaffold_t* agp_graph_component(agp_graph_t*, agp_component_key_t);
+
+/* parse a "name:start-end" component reference. Returns -1 if it is
+   malformed, or if the name is not known (so it can't be in any
+   graph) */
+int agp_component_key_parse(const char*, agp_component_key_t*);
+
+/* sequence component covering base pos of contig, or NULL. If
+   components of the contig overlap, the one starting last wins */
+agp_scaffold_t* agp_graph_component_at(agp_graph_t*, str_id_t contig,
+                                       unsigned long pos);
+
+/* component reference in a script, either "name:start-end" or
+   "contig@pos" for the component holding that base. For the latter,
+   at is set and key.start is the position */
+typedef struct {
+  agp_component_key_t key;
+  int at;
+} agp_component_ref_t;
+
+int agp_component_ref_parse(const char*, agp_component_ref_t*);
+agp_scaffold_t* agp_graph_resolve(agp_graph_t*, const agp_component_ref_t*);
 
+/* Editing. isolate returns a handle to the removed segment, which is
+   only meant to be given to insert or create: the first record with the
+   list engine, the root of its tree with the tree engine. */
 agp_scaffold_t* agp_graph_isolate(agp_graph_t *agp,
                                   agp_scaffold_t * left,
                                   agp_scaffold_t * right);
@@ -65,9 +356,21 @@ void agp_graph_reverse(agp_graph_t *agp,
 void agp_graph_create(agp_graph_t *agp,
                       char* object,
                       agp_scaffold_t * segment);
+void agp_graph_create_object(agp_graph_t *agp,
+                             str_id_t object,
+                             agp_scaffold_t * segment);
 
 void agp_graph_split(agp_graph_t *agp,
                       agp_scaffold_t * segment,
                       unsigned long position);
 
+/* join a sequence split by agp_graph_split with the gap and the
+   sequence that follow it */
+void agp_graph_unsplit(agp_graph_t *agp, agp_scaffold_t * segment);
+
+/* set a gap's type and gap fields, for putting back a gap an edit
+   replaced */
+void agp_graph_set_gap(agp_graph_t *agp, agp_scaffold_t * gap,
+                       char type, const agp_gapinfo_t * info);
+
 #endif // AGP_GRAPH_H_
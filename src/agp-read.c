@@ -0,0 +1,429 @@
+#include "agp-graph.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "gzip.h"
+#include "parallel.h"
+#include "error.h"
+
+/* Line being parsed. Fields are scanned in place, nothing is copied
+   until names are interned. Errors jump back to __parse_line with the
+   message and column filled in. */
+typedef struct {
+  const char *start, *end, *cur;
+
+  jmp_buf fail;
+  size_t column;
+  char error[256];
+} agp_line_t;
+
+/* Parsed line whose strings are located and hashed, but not interned
+   yet. This is the part that can run on worker threads. */
+typedef struct {
+  agp_scaffold_t record;
+  str_slice_t object, strs[2];
+  size_t line;
+} agp_raw_t;
+
+#define parse_fail(l, at, ...) do {                                      \
+    (l)->column = (size_t) ((at) - (l)->start) + 1;                      \
+    snprintf((l)->error, sizeof((l)->error), __VA_ARGS__);               \
+    longjmp((l)->fail, 1); } while (0)
+
+static void __report(size_t line, size_t column, const char * error){
+  error_fail("Can't parse agp file: line %zu, column %zu: %s\n",
+             line, column, error);
+}
+
+#define __is_sep(c) ((c) == '\t' || (c) == ' ' || (c) == '\r')
+
+/* columns are tab separated, but any run of blanks is accepted */
+static int __next_field(agp_line_t * l, const char ** field, size_t * len){
+  const char * c = l->cur;
+
+  while(c < l->end && __is_sep(*c)) c++;
+  if(c == l->end){
+    l->cur = c;
+    return 0;
+  }
+
+  *field = c;
+  while(c < l->end && !__is_sep(*c)) c++;
+  *len = c - *field;
+  l->cur = c;
+
+  return 1;
+}
+
+static const char * __expect_field(agp_line_t * l, size_t * len,
+                                   const char * what){
+  const char * field;
+  if(!__next_field(l, &field, len))
+    parse_fail(l, l->cur, "missing %s", what);
+  return field;
+}
+
+static unsigned long __expect_ulong(agp_line_t * l, const char * what){
+  size_t len, i;
+  const char * field = __expect_field(l, &len, what);
+  unsigned long value = 0;
+
+  for(i = 0; i < len; i++){
+    unsigned int digit = (unsigned char) field[i] - '0';
+    if(digit > 9)
+      parse_fail(l, field + i, "%s must be a non-negative integer", what);
+    if(value > (ULONG_MAX - digit) / 10)
+      parse_fail(l, field, "%s is too large", what);
+    value = value * 10 + digit;
+  }
+
+  return value;
+}
+
+static unsigned int __expect_uint(agp_line_t * l, const char * what){
+  const char * field = l->cur;
+  unsigned long value = __expect_ulong(l, what);
+
+  if(value > UINT_MAX)
+    parse_fail(l, field, "%s is too large", what);
+  return (unsigned int) value;
+}
+
+static char __expect_char(agp_line_t * l, const char * what){
+  size_t len;
+  const char * field = __expect_field(l, &len, what);
+
+  if(len != 1)
+    parse_fail(l, field, "%s must be a single character", what);
+  return *field;
+}
+
+static str_slice_t __expect_str(agp_line_t * l, const char * what){
+  size_t len;
+  const char * field = __expect_field(l, &len, what);
+  return str_slice(field, len);
+}
+
+/* parse one line into raw. Returns 1 for a record, 0 for blank and
+   comment lines, and -1 on error (see l->error and l->column) */
+static int __parse_line(agp_line_t * l, agp_raw_t * raw){
+  const char * field;
+  size_t len;
+  agp_scaffold_t * record = &raw->record;
+
+  if(setjmp(l->fail))
+    return -1;
+
+  /* skip blank and comment lines */
+  while(l->cur < l->end && __is_sep(*l->cur)) l->cur++;
+  if(l->cur == l->end || *l->cur == '#')
+    return 0;
+
+  memset(record, 0, sizeof(agp_scaffold_t));
+
+  raw->object          = __expect_str  (l, "object name");
+  record->object_start = __expect_ulong(l, "object start");
+  record->object_end   = __expect_ulong(l, "object end");
+  record->num          = __expect_uint (l, "part number");
+
+  field = l->cur;
+  record->type         = __expect_char (l, "component type");
+
+  switch(record->type) {
+  case 'U':
+  case 'N':
+    record->component.gap.length = __expect_uint(l, "gap length");
+    raw->strs[0]                 = __expect_str (l, "gap type");
+
+    field = __expect_field(l, &len, "linkage");
+    if(len >= sizeof(record->component.gap.linkage))
+      parse_fail(l, field, "Malformed gap line: linkage must be yes or no");
+    memcpy(record->component.gap.linkage, field, len);
+
+    raw->strs[1] = __expect_str(l, "linkage evidence");
+    break;
+
+  case 'W':
+    raw->strs[0]                      = __expect_str  (l, "component id");
+    record->component.seq.start       = __expect_ulong(l, "component start");
+    record->component.seq.end         = __expect_ulong(l, "component end");
+    record->component.seq.orientation = __expect_char (l, "orientation");
+    break;
+
+  default:
+    parse_fail(l, field, "Cannot deal with any entry type other"
+               " than W,U,N: %c", record->type);
+  }
+
+  if(__next_field(l, &field, &len))
+    parse_fail(l, field, "unexpected extra column");
+
+  return 1;
+}
+
+/* intern the strings of a parsed line and add it to the graph. Always
+   called in file order */
+static void __commit(agp_graph_t * graph, agp_raw_t * raw){
+  agp_scaffold_t * record = agp_graph_alloc(graph);
+  *record = raw->record;
+
+  if(record->type == 'W'){
+    record->component.seq.name = str_pool_intern_slice(raw->strs[0]);
+  } else {
+    record->component.gap.type     = str_pool_intern_slice(raw->strs[0]);
+    record->component.gap.evidence = str_pool_intern_slice(raw->strs[1]);
+  }
+
+  if(agp_graph_append(graph, str_pool_intern_slice(raw->object), record) != 0)
+    __report(raw->line, 1, "sequence component segment found more "
+             "than once");
+}
+
+/* parse and commit a single line */
+static void __read_line(agp_graph_t * graph, const char * start,
+                        const char * end, size_t line){
+  agp_line_t l;
+  agp_raw_t raw;
+
+  l.start = l.cur = start;
+  l.end   = end;
+
+  switch(__parse_line(&l, &raw)){
+  case -1: __report(line, l.column, l.error); break;
+  case  1: raw.line = line; __commit(graph, &raw); break;
+  }
+}
+
+static void __read_mapped(agp_graph_t * graph, const char * data,
+                          size_t size){
+  const char * end = data + size;
+  size_t line = 0;
+
+  while(data < end){
+    const char * nl = memchr(data, '\n', end - data);
+    if(!nl) nl = end;
+
+    __read_line(graph, data, nl, ++line);
+
+    data = nl + 1;
+  }
+}
+
+/* streams, compressed or not, are read in blocks. A line cut by the
+   end of a block is moved to the front before reading the next one */
+static void __read_stream(agp_graph_t * graph, FILE * file){
+  gzip_reader_t reader;
+  size_t size = GZIP_READ_SIZE * 4, used = 0, line = 0, n;
+  char * buffer = malloc(size);
+
+  if(!buffer){
+    error_fail("Out of memory while reading agp file\n");
+  }
+
+  gzip_reader_init(&reader, file);
+  while((n = gzip_read(&reader, buffer + used, size - used)) > 0){
+    const char * cur = buffer, * end = buffer + used + n, * nl;
+
+    while((nl = memchr(cur, '\n', end - cur)) != NULL){
+      __read_line(graph, cur, nl, ++line);
+      cur = nl + 1;
+    }
+
+    used = end - cur;
+    memmove(buffer, cur, used);
+
+    /* a line longer than the buffer */
+    if(used == size){
+      size *= 2;
+      buffer = realloc(buffer, size);
+      if(!buffer){
+        error_fail("Out of memory while reading agp file\n");
+      }
+    }
+  }
+
+  if(used > 0)
+    __read_line(graph, buffer, buffer + used, ++line);
+
+  gzip_reader_close(&reader);
+  free(buffer);
+}
+
+/* Parallel reading. The mapping is cut at line boundaries into chunks
+   that worker threads parse into raw records; the main thread then
+   commits the chunks in file order, so objects, duplicate detection
+   and errors come out exactly as in the serial reader. Chunks are
+   processed a round at a time to bound the memory held in raw
+   records. */
+#define AGP_CHUNK_SIZE (4 << 20)
+#define AGP_CHUNKS_PER_THREAD 2
+
+typedef struct {
+  const char *start, *end;
+
+  agp_raw_t * raws;
+  size_t n, m;
+
+  /* lines in the chunk, and the first error if any. A worker can't
+     stop the run, so running out of memory is kept here too */
+  size_t lines;
+  int failed, out_of_memory;
+  size_t fail_line, fail_column;
+  char error[256];
+} agp_chunk_t;
+
+static void __parse_chunk(void * data, size_t i){
+  agp_chunk_t * chunk = (agp_chunk_t *) data + i;
+  const char * cur = chunk->start;
+  agp_line_t l;
+
+  chunk->n = 0;
+  chunk->lines = 0;
+  chunk->failed = 0;
+  chunk->out_of_memory = 0;
+
+  while(cur < chunk->end){
+    const char * nl = memchr(cur, '\n', chunk->end - cur);
+    if(!nl) nl = chunk->end;
+    chunk->lines++;
+
+    if(chunk->n == chunk->m){
+      size_t m = chunk->m ? chunk->m * 2 : 4096;
+      agp_raw_t * raws = realloc(chunk->raws, sizeof(agp_raw_t) * m);
+      if(!raws){
+        chunk->out_of_memory = 1;
+        return;
+      }
+      chunk->raws = raws;
+      chunk->m = m;
+    }
+
+    l.start = l.cur = cur;
+    l.end   = nl;
+
+    agp_raw_t * raw = chunk->raws + chunk->n;
+    int ret = __parse_line(&l, raw);
+
+    if(ret < 0){
+      chunk->failed = 1;
+      chunk->fail_line = chunk->lines;
+      chunk->fail_column = l.column;
+      memcpy(chunk->error, l.error, sizeof(l.error));
+      return;
+    }
+
+    if(ret > 0){
+      raw->line = chunk->lines;
+      chunk->n++;
+    }
+
+    cur = nl + 1;
+  }
+}
+
+static void __read_parallel(agp_graph_t * graph, const char * data,
+                            size_t size, int threads){
+  const char * end = data + size;
+  size_t n_chunks = (size_t) threads * AGP_CHUNKS_PER_THREAD;
+  agp_chunk_t * chunks = calloc(n_chunks, sizeof(agp_chunk_t));
+  size_t line = 0;
+
+  if(!chunks){
+    error_fail("Out of memory while reading agp file\n");
+  }
+
+  while(data < end){
+    size_t i, j, used = 0;
+
+    /* cut the next round, each chunk ending just after a newline */
+    for(i = 0; i < n_chunks && data < end; i++){
+      const char * stop = data + AGP_CHUNK_SIZE;
+
+      if(stop >= end){
+        stop = end;
+      } else {
+        stop = memchr(stop, '\n', end - stop);
+        stop = stop ? stop + 1 : end;
+      }
+
+      chunks[i].start = data;
+      chunks[i].end   = stop;
+      data = stop;
+      used++;
+    }
+
+    parallel_for(threads, used, __parse_chunk, chunks);
+
+    for(i = 0; i < used; i++){
+      agp_chunk_t * chunk = chunks + i;
+
+      for(j = 0; j < chunk->n; j++){
+        chunk->raws[j].line += line;
+        __commit(graph, chunk->raws + j);
+      }
+
+      if(chunk->out_of_memory){
+        error_fail("Out of memory while reading agp file\n");
+      }
+      if(chunk->failed)
+        __report(line + chunk->fail_line, chunk->fail_column, chunk->error);
+
+      line += chunk->lines;
+    }
+  }
+
+  size_t i;
+  for(i = 0; i < n_chunks; i++)
+    free(chunks[i].raws);
+  free(chunks);
+}
+
+void agp_graph_read_buffer(agp_graph_t * graph, const char * data,
+                           size_t size){
+  __read_mapped(graph, data, size);
+}
+
+agp_graph_t * agp_graph_read(FILE * file){
+  return agp_graph_read_threads(file, 1);
+}
+
+agp_graph_t * agp_graph_read_threads(FILE * file, int threads){
+  agp_graph_t * graph = agp_graph_init();
+  struct stat st;
+  int fd = fileno(file);
+
+  /* map regular files, everything else is streamed. So are compressed
+     files, which are told by their magic bytes */
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+     ftello(file) == 0){
+    void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if(data != MAP_FAILED && st.st_size >= 2 &&
+       memcmp(data, "\x1f\x8b", 2) == 0){
+      munmap(data, st.st_size);
+      data = MAP_FAILED;
+    }
+
+    if(data != MAP_FAILED){
+      posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+      if(threads > 1 && (size_t) st.st_size > AGP_CHUNK_SIZE)
+        __read_parallel(graph, data, st.st_size, threads);
+      else
+        __read_mapped(graph, data, st.st_size);
+
+      munmap(data, st.st_size);
+      return graph;
+    }
+  }
+
+  __read_stream(graph, file);
+  return graph;
+}
@@ -0,0 +1,543 @@
+#include "agp-snapshot.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "klib/khash.h"
+#include "error.h"
+
+/* File layout: the header, then each section in the order of the
+   header's fields, every one starting on an 8 byte boundary, and last
+   the CRC-32 of everything before it, as 8 bytes. Offsets are from the
+   start of the file, so the file can be mapped anywhere. */
+#define SNAPSHOT_MAGIC      "MAGPIESN"
+#define SNAPSHOT_VERSION    3
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+typedef struct {
+  uint64_t offset, n;
+} snapshot_section_t;
+
+/* a khash table: flags and keys as they are in memory, values as
+   indices (into the records, objects or contigs sections) */
+typedef struct {
+  uint64_t n_buckets, size, n_occupied, upper_bound;
+  snapshot_section_t flags, keys, vals;
+} snapshot_hash_t;
+
+typedef struct {
+  char magic[8];
+  uint32_t version, byte_order;
+  uint32_t record_size, key_size;
+  uint64_t file_size;
+
+  /* string pool: lengths, hashes, and the NUL terminated strings */
+  snapshot_section_t lens, hashes, bytes;
+
+  /* records, with object, next and prev stored as index + 1 (0 for
+     NULL). Records of an object are stored in order */
+  snapshot_section_t records;
+  snapshot_section_t objects;
+
+  /* contig index: record indices of every contig back to back, and
+     where each contig's run starts */
+  snapshot_section_t contig_records, contigs;
+
+  snapshot_hash_t object_hash, component_hash, contig_hash;
+} snapshot_header_t;
+
+typedef struct {
+  uint64_t name, head, tail, count, length;
+} snapshot_object_t;
+
+typedef struct {
+  uint64_t offset, n;
+} snapshot_contig_t;
+
+#define __align(x) (((x) + 7) & ~(uint64_t) 7)
+
+/* index a record was saved at, in the mark records have while the
+   graph is a list */
+#define __index(record) ((record)->tree.mark)
+
+#define __encode(i) ((void*) (uintptr_t) (i))
+#define __decode(p) ((uint64_t) (uintptr_t) (p))
+
+static void __section(snapshot_section_t * section, uint64_t * pos,
+                      uint64_t n, size_t size){
+  section->offset = *pos;
+  section->n = n;
+  *pos = __align(*pos + n * size);
+}
+
+static void __hash_sections(snapshot_hash_t * hash, uint64_t * pos,
+                            khint_t n_buckets, size_t key_size){
+  hash->n_buckets = n_buckets;
+  __section(&hash->flags, pos, n_buckets ? __ac_fsize(n_buckets) : 0,
+            sizeof(khint32_t));
+  __section(&hash->keys, pos, n_buckets, key_size);
+  __section(&hash->vals, pos, n_buckets, sizeof(uint64_t));
+}
+
+/* CRC-32 of size bytes, in pieces small enough for zlib */
+static uint32_t __crc(uint32_t crc, const void * data, uint64_t size){
+  const Bytef * bytes = data;
+
+  while(size > 0){
+    uInt n = size > (1u << 30) ? (1u << 30) : (uInt) size;
+    crc = crc32(crc, bytes, n);
+    bytes += n;
+    size -= n;
+  }
+  return crc;
+}
+
+/* writes are padded up to the next section, and summed as they go */
+typedef struct {
+  FILE * file;
+  uint64_t pos;
+  uint32_t crc;
+} snapshot_writer_t;
+
+static void __write(snapshot_writer_t * w, const void * data, size_t size){
+  if(size && fwrite(data, 1, size, w->file) != size){
+    error_fail("Failed to write snapshot: %s\n", strerror(errno));
+  }
+  w->crc = __crc(w->crc, data, size);
+  w->pos += size;
+}
+
+static void __pad(snapshot_writer_t * w){
+  static const char zero[8] = {0};
+  __write(w, zero, __align(w->pos) - w->pos);
+}
+
+static void __write_u64(snapshot_writer_t * w, uint64_t x){
+  __write(w, &x, sizeof(x));
+}
+
+/* value is the saved index for the bucket __k */
+#define __write_hash(w, h, value) do {                                  \
+    khint_t __k;                                                        \
+    if(kh_end(h)){                                                      \
+      __write(w, (h)->flags, __ac_fsize(kh_end(h)) * sizeof(khint32_t)); \
+      __pad(w);                                                         \
+      __write(w, (h)->keys, kh_end(h) * sizeof(*(h)->keys));            \
+      __pad(w);                                                         \
+      for(__k = 0; __k < kh_end(h); __k++)                              \
+        __write_u64(w, kh_exist(h, __k) ? (value) : 0);                 \
+    }                                                                   \
+  } while(0)
+
+#define __hash_counts(hash, h) do {                                     \
+    (hash).size        = (h)->size;                                     \
+    (hash).n_occupied  = (h)->n_occupied;                               \
+    (hash).upper_bound = (h)->upper_bound;                              \
+  } while(0)
+
+void agp_graph_save_snapshot(agp_graph_t * agp, FILE * file){
+  snapshot_header_t header;
+  snapshot_writer_t w = { file, 0 };
+  agp_engine_t engine = agp->engine;
+  khiter_t k;
+  size_t i;
+
+  agp_graph_set_engine(agp, AGP_ENGINE_LIST);
+
+  /* number the objects in hash order, and the records in object
+     order */
+  uint64_t n_records = 0, n_objects = 0, n_contig_records = 0;
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++){
+    if (!kh_exist(agp->objects, k)) continue;
+
+    agp_scaffold_t * cur;
+    for(cur = kh_value(agp->objects, k)->head; cur; cur = cur->next)
+      __index(cur) = n_records++;
+    n_objects++;
+  }
+
+  for (k = kh_begin(agp->contigs); k != kh_end(agp->contigs); k++)
+    if (kh_exist(agp->contigs, k))
+      n_contig_records += kh_value(agp->contigs, k)->n;
+
+  size_t n_strings = str_pool_size(), n_bytes = 0;
+  for(i = 0; i < n_strings; i++)
+    n_bytes += str_pool_len(i) + 1;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+  header.version     = SNAPSHOT_VERSION;
+  header.byte_order  = SNAPSHOT_BYTE_ORDER;
+  header.record_size = sizeof(agp_scaffold_t);
+  header.key_size    = sizeof(agp_component_key_t);
+
+  uint64_t pos = __align(sizeof(header));
+  __section(&header.lens,    &pos, n_strings, sizeof(uint32_t));
+  __section(&header.hashes,  &pos, n_strings, sizeof(uint32_t));
+  __section(&header.bytes,   &pos, n_bytes,   1);
+  __section(&header.records, &pos, n_records, sizeof(agp_scaffold_t));
+  __section(&header.objects, &pos, n_objects, sizeof(snapshot_object_t));
+  __section(&header.contig_records, &pos, n_contig_records,
+            sizeof(uint64_t));
+  __section(&header.contigs, &pos, kh_size(agp->contigs),
+            sizeof(snapshot_contig_t));
+  __hash_sections(&header.object_hash, &pos, kh_end(agp->objects),
+                  sizeof(str_id_t));
+  __hash_sections(&header.component_hash, &pos, kh_end(agp->components),
+                  sizeof(agp_component_key_t));
+  __hash_sections(&header.contig_hash, &pos, kh_end(agp->contigs),
+                  sizeof(str_id_t));
+  __hash_counts(header.object_hash, agp->objects);
+  __hash_counts(header.component_hash, agp->components);
+  __hash_counts(header.contig_hash, agp->contigs);
+  header.file_size = pos + sizeof(uint64_t);
+
+  __write(&w, &header, sizeof(header));
+  __pad(&w);
+
+  /* string pool */
+  for(i = 0; i < n_strings; i++){
+    uint32_t len = str_pool_len(i);
+    __write(&w, &len, sizeof(len));
+  }
+  __pad(&w);
+  for(i = 0; i < n_strings; i++){
+    uint32_t hash = str_pool_slice(i).hash;
+    __write(&w, &hash, sizeof(hash));
+  }
+  __pad(&w);
+  for(i = 0; i < n_strings; i++)
+    __write(&w, str_pool_get(i), str_pool_len(i) + 1);
+  __pad(&w);
+
+  /* records */
+  uint64_t object_index = 0;
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++){
+    if (!kh_exist(agp->objects, k)) continue;
+
+    agp_scaffold_t * cur;
+    for(cur = kh_value(agp->objects, k)->head; cur; cur = cur->next){
+      agp_scaffold_t record = *cur;
+
+      record.object = __encode(object_index + 1);
+      record.next = cur->next ? __encode(__index(cur->next) + 1) : NULL;
+      record.prev = cur->prev ? __encode(__index(cur->prev) + 1) : NULL;
+      memset(&record.tree, 0, sizeof(record.tree));
+      __write(&w, &record, sizeof(record));
+    }
+    object_index++;
+  }
+  __pad(&w);
+
+  /* objects */
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++){
+    if (!kh_exist(agp->objects, k)) continue;
+    agp_object_t * object = kh_value(agp->objects, k);
+
+    snapshot_object_t saved = {
+      object->name,
+      object->head ? __index(object->head) + 1 : 0,
+      object->tail ? __index(object->tail) + 1 : 0,
+      object->count,
+      object->length
+    };
+    __write(&w, &saved, sizeof(saved));
+  }
+  __pad(&w);
+
+  /* contig index */
+  for (k = kh_begin(agp->contigs); k != kh_end(agp->contigs); k++){
+    if (!kh_exist(agp->contigs, k)) continue;
+    agp_contig_index_t * index = kh_value(agp->contigs, k);
+
+    for(i = 0; i < index->n; i++)
+      __write_u64(&w, __index(index->records[i]));
+  }
+  __pad(&w);
+
+  uint64_t offset = 0;
+  for (k = kh_begin(agp->contigs); k != kh_end(agp->contigs); k++){
+    if (!kh_exist(agp->contigs, k)) continue;
+
+    snapshot_contig_t contig = { offset, kh_value(agp->contigs, k)->n };
+    __write(&w, &contig, sizeof(contig));
+    offset += contig.n;
+  }
+  __pad(&w);
+
+  /* hashes. Objects and contigs were numbered in bucket order */
+  uint64_t n = 0;
+  __write_hash(&w, agp->objects, n++);
+  n = 0;
+  __write_hash(&w, agp->components,
+               __index(kh_value(agp->components, __k)));
+  __write_hash(&w, agp->contigs, n++);
+
+  uint64_t crc = w.crc;
+  __write_u64(&w, crc);
+
+  if(fflush(file) != 0 || w.pos != header.file_size){
+    error_fail("Failed to write snapshot: %s\n", strerror(errno));
+  }
+
+  agp_graph_set_engine(agp, engine);
+}
+
+
+static void __corrupt(void){
+  error_fail("Snapshot is corrupt or was written by another "
+             "version of magpie\n");
+}
+
+static const void * __at(const char * map, const snapshot_header_t * header,
+                         snapshot_section_t section, size_t size){
+  if(section.offset > header->file_size ||
+     section.n > (header->file_size - section.offset) / size)
+    __corrupt();
+  return map + section.offset;
+}
+
+static void * __copy(const char * map, const snapshot_header_t * header,
+                     snapshot_section_t section, size_t size){
+  void * copy = malloc(section.n * size);
+  if(!copy){
+    error_fail("Out of memory while loading snapshot\n");
+  }
+  memcpy(copy, __at(map, header, section, size), section.n * size);
+  return copy;
+}
+
+/* restore a hash table whose values are left to the caller, which is
+   given the saved indices in vals */
+#define __load_hash(map, header, h, hash, vals) do {                    \
+    if((hash).n_buckets == 0) break;                                    \
+    if((hash).flags.n != __ac_fsize((hash).n_buckets) ||                \
+       (hash).keys.n != (hash).n_buckets ||                             \
+       (hash).vals.n != (hash).n_buckets)                               \
+      __corrupt();                                                      \
+    (h)->n_buckets   = (hash).n_buckets;                                \
+    (h)->size        = (hash).size;                                     \
+    (h)->n_occupied  = (hash).n_occupied;                               \
+    (h)->upper_bound = (hash).upper_bound;                              \
+    (h)->flags = __copy(map, header, (hash).flags, sizeof(khint32_t));  \
+    (h)->keys  = __copy(map, header, (hash).keys, sizeof(*(h)->keys));  \
+    (h)->vals  = calloc((hash).n_buckets, sizeof(*(h)->vals));          \
+    vals = __at(map, header, (hash).vals, sizeof(uint64_t));            \
+  } while(0)
+
+#define __check_index(i, n) do { if((i) >= (n)) __corrupt(); } while(0)
+
+/* the pool already held strings: intern them again and append every
+   record to a new graph */
+static agp_graph_t * __load_replay(const char * map,
+                                   const snapshot_header_t * header){
+  const uint32_t * lens = __at(map, header, header->lens, sizeof(uint32_t));
+  const char * bytes = __at(map, header, header->bytes, 1);
+  const agp_scaffold_t * records =
+    __at(map, header, header->records, sizeof(agp_scaffold_t));
+  const snapshot_object_t * objects =
+    __at(map, header, header->objects, sizeof(snapshot_object_t));
+  uint64_t i, offset = 0;
+
+  if(header->hashes.n != header->lens.n)
+    __corrupt();
+
+  str_id_t * ids = malloc(sizeof(str_id_t) * header->lens.n);
+  for(i = 0; i < header->lens.n; i++){
+    if(offset + lens[i] >= header->bytes.n || bytes[offset + lens[i]])
+      __corrupt();
+    ids[i] = str_pool_intern(bytes + offset, lens[i]);
+    offset += lens[i] + 1;
+  }
+
+  agp_graph_t * graph = agp_graph_init();
+  for(i = 0; i < header->objects.n; i++){
+    uint64_t cur = objects[i].head;
+    size_t count = 0;
+
+    __check_index(objects[i].name, header->lens.n);
+    while(cur){
+      __check_index(cur - 1, header->records.n);
+      if(++count > header->records.n) __corrupt();
+
+      agp_scaffold_t * record = agp_graph_alloc(graph);
+      *record = records[cur - 1];
+      cur = __decode(record->next);
+
+      if(record->type == 'W'){
+        __check_index(record->component.seq.name, header->lens.n);
+        record->component.seq.name = ids[record->component.seq.name];
+      } else {
+        __check_index(record->component.gap.type, header->lens.n);
+        __check_index(record->component.gap.evidence, header->lens.n);
+        record->component.gap.type = ids[record->component.gap.type];
+        record->component.gap.evidence =
+          ids[record->component.gap.evidence];
+      }
+
+      if(agp_graph_append(graph, ids[objects[i].name], record) != 0)
+        __corrupt();
+    }
+  }
+
+  free(ids);
+  return graph;
+}
+
+agp_graph_t * agp_graph_load_snapshot(FILE * file){
+  struct stat st;
+  uint64_t i, j;
+  khiter_t k;
+
+  if(fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode)){
+    error_fail("Snapshots can only be loaded from regular files\n");
+  }
+
+  if((size_t) st.st_size < sizeof(snapshot_header_t) + sizeof(uint64_t))
+    __corrupt();
+
+  char * map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fileno(file), 0);
+  if(map == MAP_FAILED){
+    error_fail("Failed to map snapshot: %s\n", strerror(errno));
+  }
+
+  const snapshot_header_t * header = (const snapshot_header_t*) map;
+  if(memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0 ||
+     header->version != SNAPSHOT_VERSION ||
+     header->byte_order != SNAPSHOT_BYTE_ORDER ||
+     header->record_size != sizeof(agp_scaffold_t) ||
+     header->key_size != sizeof(agp_component_key_t) ||
+     header->file_size != (uint64_t) st.st_size ||
+     header->hashes.n != header->lens.n)
+    __corrupt();
+
+  /* bounds are checked as the snapshot is loaded, but not what is
+     inside them */
+  uint64_t crc;
+  memcpy(&crc, map + st.st_size - sizeof(crc), sizeof(crc));
+  if(crc != __crc(0, map, st.st_size - sizeof(crc)))
+    __corrupt();
+
+  /* ids, and so the hashes, can only be kept with an empty pool */
+  if(str_pool_size() > 1){
+    agp_graph_t * graph = __load_replay(map, header);
+    munmap(map, st.st_size);
+    return graph;
+  }
+
+  if(str_pool_load(__at(map, header, header->bytes, 1), header->bytes.n,
+                   __at(map, header, header->lens, sizeof(uint32_t)),
+                   __at(map, header, header->hashes, sizeof(uint32_t)),
+                   header->lens.n) != 0)
+    __corrupt();
+
+  agp_graph_t * graph = agp_graph_init();
+  const uint64_t * vals;
+
+  /* objects */
+  const snapshot_object_t * saved =
+    __at(map, header, header->objects, sizeof(snapshot_object_t));
+  agp_object_t ** objects = malloc(sizeof(agp_object_t*) *
+                                   (header->objects.n + 1));
+  for(i = 0; i < header->objects.n; i++){
+    __check_index(saved[i].head, header->records.n + 1);
+    __check_index(saved[i].tail, header->records.n + 1);
+    __check_index(saved[i].name, header->lens.n);
+
+    objects[i] = calloc(1, sizeof(agp_object_t));
+    objects[i]->name   = saved[i].name;
+    objects[i]->count  = saved[i].count;
+    objects[i]->length = saved[i].length;
+  }
+
+  /* records are fixed up in place */
+  agp_scaffold_t * records = (agp_scaffold_t*)
+    __at(map, header, header->records, sizeof(agp_scaffold_t));
+#define __fix(p, base, n) do {                                          \
+    uint64_t __i = __decode(p);                                         \
+    __check_index(__i, (n) + 1);                                        \
+    (p) = __i ? (base) + __i - 1 : NULL;                                \
+  } while(0)
+  for(i = 0; i < header->records.n; i++){
+    agp_scaffold_t * record = records + i;
+    uint64_t object = __decode(record->object);
+
+    __check_index(object - 1, header->objects.n);
+    record->object = objects[object - 1];
+    __fix(record->next, records, header->records.n);
+    __fix(record->prev, records, header->records.n);
+  }
+
+  for(i = 0; i < header->objects.n; i++){
+    objects[i]->head = __encode(saved[i].head);
+    objects[i]->tail = __encode(saved[i].tail);
+    __fix(objects[i]->head, records, header->records.n);
+    __fix(objects[i]->tail, records, header->records.n);
+  }
+#undef __fix
+
+  /* contig index */
+  const uint64_t * contig_records =
+    __at(map, header, header->contig_records, sizeof(uint64_t));
+  const snapshot_contig_t * saved_contigs =
+    __at(map, header, header->contigs, sizeof(snapshot_contig_t));
+  agp_contig_index_t ** contigs = malloc(sizeof(agp_contig_index_t*) *
+                                         (header->contigs.n + 1));
+  for(i = 0; i < header->contigs.n; i++){
+    snapshot_contig_t contig = saved_contigs[i];
+    if(contig.offset > header->contig_records.n ||
+       contig.n > header->contig_records.n - contig.offset)
+      __corrupt();
+
+    contigs[i] = calloc(1, sizeof(agp_contig_index_t));
+    contigs[i]->n = contigs[i]->m = contig.n;
+    contigs[i]->records = malloc(sizeof(agp_scaffold_t*) * (contig.n + 1));
+    for(j = 0; j < contig.n; j++){
+      __check_index(contig_records[contig.offset + j], header->records.n);
+      contigs[i]->records[j] = records + contig_records[contig.offset + j];
+    }
+  }
+
+  /* hashes. Any bucket left without a value means a corrupt file, and
+     the graph is never returned */
+  __load_hash(map, header, graph->objects, header->object_hash, vals);
+  for (k = kh_begin(graph->objects); k != kh_end(graph->objects); k++)
+    if (kh_exist(graph->objects, k)){
+      __check_index(vals[k], header->objects.n);
+      kh_value(graph->objects, k) = objects[vals[k]];
+    }
+
+  __load_hash(map, header, graph->components, header->component_hash,
+              vals);
+  for (k = kh_begin(graph->components); k != kh_end(graph->components); k++)
+    if (kh_exist(graph->components, k)){
+      __check_index(vals[k], header->records.n);
+      kh_value(graph->components, k) = records + vals[k];
+    }
+
+  __load_hash(map, header, graph->contigs, header->contig_hash, vals);
+  for (k = kh_begin(graph->contigs); k != kh_end(graph->contigs); k++)
+    if (kh_exist(graph->contigs, k)){
+      __check_index(vals[k], header->contigs.n);
+      kh_value(graph->contigs, k) = contigs[vals[k]];
+    }
+
+  if(kh_size(graph->objects) != header->objects.n ||
+     kh_size(graph->contigs) != header->contigs.n)
+    __corrupt();
+
+  free(objects);
+  free(contigs);
+
+  graph->records.mapped = map;
+  graph->records.mapped_size = st.st_size;
+
+  return graph;
+}
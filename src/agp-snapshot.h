@@ -0,0 +1,29 @@
+#ifndef AGP_SNAPSHOT_H_
+#define AGP_SNAPSHOT_H_
+
+#include <stdio.h>
+
+#include "agp-graph.h"
+
+/* Binary snapshot of a graph, for reloading a large assembly without
+   parsing it again. A snapshot holds the string pool, the records with
+   their links stored as indices, and the contents of the graph's
+   hashes, so loading maps the file and only turns indices back into
+   pointers.
+
+   Snapshots are tied to the build that wrote them (byte order, record
+   layout and hash functions), and are rejected otherwise. They end in
+   a CRC-32 of the rest of the file, so a damaged snapshot is rejected
+   too. */
+
+/* write a snapshot. With the tree engine the graph is flattened
+   first */
+void agp_graph_save_snapshot(agp_graph_t*, FILE*);
+
+/* load a snapshot from a regular file. The records stay in the file's
+   private mapping. If the string pool already holds strings, ids can't
+   be kept, so the strings are interned again and the graph is rebuilt
+   one record at a time, which is slower */
+agp_graph_t * agp_graph_load_snapshot(FILE*);
+
+#endif // AGP_SNAPSHOT_H_
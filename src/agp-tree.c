@@ -0,0 +1,248 @@
+#include "agp-tree.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "error.h"
+
+#define __left(x)  ((x)->tree.node->child[0])
+#define __right(x) ((x)->tree.node->child[1])
+#define __size(x)  ((x) ? (x)->tree.node->size : 0)
+#define __span(x)  ((x) ? (x)->tree.node->span : 0)
+
+size_t * agp_tree_visits = NULL;
+
+/* priorities are a hash of the record's address, so they are fixed
+   for a record and need no shared state */
+static unsigned int __priority(const agp_scaffold_t * record){
+  uint64_t x = (uint64_t) (uintptr_t) record;
+
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return (unsigned int) (x ^ (x >> 31));
+}
+
+/* apply flags to a subtree: the root is updated now, its children when
+   it is next pushed */
+static void __apply(agp_scaffold_t * x, unsigned char flags){
+  if(!x) return;
+
+  if(flags & AGP_TREE_REVERSE){
+    agp_scaffold_t * tmp = __left(x);
+    __left(x)  = __right(x);
+    __right(x) = tmp;
+  }
+
+  if((flags & AGP_TREE_COMPLEMENT) && x->type == 'W'){
+    if(x->component.seq.orientation == '+')
+      x->component.seq.orientation = '-';
+    else if(x->component.seq.orientation == '-')
+      x->component.seq.orientation = '+';
+  }
+
+  x->tree.node->flags ^= flags;
+}
+
+static inline void __push(agp_scaffold_t * x){
+  if(agp_tree_visits)
+    (*agp_tree_visits)++;
+
+  if(x->tree.node->flags){
+    __apply(__left(x),  x->tree.node->flags);
+    __apply(__right(x), x->tree.node->flags);
+    x->tree.node->flags = 0;
+  }
+}
+
+static inline void __update(agp_scaffold_t * x){
+  x->tree.node->size = 1 + __size(__left(x)) + __size(__right(x));
+  x->tree.node->span = agp_record_length(x) +
+    __span(__left(x)) + __span(__right(x));
+
+  if(__left(x))  __left(x)->tree.node->parent  = x;
+  if(__right(x)) __right(x)->tree.node->parent = x;
+}
+
+void agp_tree_node(agp_scaffold_t * record){
+  record->tree.node->parent   = NULL;
+  __left(record)        = NULL;
+  __right(record)       = NULL;
+  record->tree.node->flags    = 0;
+  record->tree.node->priority = __priority(record);
+  __update(record);
+}
+
+static agp_scaffold_t * __join(agp_scaffold_t * a, agp_scaffold_t * b){
+  if(!a) return b;
+  if(!b) return a;
+
+  if(a->tree.node->priority > b->tree.node->priority){
+    __push(a);
+    __right(a) = __join(__right(a), b);
+    __update(a);
+    return a;
+  }
+
+  __push(b);
+  __left(b) = __join(a, __left(b));
+  __update(b);
+  return b;
+}
+
+agp_scaffold_t * agp_tree_join(agp_scaffold_t * a, agp_scaffold_t * b){
+  agp_scaffold_t * root = __join(a, b);
+  if(root) root->tree.node->parent = NULL;
+  return root;
+}
+
+static void __split(agp_scaffold_t * t, size_t k,
+                    agp_scaffold_t ** l, agp_scaffold_t ** r){
+  if(!t){
+    *l = *r = NULL;
+    return;
+  }
+
+  __push(t);
+  size_t left = __size(__left(t));
+
+  if(left < k){
+    __split(__right(t), k - left - 1, &__right(t), r);
+    __update(t);
+    *l = t;
+  } else {
+    __split(__left(t), k, l, &__left(t));
+    __update(t);
+    *r = t;
+  }
+}
+
+void agp_tree_split(agp_scaffold_t * root, size_t k,
+                    agp_scaffold_t ** left, agp_scaffold_t ** right){
+  __split(root, k, left, right);
+  if(*left)  (*left)->tree.node->parent  = NULL;
+  if(*right) (*right)->tree.node->parent = NULL;
+}
+
+/* push flags down from the root to x */
+static agp_scaffold_t * __push_path(agp_scaffold_t * x){
+  agp_scaffold_t * root = x;
+  if(x->tree.node->parent)
+    root = __push_path(x->tree.node->parent);
+  __push(x);
+  return root;
+}
+
+size_t agp_tree_rank(agp_scaffold_t * record, agp_scaffold_t ** root){
+  *root = __push_path(record);
+
+  size_t rank = __size(__left(record));
+  agp_scaffold_t * x = record;
+  while(x->tree.node->parent){
+    agp_scaffold_t * p = x->tree.node->parent;
+    if(__right(p) == x)
+      rank += __size(__left(p)) + 1;
+    x = p;
+  }
+
+  return rank;
+}
+
+agp_scaffold_t * agp_tree_at(agp_scaffold_t * t, size_t i){
+  while(t){
+    __push(t);
+    size_t left = __size(__left(t));
+
+    if(i < left){
+      t = __left(t);
+    } else if(i == left){
+      return t;
+    } else {
+      i -= left + 1;
+      t = __right(t);
+    }
+  }
+
+  return NULL;
+}
+
+void agp_tree_update(agp_scaffold_t * record){
+  for(; record != NULL; record = record->tree.node->parent)
+    __update(record);
+}
+
+void agp_tree_reverse(agp_scaffold_t * root, int complement){
+  __apply(root, AGP_TREE_REVERSE | (complement ? AGP_TREE_COMPLEMENT : 0));
+}
+
+static void __update_all(agp_scaffold_t * x){
+  if(!x) return;
+  __update_all(__left(x));
+  __update_all(__right(x));
+  __update(x);
+}
+
+agp_scaffold_t * agp_tree_build(agp_scaffold_t * head){
+  agp_scaffold_t ** stack = NULL;
+  size_t n = 0, m = 0;
+
+  /* cartesian tree on the priorities, keeping the right spine on the
+     stack */
+  agp_scaffold_t * cur;
+  for(cur = head; cur != NULL; cur = cur->next){
+    agp_scaffold_t * last = NULL;
+
+    agp_tree_node(cur);
+    while(n > 0 && stack[n - 1]->tree.node->priority < cur->tree.node->priority)
+      last = stack[--n];
+
+    __left(cur) = last;
+    if(n > 0)
+      __right(stack[n - 1]) = cur;
+
+    if(n == m){
+      m = m ? m * 2 : 64;
+      stack = realloc(stack, sizeof(agp_scaffold_t*) * m);
+      if(!stack){
+        error_fail("Out of memory while building tree\n");
+      }
+    }
+    stack[n++] = cur;
+  }
+
+  agp_scaffold_t * root = n > 0 ? stack[0] : NULL;
+  free(stack);
+
+  __update_all(root);
+  if(root) root->tree.node->parent = NULL;
+
+  return root;
+}
+
+static void __flatten(agp_scaffold_t * x, agp_object_t * object,
+                      agp_scaffold_t ** last){
+  if(!x) return;
+
+  __push(x);
+  __flatten(__left(x), object, last);
+
+  x->object = object;
+  x->prev = *last;
+  x->next = NULL;
+  if(*last)
+    (*last)->next = x;
+  else
+    object->head = x;
+  *last = x;
+
+  __flatten(__right(x), object, last);
+}
+
+void agp_tree_flatten(agp_scaffold_t * root, agp_object_t * object){
+  agp_scaffold_t * last = NULL;
+
+  object->head = NULL;
+  __flatten(root, object, &last);
+  object->tail = last;
+}
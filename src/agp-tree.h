@@ -0,0 +1,64 @@
+#ifndef AGP_TREE_H_
+#define AGP_TREE_H_
+
+#include "agp-graph.h"
+
+/* Implicit treap over agp records, used by the tree engine. Records
+   are ordered by position only (no keys), so a tree is a sequence that
+   can be split and joined in O(log n). Reversing and complementing a
+   whole tree is lazy: flags are left on the root and pushed down to
+   the children when a node is visited.
+
+   All functions take and return roots. A NULL root is an empty
+   tree. */
+
+/* size and span are totals for the subtree */
+typedef struct AGP_TREE_NODE_S {
+  agp_scaffold_t *parent, *child[2];
+  size_t size;
+  unsigned long span;
+  unsigned int priority;
+  unsigned char flags;
+} agp_tree_node_t;
+
+#define AGP_TREE_REVERSE    1
+#define AGP_TREE_COMPLEMENT 2
+
+/* if set, nodes visited are counted there (agp_graph_count_walks) */
+extern size_t * agp_tree_visits;
+
+/* make record a tree of its own. Its node must be set */
+void agp_tree_node(agp_scaffold_t* record);
+
+/* records of a then records of b */
+agp_scaffold_t* agp_tree_join(agp_scaffold_t* a, agp_scaffold_t* b);
+
+/* first k records into left, the rest into right */
+void agp_tree_split(agp_scaffold_t* root, size_t k,
+                    agp_scaffold_t** left, agp_scaffold_t** right);
+
+/* position of a record in its tree, whose root is stored in root.
+   Pending flags above the record are pushed down, so its fields are up
+   to date afterwards */
+size_t agp_tree_rank(agp_scaffold_t* record, agp_scaffold_t** root);
+
+/* record at position i */
+agp_scaffold_t* agp_tree_at(agp_scaffold_t* root, size_t i);
+
+/* recount the totals above a record whose length changed */
+void agp_tree_update(agp_scaffold_t* record);
+
+/* reverse the records, complementing them if asked */
+void agp_tree_reverse(agp_scaffold_t* root, int complement);
+
+#define agp_tree_size(root) ((root) ? (root)->tree.node->size : 0)
+
+/* tree over a next linked list of records, in O(n). Their nodes must
+   be set */
+agp_scaffold_t* agp_tree_build(agp_scaffold_t* head);
+
+/* link the records of the tree as a list owned by object, setting
+   object's head and tail */
+void agp_tree_flatten(agp_scaffold_t* root, agp_object_t* object);
+
+#endif // AGP_TREE_H_
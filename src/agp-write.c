@@ -0,0 +1,426 @@
+#include "agp-write.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "error.h"
+
+/* widest unsigned long in decimal */
+#define ULONG_DIGITS 20
+
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/* decimal representation of value, two digits at a time */
+static inline char * __put_ulong(char * out, unsigned long value){
+  char tmp[ULONG_DIGITS];
+  char * end = tmp + ULONG_DIGITS, * cur = end;
+
+  while(value >= 100){
+    const char * pair = digit_pairs + (value % 100) * 2;
+    value /= 100;
+    *--cur = pair[1];
+    *--cur = pair[0];
+  }
+
+  if(value >= 10){
+    const char * pair = digit_pairs + value * 2;
+    *--cur = pair[1];
+    *--cur = pair[0];
+  } else {
+    *--cur = '0' + value;
+  }
+
+  memcpy(out, cur, end - cur);
+  return out + (end - cur);
+}
+
+static inline char * __put_str(char * out, str_id_t id){
+  size_t len = str_pool_len(id);
+  memcpy(out, str_pool_get(id), len);
+  return out + len;
+}
+
+#define __put_char(out, c) (*(out)++ = (c))
+
+size_t agp_record_size(const agp_scaffold_t* record){
+  /* 5 or 6 numbers, 9 separators and single characters */
+  size_t size = str_pool_len(record->object->name) + 6 * ULONG_DIGITS + 16;
+
+  if(record->type == 'U' || record->type == 'N')
+    size += str_pool_len(record->component.gap.type) +
+      str_pool_len(record->component.gap.evidence) +
+      sizeof(record->component.gap.linkage);
+  else
+    size += str_pool_len(record->component.seq.name);
+
+  return size;
+}
+
+size_t agp_format_record(char* out, const agp_scaffold_t* record){
+  char * cur = out;
+
+  cur = __put_str  (cur, record->object->name);  __put_char(cur, '\t');
+  cur = __put_ulong(cur, record->object_start);  __put_char(cur, '\t');
+  cur = __put_ulong(cur, record->object_end);    __put_char(cur, '\t');
+  cur = __put_ulong(cur, record->num);           __put_char(cur, '\t');
+  __put_char(cur, record->type);                 __put_char(cur, '\t');
+
+  switch(record->type) {
+  case 'U':
+  case 'N':
+    cur = __put_ulong(cur, record->component.gap.length);
+    __put_char(cur, '\t');
+    cur = __put_str(cur, record->component.gap.type);
+    __put_char(cur, '\t');
+    size_t len = strlen(record->component.gap.linkage);
+    memcpy(cur, record->component.gap.linkage, len);
+    cur += len;
+    __put_char(cur, '\t');
+    cur = __put_str(cur, record->component.gap.evidence);
+    break;
+
+  default:
+    cur = __put_str  (cur, record->component.seq.name);  __put_char(cur, '\t');
+    cur = __put_ulong(cur, record->component.seq.start); __put_char(cur, '\t');
+    cur = __put_ulong(cur, record->component.seq.end);   __put_char(cur, '\t');
+    __put_char(cur, record->component.seq.orientation);
+  }
+
+  __put_char(cur, '\n');
+
+  return cur - out;
+}
+
+void agp_writer_init(agp_writer_t* writer, FILE* file){
+  struct stat st;
+
+  writer->data  = malloc(AGP_WRITER_SIZE);
+  writer->size  = AGP_WRITER_SIZE;
+  writer->used  = 0;
+  writer->total = 0;
+  writer->file  = file;
+  writer->fd    = -1;
+  writer->compress = 0;
+
+  if(!writer->data){
+    error_fail("Out of memory while allocating output buffer\n");
+  }
+
+  /* regular files skip stdio and get the buffer handed straight to
+     write(2) */
+  fflush(file);
+  int fd = fileno(file);
+  if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    writer->fd = fd;
+}
+
+static void __write_fd(int fd, const char* data, size_t len){
+  while(len > 0){
+    ssize_t ret = write(fd, data, len);
+
+    if(ret < 0){
+      if(errno == EINTR) continue;
+      error_fail("Failed to write output: %s\n", strerror(errno));
+    }
+
+    data += ret;
+    len  -= ret;
+  }
+}
+
+static void __write_out(agp_writer_t* writer, const char* data, size_t len){
+  if(writer->fd >= 0){
+    __write_fd(writer->fd, data, len);
+  } else if(fwrite(data, 1, len, writer->file) != len){
+    error_fail("Failed to write output: %s\n", strerror(errno));
+  }
+}
+
+void agp_writer_init_bgzf(agp_writer_t* writer, FILE* file, int threads){
+  agp_writer_init(writer, file);
+
+  free(writer->data);
+  writer->size = (size_t) GZIP_BGZF_DATA * AGP_WRITER_BLOCKS * threads;
+  writer->data = malloc(writer->size);
+  if(!writer->data){
+    error_fail("Out of memory while allocating output buffer\n");
+  }
+
+  writer->compress = 1;
+  gzip_bgzf_init(&writer->bgzf, threads, Z_DEFAULT_COMPRESSION);
+}
+
+/* compress and write len bytes of the buffer, and move what's left to
+   the front */
+static void __write_blocks(agp_writer_t* writer, size_t len){
+  size_t n = gzip_bgzf_compress(&writer->bgzf, writer->data, len), i;
+
+  for(i = 0; i < n; i++)
+    __write_out(writer, (const char*) writer->bgzf.blocks +
+                i * GZIP_BGZF_MAX, writer->bgzf.sizes[i]);
+
+  writer->used -= len;
+  memmove(writer->data, writer->data + len, writer->used);
+}
+
+void agp_writer_flush(agp_writer_t* writer){
+  if(writer->compress){
+    __write_blocks(writer, writer->used - writer->used % GZIP_BGZF_DATA);
+    return;
+  }
+
+  if(writer->used > 0)
+    __write_out(writer, writer->data, writer->used);
+  writer->used = 0;
+}
+
+void agp_writer_write(agp_writer_t* writer, const char* data, size_t len){
+  writer->total += len;
+
+  /* everything goes through the buffer to be compressed */
+  while(writer->compress && len > 0){
+    size_t n = writer->size - writer->used < len ?
+      writer->size - writer->used : len;
+
+    memcpy(writer->data + writer->used, data, n);
+    writer->used += n;
+    data += n;
+    len  -= n;
+
+    if(writer->used == writer->size)
+      agp_writer_flush(writer);
+  }
+  if(writer->compress)
+    return;
+
+  if(writer->used + len <= writer->size){
+    memcpy(writer->data + writer->used, data, len);
+    writer->used += len;
+    return;
+  }
+
+  /* too big to be worth copying */
+  agp_writer_flush(writer);
+  if(len >= writer->size){
+    __write_out(writer, data, len);
+  } else {
+    memcpy(writer->data, data, len);
+    writer->used = len;
+  }
+}
+
+void agp_writer_record(agp_writer_t* writer, const agp_scaffold_t* record){
+  size_t need = agp_record_size(record);
+
+  if(writer->used + need > writer->size){
+    agp_writer_flush(writer);
+
+    if(need > writer->size){
+      char * data = realloc(writer->data, need);
+      if(!data){
+        error_fail("Out of memory while writing the agp\n");
+      }
+      writer->data = data;
+      writer->size = need;
+    }
+  }
+
+  size_t len = agp_format_record(writer->data + writer->used, record);
+  writer->used  += len;
+  writer->total += len;
+}
+
+void agp_writer_close(agp_writer_t* writer){
+  if(writer->compress){
+    __write_blocks(writer, writer->used);
+    __write_out(writer, (const char*) gzip_bgzf_eof, sizeof(gzip_bgzf_eof));
+    gzip_bgzf_free(&writer->bgzf);
+  }
+
+  agp_writer_flush(writer);
+  if(writer->fd < 0)
+    fflush(writer->file);
+
+  free(writer->data);
+  writer->data = NULL;
+  writer->size = 0;
+}
+
+/* renumber the records of an object, returning an upper bound on its
+   formatted size. Objects a fork shares with its base are already
+   numbered, and only sized */
+static size_t __renumber(agp_graph_t * agp, agp_object_t * object){
+  unsigned int num = 1;
+  unsigned long pos = 0;
+  size_t size = 0;
+
+  agp_scaffold_t* record;
+  if(agp_graph_shared(agp, object)){
+    for(record = object->head; record != NULL; record = record->next)
+      size += agp_record_size(record);
+    return size;
+  }
+
+  for(record = object->head; record != NULL; record = record->next){
+
+    /* Adjust record for any changes made */
+    record->num = num++;
+    record->object_start = ++pos;
+
+    if(record->type == 'U' || record->type == 'N')
+      pos += record->component.gap.length -1 ;
+    else
+      pos += (record->component.seq.end - record->component.seq.start);
+
+    record->object_end = pos;
+
+    size += agp_record_size(record);
+  }
+
+  return size;
+}
+
+/* Threaded printing. Objects are independent, so they are renumbered
+   and formatted on worker threads into private buffers, one per
+   object, and written out in sorted order. Batches of objects are
+   handled at a time so only a bounded amount of output is held. */
+#define AGP_PRINT_BATCH 64
+
+typedef struct {
+  char * data;
+  size_t len, size;
+} agp_print_buffer_t;
+
+typedef struct {
+  agp_graph_t * graph;
+  agp_object_t ** objects;
+  agp_print_buffer_t * buffers;
+} agp_print_job_t;
+
+static void __format_object(void * data, size_t i){
+  agp_print_job_t * job = data;
+  agp_object_t * object = job->objects[i];
+  agp_print_buffer_t * buffer = job->buffers + i;
+  size_t need = __renumber(job->graph, object);
+
+  if(need > buffer->size){
+    free(buffer->data);
+    buffer->size = need;
+    buffer->data = malloc(need);
+    if(!buffer->data){
+      error_fail("Out of memory while formatting output\n");
+    }
+  }
+
+  char * cur = buffer->data;
+  agp_scaffold_t * record;
+  for(record = object->head; record != NULL; record = record->next)
+    cur += agp_format_record(cur, record);
+
+  buffer->len = cur - buffer->data;
+}
+
+static void __print_parallel(agp_graph_t * agp, agp_object_t ** objects,
+                             int size, agp_writer_t * writer, int threads){
+  size_t batch = (size_t) threads * AGP_PRINT_BATCH;
+  agp_print_buffer_t * buffers = calloc(batch, sizeof(agp_print_buffer_t));
+  size_t i, j;
+
+  for(i = 0; i < (size_t) size; i += batch){
+    size_t n = size - i < batch ? size - i : batch;
+    agp_print_job_t job = { agp, objects + i, buffers };
+
+    parallel_for(threads, n, __format_object, &job);
+
+    for(j = 0; j < n; j++)
+      agp_writer_write(writer, buffers[j].data, buffers[j].len);
+  }
+
+  for(i = 0; i < batch; i++)
+    free(buffers[i].data);
+  free(buffers);
+}
+
+void agp_graph_renumber(agp_graph_t * agp){
+  khiter_t k;
+
+  agp_graph_flatten(agp);
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++)
+    if (kh_exist(agp->objects, k))
+      __renumber(agp, kh_value(agp->objects, k));
+}
+
+int agp_graph_print (agp_graph_t * agp, FILE* out){
+  return agp_graph_print_threads(agp, out, 1);
+}
+
+static int __print(agp_graph_t * agp, agp_writer_t * writer, int threads){
+  int size = kh_size(agp->objects);
+  agp_object_t ** objects = agp_graph_sorted_objects(agp);
+
+  agp_graph_flatten(agp);
+
+  if(threads > 1 && size > 1){
+    __print_parallel(agp, objects, size, writer, threads);
+  } else {
+    int i;
+    for(i = 0; i < size; i++){
+      __renumber(agp, objects[i]);
+
+      agp_scaffold_t* record;
+      for(record = objects[i]->head; record != NULL; record = record->next)
+        agp_writer_record(writer, record);
+    }
+  }
+
+  agp_writer_close(writer);
+
+  free(objects);
+  return (int) writer->total;
+}
+
+int agp_graph_print_threads (agp_graph_t * agp, FILE* out, int threads){
+  agp_writer_t writer;
+
+  agp_writer_init(&writer, out);
+  return __print(agp, &writer, threads);
+}
+
+int agp_graph_print_bgzf (agp_graph_t * agp, FILE* out, int threads){
+  agp_writer_t writer;
+
+  agp_writer_init_bgzf(&writer, out, threads);
+  return __print(agp, &writer, threads);
+}
+
+int agp_graph_print_object (agp_graph_t * agp, agp_object_t * object,
+                            FILE* out){
+  agp_writer_t writer;
+  agp_scaffold_t* record;
+
+  agp_graph_flatten_object(agp, object);
+  __renumber(agp, object);
+
+  agp_writer_init(&writer, out);
+  for(record = object->head; record != NULL; record = record->next)
+    agp_writer_record(&writer, record);
+  agp_writer_close(&writer);
+
+  return (int) writer.total;
+}
@@ -0,0 +1,54 @@
+#ifndef AGP_WRITE_H_
+#define AGP_WRITE_H_
+
+#include <stdio.h>
+
+#include "agp-graph.h"
+#include "gzip.h"
+
+/* Output buffer. Records are formatted straight into data, which is
+   written out in large chunks. Regular files are written with write(2)
+   on the underlying descriptor, anything else goes through the FILE.
+
+   A compressing writer packs the data into BGZF blocks (gzip.h) when
+   flushed, keeping back a partial last block until it's closed. Its
+   buffer holds AGP_WRITER_BLOCKS blocks per thread */
+#define AGP_WRITER_SIZE (1 << 20)
+#define AGP_WRITER_BLOCKS 16
+
+typedef struct {
+  char * data;
+  size_t used, size;
+
+  int fd;
+  FILE * file;
+
+  /* bytes passed to the writer so far */
+  size_t total;
+
+  int compress;
+  gzip_bgzf_t bgzf;
+} agp_writer_t;
+
+void agp_writer_init(agp_writer_t*, FILE*);
+
+/* writer compressing to BGZF on up to threads threads */
+void agp_writer_init_bgzf(agp_writer_t*, FILE*, int threads);
+
+/* write out everything buffered, and release the buffer */
+void agp_writer_close(agp_writer_t*);
+
+void agp_writer_flush(agp_writer_t*);
+void agp_writer_write(agp_writer_t*, const char* data, size_t len);
+
+/* format a record as an agp line */
+void agp_writer_record(agp_writer_t*, const agp_scaffold_t*);
+
+/* upper bound on the formatted length of a record */
+size_t agp_record_size(const agp_scaffold_t*);
+
+/* format a record into out, which must hold agp_record_size
+   bytes. Returns the number of bytes used (no NUL is added) */
+size_t agp_format_record(char* out, const agp_scaffold_t*);
+
+#endif // AGP_WRITE_H_
@@ -8,48 +8,249 @@
 
 const char* const help_message =
   "Usage: magpie [OPTION...] <SCRIPT> [<AGP>]\n"
+  "  or:  magpie diff [OPTION...] <OLD AGP> <NEW AGP>\n"
   "mAGPie -- Curate AGP files\n\n"
   "  -s, --simplify         Simplify the agp output. If adjacent \n"
   "                         components in the agp file are contiguous,\n"
   "                         then combine and remove internal gap.\n"
-  "  -o, --out FILE         Output file (default: stdout)\n"
+  "  -c, --check            Only check the script against the agp file,\n"
+  "                         on a scratch copy, without writing output\n"
+  "  -i, --interactive      After the script, read commands from stdin,\n"
+  "                         with UNDO, REDO and checkpoints. Type HELP\n"
+  "                         for the list. The agp is written on QUIT\n"
+  "  -o, --out FILE         Output file (default: stdout). Names ending\n"
+  "                         in .gz are compressed (BGZF)\n"
+  "  -t, --threads N        Number of threads to use (default: 1)\n"
+  "  -e, --engine ENGINE    Scaffold representation, list or tree. Use\n"
+  "                         tree for many edits on long scaffolds\n"
+  "                         (default: list)\n"
+  "      --order ORDER      Order of the objects in the output, lexical\n"
+  "                         or natural, where numbers in names compare\n"
+  "                         as numbers (chr2 before chr10)\n"
+  "                         (default: lexical)\n"
+  "      --fasta-in FILE    Contig FASTA (indexed by FILE.fai if there\n"
+  "                         is one) to build scaffold sequences from\n"
+  "      --fasta-out FILE   Write the scaffolds of the final agp as\n"
+  "                         FASTA, with gaps as runs of N. Names ending\n"
+  "                         in .gz are compressed (BGZF)\n"
+  "      --pairs-in FILE    Hi-C pairs (.pairs) on the scaffolds of the\n"
+  "                         agp as read, to move to the final agp\n"
+  "      --pairs-out FILE   Write the pairs of --pairs-in on the\n"
+  "                         scaffolds of the final agp. Names ending in\n"
+  "                         .gz are compressed (BGZF)\n"
+  "      --pairs-contigs    Positions in --pairs-in are on the contigs\n"
+  "                         instead of the scaffolds\n"
+  "      --chain-out FILE   Write a UCSC chain file from the agp as read\n"
+  "                         to the final agp\n"
+  "      --bed-in FILE      BED features on the agp as read, to move to\n"
+  "                         the final agp\n"
+  "      --bed-out FILE     Write the features of --bed-in on the final\n"
+  "                         agp. Features that were split up are\n"
+  "                         written as comments\n"
+  "      --gff-in FILE      Same as --bed-in, for GFF3\n"
+  "      --gff-out FILE     Same as --bed-out, for GFF3\n"
+  "      --fork SCRIPT=FILE Also run SCRIPT on the agp as read, and write\n"
+  "                         the result to FILE. Can be given many times;\n"
+  "                         the agp is only read once, and the scripts\n"
+  "                         are run on up to --threads threads\n"
+  "      --save-snapshot FILE\n"
+  "                         Save the agp file, as read, to a binary\n"
+  "                         snapshot for fast reloading\n"
+  "      --load-snapshot FILE\n"
+  "                         Load the graph from a snapshot instead of\n"
+  "                         reading an agp file\n"
+  "      --stats            Report time per phase, graph sizes, hash\n"
+  "                         load factors and memory on stderr\n"
+  "      --trace FILE       Write a line of JSON to FILE for every\n"
+  "                         operation run, with its line, verb, records\n"
+  "                         walked and nanoseconds taken. Runs the script\n"
+  "                         on one thread\n"
   "  -h, --help             Give this help list\n"
   "\n"
-  "If no AGP file is given, it's read from stdin\n"
+  "If no AGP file is given, it's read from stdin. Gzip compressed AGP\n"
+  "files are read as they are\n\n"
+  "magpie diff writes a script turning OLD AGP into NEW AGP to the\n"
+  "output. Components of NEW AGP joined from several of OLD AGP need\n"
+  "--simplify when the script is run\n"
   "Report bugs to github.com/IGBB/magpie.\n";
 
 
+/* long only options */
+#define OPT_SAVE_SNAPSHOT 300
+#define OPT_LOAD_SNAPSHOT 301
+#define OPT_STATS         302
+#define OPT_TRACE         303
+#define OPT_ORDER         304
+#define OPT_FASTA_IN      305
+#define OPT_FASTA_OUT     306
+#define OPT_PAIRS_IN      307
+#define OPT_PAIRS_OUT     308
+#define OPT_PAIRS_CONTIGS 309
+#define OPT_CHAIN_OUT     310
+#define OPT_BED_IN        311
+#define OPT_BED_OUT       312
+#define OPT_GFF_IN        313
+#define OPT_GFF_OUT       314
+#define OPT_FORK          315
+
 static ko_longopt_t longopts[] = {
 
     { "simplify", ko_no_argument, 's' },
+    { "check", ko_no_argument, 'c' },
+    { "interactive", ko_no_argument, 'i' },
     { "out", ko_required_argument, 'o' },
+    { "threads", ko_required_argument, 't' },
+    { "engine", ko_required_argument, 'e' },
     { "help", ko_no_argument, 'h' },
+    { "save-snapshot", ko_required_argument, OPT_SAVE_SNAPSHOT },
+    { "load-snapshot", ko_required_argument, OPT_LOAD_SNAPSHOT },
+    { "stats", ko_no_argument, OPT_STATS },
+    { "trace", ko_required_argument, OPT_TRACE },
+    { "order", ko_required_argument, OPT_ORDER },
+    { "fasta-in", ko_required_argument, OPT_FASTA_IN },
+    { "fasta-out", ko_required_argument, OPT_FASTA_OUT },
+    { "pairs-in", ko_required_argument, OPT_PAIRS_IN },
+    { "pairs-out", ko_required_argument, OPT_PAIRS_OUT },
+    { "pairs-contigs", ko_no_argument, OPT_PAIRS_CONTIGS },
+    { "chain-out", ko_required_argument, OPT_CHAIN_OUT },
+    { "bed-in", ko_required_argument, OPT_BED_IN },
+    { "bed-out", ko_required_argument, OPT_BED_OUT },
+    { "gff-in", ko_required_argument, OPT_GFF_IN },
+    { "gff-out", ko_required_argument, OPT_GFF_OUT },
+    { "fork", ko_required_argument, OPT_FORK },
 
     {NULL, 0, 0}
   };
 
 
+/* --fork SCRIPT=FILE, split at the last '=' */
+static void __add_fork(arguments_t * arguments, char * arg){
+  char * equals = strrchr(arg, '=');
+
+  if(!equals || equals == arg || !equals[1]){
+    fprintf(stderr, "Expected SCRIPT=FILE for --fork: %s\n", arg);
+    exit(EXIT_FAILURE);
+  }
+  *equals = '\0';
+
+  int n = arguments->forks + 1;
+  arguments->fork_scripts = realloc(arguments->fork_scripts,
+                                    sizeof(char*) * n);
+  arguments->fork_outs = realloc(arguments->fork_outs, sizeof(char*) * n);
+  if(!arguments->fork_scripts || !arguments->fork_outs){
+    fprintf(stderr, "Out of memory while parsing options\n");
+    exit(EXIT_FAILURE);
+  }
+
+  arguments->fork_scripts[arguments->forks] = arg;
+  arguments->fork_outs[arguments->forks]    = equals + 1;
+  arguments->forks = n;
+}
+
 arguments_t parse_options(int argc, char **argv) {
   arguments_t arguments = { .simplify = 0,
+                            .threads  = 1,
+                            .tree     = 0,
+                            .check    = 0,
+                            .interactive = 0,
+                            .stats    = 0,
+                            .natural  = 0,
+                            .pairs_contigs = 0,
                             .script   = NULL,
                             .agp     = "/dev/stdin",
-                            .out      = "/dev/stdout"
+                            .out      = "/dev/stdout",
+                            .save_snapshot = NULL,
+                            .load_snapshot = NULL,
+                            .trace    = NULL,
+                            .fasta_in  = NULL,
+                            .fasta_out = NULL,
+                            .pairs_in  = NULL,
+                            .pairs_out = NULL,
+                            .chain_out = NULL,
+                            .bed_in    = NULL,
+                            .bed_out   = NULL,
+                            .gff_in    = NULL,
+                            .gff_out   = NULL,
+                            .fork_scripts = NULL,
+                            .fork_outs = NULL,
+                            .forks     = 0,
+                            .diff      = NULL
   };
 
 
+  /* magpie diff takes the same options after the word */
+  int diff = argc > 1 && strcmp(argv[1], "diff") == 0;
+  argc -= diff;
+  argv += diff;
+
   ketopt_t opt = KETOPT_INIT;
 
   int  c;
-  while ((c = ketopt(&opt, argc, argv, 1, "o:sh", longopts)) >= 0) {
+  while ((c = ketopt(&opt, argc, argv, 1, "o:st:e:cih", longopts)) >= 0) {
     switch(c){
       case 'o': arguments.out      = opt.arg; break;
       case 's': arguments.simplify = 1;       break;
+      case 'c': arguments.check    = 1;       break;
+      case 'i': arguments.interactive = 1;    break;
+      case 't':
+        arguments.threads = atoi(opt.arg);
+        if(arguments.threads < 1){
+          fprintf(stderr, "Number of threads must be a positive integer\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'e':
+        if(strcmp(opt.arg, "tree") == 0)
+          arguments.tree = 1;
+        else if(strcmp(opt.arg, "list") == 0)
+          arguments.tree = 0;
+        else {
+          fprintf(stderr, "Unknown engine: %s\n", opt.arg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case OPT_ORDER:
+        if(strcmp(opt.arg, "natural") == 0)
+          arguments.natural = 1;
+        else if(strcmp(opt.arg, "lexical") == 0)
+          arguments.natural = 0;
+        else {
+          fprintf(stderr, "Unknown order: %s\n", opt.arg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case OPT_SAVE_SNAPSHOT: arguments.save_snapshot = opt.arg; break;
+      case OPT_LOAD_SNAPSHOT: arguments.load_snapshot = opt.arg; break;
+      case OPT_STATS:         arguments.stats = 1;             break;
+      case OPT_TRACE:         arguments.trace = opt.arg;       break;
+      case OPT_FASTA_IN:      arguments.fasta_in = opt.arg;    break;
+      case OPT_FASTA_OUT:     arguments.fasta_out = opt.arg;   break;
+      case OPT_PAIRS_IN:      arguments.pairs_in = opt.arg;    break;
+      case OPT_PAIRS_OUT:     arguments.pairs_out = opt.arg;   break;
+      case OPT_PAIRS_CONTIGS: arguments.pairs_contigs = 1;     break;
+      case OPT_CHAIN_OUT:     arguments.chain_out = opt.arg;   break;
+      case OPT_BED_IN:        arguments.bed_in = opt.arg;      break;
+      case OPT_BED_OUT:       arguments.bed_out = opt.arg;     break;
+      case OPT_GFF_IN:        arguments.gff_in = opt.arg;      break;
+      case OPT_GFF_OUT:       arguments.gff_out = opt.arg;     break;
+      case OPT_FORK:          __add_fork(&arguments, opt.arg); break;
       case 'h':
         printf(help_message);
         exit(EXIT_SUCCESS);
     };
   }
 
+  if(diff){
+    if(argc - opt.ind != 2){
+      fprintf(stderr, "Expected two agp files to diff\n");
+      fprintf(stderr, help_message);
+      exit(EXIT_FAILURE);
+    }
+    arguments.agp  = argv[opt.ind];
+    arguments.diff = argv[opt.ind + 1];
+    return arguments;
+  }
+
   if( argc-opt.ind == 1 || argc-opt.ind == 2 ){
       arguments.script = argv[opt.ind];
       if(argc - opt.ind == 2)
@@ -60,6 +261,34 @@ arguments_t parse_options(int argc, char **argv) {
           fprintf(stderr, help_message);
           exit(EXIT_FAILURE);
   }
-  
+
+  if(!arguments.fasta_in != !arguments.fasta_out){
+    fprintf(stderr, "--fasta-in and --fasta-out go together\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(!arguments.pairs_in != !arguments.pairs_out){
+    fprintf(stderr, "--pairs-in and --pairs-out go together\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(!arguments.bed_in != !arguments.bed_out){
+    fprintf(stderr, "--bed-in and --bed-out go together\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(!arguments.gff_in != !arguments.gff_out){
+    fprintf(stderr, "--gff-in and --gff-out go together\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* commands come from stdin, so the graph can't */
+  if(arguments.interactive && !arguments.load_snapshot &&
+     argc - opt.ind < 2){
+    fprintf(stderr, "An AGP file (or --load-snapshot) is needed with "
+            "--interactive\n");
+    exit(EXIT_FAILURE);
+  }
+
   return arguments;
 }
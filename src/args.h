@@ -5,7 +5,28 @@ extern const char* const program_version;
 
 typedef struct {
   int simplify;
+  int threads;
+  int tree;
+  int check;
+  int interactive;
+  int stats;
+  int natural;
+  int pairs_contigs;
   char *script, *agp, *out;
+  char *save_snapshot, *load_snapshot;
+  char *trace;
+  char *fasta_in, *fasta_out;
+  char *pairs_in, *pairs_out;
+  char *chain_out;
+  char *bed_in, *bed_out, *gff_in, *gff_out;
+
+  /* --fork: more scripts, each run on a fork of the agp as read and
+     written to its own output */
+  char **fork_scripts, **fork_outs;
+  int forks;
+
+  /* magpie diff: the agp to turn agp into */
+  char *diff;
 } arguments_t;
 
 arguments_t parse_options(int argc, char **argv);
@@ -0,0 +1,566 @@
+#include "diff.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "klib/khash.h"
+#include "script.h"
+
+KHASH_SET_INIT_INT64(claimed)
+
+/* a component of to, as the record of from it matches, with the
+   orientation it should end up with */
+typedef struct {
+  agp_scaffold_t * record;
+  char orientation;
+} diff_unit_t;
+
+/* units of an object of to that are already together in from. left
+   and right are their ends in the order of from */
+typedef struct {
+  size_t first, last;
+  agp_scaffold_t *left, *right;
+  agp_object_t * object;
+  int fix;                           /* -1, SCRIPT_REV or SCRIPT_REVCOMP */
+  long key;                          /* position of left in object */
+} diff_strip_t;
+
+typedef struct {
+  agp_graph_t *from, *to;
+  FILE * out;
+  size_t ops, temporary;
+} diff_t;
+
+#define __fail(...) do {                                                \
+    fprintf(stderr, "Can't diff: " __VA_ARGS__);                        \
+    exit(EXIT_FAILURE); } while (0)
+
+#define __seq(r) str_pool_get((r)->component.seq.name),                 \
+    (r)->component.seq.start, (r)->component.seq.end
+
+static void * __alloc(size_t size){
+  void * data = malloc(size ? size : 1);
+  if(!data){
+    fprintf(stderr, "Out of memory while diffing\n");
+    exit(EXIT_FAILURE);
+  }
+  return data;
+}
+
+static agp_component_ref_t __ref(agp_scaffold_t * record){
+  agp_component_ref_t ref = { { record->component.seq.name,
+                                record->component.seq.start,
+                                record->component.seq.end }, 0 };
+  return ref;
+}
+
+static void __segment(script_op_t * op, agp_scaffold_t * left,
+                      agp_scaffold_t * right){
+  op->left  = __ref(left);
+  op->right = __ref(right);
+  op->range = left == right ? SCRIPT_SINGLE : SCRIPT_THRU;
+}
+
+/* check, run and write an operation */
+static void __emit(diff_t * diff, script_op_t * op){
+  char error[1024];
+  str_id_t names[3];
+
+  op->line   = diff->ops + 1;
+  op->column = 1;
+  if(script_op_check(op, diff->from, names, error, sizeof(error)) < 0){
+    fprintf(stderr, "Can't diff: %s, at ", error);
+    script_op_write(op, stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  script_op_run(op, diff->from);
+  script_op_write(op, diff->out);
+  diff->ops++;
+}
+
+/* sequence next to a record, over a gap */
+static agp_scaffold_t * __next(agp_graph_t * agp, agp_scaffold_t * record,
+                               int direction){
+  agp_scaffold_t * next = agp_graph_neighbor(agp, record, direction);
+  if(next && agp_is_gap(next))
+    next = agp_graph_neighbor(agp, next, direction);
+  return next;
+}
+
+static void __split(diff_t * diff, agp_scaffold_t * record,
+                    unsigned long pos){
+  script_op_t op = { .verb = SCRIPT_SPLIT };
+
+  /* SPLIT leaves at least two bases before the cut */
+  if(pos <= record->component.seq.start)
+    __fail("%s:%lu-%lu would have to be split after its first base\n",
+           __seq(record));
+
+  op.target = __ref(record);
+  op.pos = pos;
+  __emit(diff, &op);
+}
+
+/* sequence of from holding a base of a component of to */
+static agp_scaffold_t * __at(diff_t * diff, agp_scaffold_t * record,
+                             unsigned long pos){
+  agp_scaffold_t * found =
+    agp_graph_component_at(diff->from, record->component.seq.name, pos);
+  if(!found)
+    __fail("%s:%lu of %s:%lu-%lu isn't in the old agp\n",
+           str_pool_get(record->component.seq.name), pos, __seq(record));
+  return found;
+}
+
+/* a cut of a sequence of from after pos */
+typedef struct {
+  agp_scaffold_t * record;
+  unsigned long pos;
+} diff_cut_t;
+
+/* by sequence, from the right, so every cut leaves the record with
+   the start it had */
+static int __cut_cmp(const void * a, const void * b){
+  const diff_cut_t * l = a, * r = b;
+  const agp_seqinfo_t * x = &l->record->component.seq;
+  const agp_seqinfo_t * y = &r->record->component.seq;
+
+  if(x->name != y->name)
+    return (x->name > y->name) - (x->name < y->name);
+  if(x->start != y->start)
+    return (x->start > y->start) - (x->start < y->start);
+  return (l->pos < r->pos) - (l->pos > r->pos);
+}
+
+/* cut the sequences of from at the component boundaries of to */
+static void __split_all(diff_t * diff, agp_object_t ** objects, size_t n){
+  diff_cut_t * cuts = NULL;
+  size_t used = 0, size = 0, i;
+  agp_scaffold_t * cur;
+
+  for(i = 0; i < n; i++)
+    for(cur = objects[i]->head; cur != NULL; cur = cur->next){
+      if(cur->type != 'W')
+        continue;
+
+      unsigned long ends[2] = { cur->component.seq.start - 1,
+                                cur->component.seq.end };
+      int j;
+
+      for(j = 0; j < 2; j++){
+        agp_scaffold_t * found = __at(diff, cur, ends[j] + (j == 0));
+        if(ends[j] < found->component.seq.start ||
+           ends[j] >= found->component.seq.end)
+          continue;
+
+        if(used == size){
+          size = size ? size * 2 : 1024;
+          cuts = realloc(cuts, sizeof(diff_cut_t) * size);
+          if(!cuts){
+            fprintf(stderr, "Out of memory while diffing\n");
+            exit(EXIT_FAILURE);
+          }
+        }
+        cuts[used].record = found;
+        cuts[used].pos = ends[j];
+        used++;
+      }
+    }
+
+  if(used)
+    qsort(cuts, used, sizeof(diff_cut_t), __cut_cmp);
+  for(i = 0; i < used; i++)
+    if(i == 0 || cuts[i].record != cuts[i - 1].record ||
+       cuts[i].pos != cuts[i - 1].pos)
+      __split(diff, cuts[i].record, cuts[i].pos);
+
+  free(cuts);
+}
+
+#define __flippable(c) ((c) == '+' || (c) == '-')
+
+/* match the components of to to sequences of from. Returns the units
+   of every object, in order, with offsets[i] the first of object i */
+static diff_unit_t * __match(diff_t * diff, agp_object_t ** objects,
+                             size_t n, size_t * offsets, size_t * joined){
+  khash_t(claimed) * claimed = kh_init(claimed);
+  diff_unit_t * units = NULL;
+  size_t used = 0, size = 0, i, j;
+  agp_scaffold_t * cur;
+  khiter_t k;
+  int ret;
+
+  for(i = 0; i < n; i++){
+    offsets[i] = used;
+
+    for(cur = objects[i]->head; cur != NULL; cur = cur->next){
+      if(cur->type != 'W')
+        continue;
+
+      const agp_seqinfo_t * seq = &cur->component.seq;
+      unsigned long pos = seq->start;
+      size_t first = used;
+
+      while(pos <= seq->end){
+        agp_scaffold_t * found = __at(diff, cur, pos);
+        if(found->component.seq.start != pos)
+          __fail("sequences overlapping %s:%lu-%lu in the old agp\n",
+                 __seq(found));
+
+        kh_put(claimed, claimed, (uint64_t) (uintptr_t) found, &ret);
+        if(ret == 0)
+          __fail("%s:%lu-%lu is used more than once in the new agp\n",
+                 __seq(found));
+
+        if(found->component.seq.orientation != seq->orientation &&
+           (!__flippable(found->component.seq.orientation) ||
+            !__flippable(seq->orientation)))
+          __fail("%s:%lu-%lu can't go from orientation %c to %c\n",
+                 __seq(found), found->component.seq.orientation,
+                 seq->orientation);
+
+        if(used == size){
+          size = size ? size * 2 : 1024;
+          units = realloc(units, sizeof(diff_unit_t) * size);
+          if(!units){
+            fprintf(stderr, "Out of memory while diffing\n");
+            exit(EXIT_FAILURE);
+          }
+        }
+        units[used].record = found;
+        units[used].orientation = seq->orientation;
+        used++;
+        pos = found->component.seq.end + 1;
+      }
+
+      /* pieces of a reversed component run backwards, as simplify
+         joins them */
+      if(seq->orientation == '-')
+        for(j = 0; first + j < used - 1 - j; j++){
+          diff_unit_t tmp = units[first + j];
+          units[first + j] = units[used - 1 - j];
+          units[used - 1 - j] = tmp;
+        }
+      if(used - first > 1)
+        (*joined)++;
+    }
+  }
+  offsets[n] = used;
+
+  /* and everything of from must be in to */
+  agp_graph_flatten(diff->from);
+  for (k = kh_begin(diff->from->objects);
+       k != kh_end(diff->from->objects); k++){
+    if (!kh_exist(diff->from->objects, k)) continue;
+    for(cur = kh_value(diff->from->objects, k)->head; cur; cur = cur->next)
+      if(cur->type == 'W' &&
+         kh_get(claimed, claimed, (uint64_t) (uintptr_t) cur) ==
+         kh_end(claimed))
+        __fail("%s:%lu-%lu isn't in the new agp\n", __seq(cur));
+  }
+
+  kh_destroy(claimed, claimed);
+  return units;
+}
+
+/* runs of units already together */
+static size_t __strips(diff_t * diff, diff_unit_t * units, size_t n,
+                       diff_strip_t * strips){
+  agp_graph_t * agp = diff->from;
+  size_t m = 0, i = 0;
+
+  while(i < n){
+    diff_strip_t * strip = strips + m++;
+    agp_scaffold_t * record = units[i].record;
+    int same = record->component.seq.orientation == units[i].orientation;
+    int direction = 0;
+
+    strip->first = strip->last = i;
+    strip->object = agp_graph_record_object(agp, record);
+
+    /* the second unit tells which way the run goes */
+    if(i + 1 < n){
+      agp_scaffold_t * next = units[i + 1].record;
+      int next_same = next->component.seq.orientation ==
+        units[i + 1].orientation;
+
+      if(same == next_same && __next(agp, record, 1) == next && same)
+        direction = 1;
+      else if(same == next_same && __next(agp, record, -1) == next)
+        direction = -1;
+    }
+
+    while(direction && strip->last + 1 < n){
+      agp_scaffold_t * last = units[strip->last].record;
+      agp_scaffold_t * next = units[strip->last + 1].record;
+
+      if(__next(agp, last, direction) != next ||
+         (next->component.seq.orientation ==
+          units[strip->last + 1].orientation) != same)
+        break;
+      strip->last++;
+    }
+
+    if(direction >= 0){
+      strip->left  = units[strip->first].record;
+      strip->right = units[strip->last].record;
+    } else {
+      strip->left  = units[strip->last].record;
+      strip->right = units[strip->first].record;
+    }
+    strip->fix = !same ? SCRIPT_REVCOMP : direction < 0 ? SCRIPT_REV : -1;
+    strip->key = agp_graph_distance(agp, agp_graph_first(agp, strip->object),
+                                     strip->left);
+    i = strip->last + 1;
+  }
+
+  return m;
+}
+
+/* strips of object on the longest run of increasing keys. Sets keep
+   for them */
+static void __longest(diff_strip_t * strips, size_t m, agp_object_t * object,
+                      char * keep){
+  size_t * tails = __alloc(sizeof(size_t) * m);
+  size_t * prev  = __alloc(sizeof(size_t) * m);
+  size_t length = 0, i;
+
+  memset(keep, 0, m);
+  for(i = 0; i < m; i++){
+    if(strips[i].object != object)
+      continue;
+
+    size_t lo = 0, hi = length;
+    while(lo < hi){
+      size_t mid = lo + (hi - lo) / 2;
+      if(strips[tails[mid]].key < strips[i].key)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    prev[i] = lo > 0 ? tails[lo - 1] : (size_t) -1;
+    tails[lo] = i;
+    if(lo == length)
+      length++;
+  }
+
+  for(i = length ? tails[length - 1] : (size_t) -1; i != (size_t) -1;
+      i = prev[i])
+    keep[i] = 1;
+
+  free(tails);
+  free(prev);
+}
+
+typedef struct {
+  agp_object_t * object;
+  size_t units, first;
+} diff_count_t;
+
+static int __count_cmp(const void * a, const void * b){
+  const diff_count_t * l = a, * r = b;
+  if(l->object != r->object)
+    return (l->object > r->object) - (l->object < r->object);
+  return (l->first > r->first) - (l->first < r->first);
+}
+
+/* object holding the most units of the strips, the first one to come
+   on a tie */
+static agp_object_t * __anchor(diff_strip_t * strips, size_t m){
+  diff_count_t * counts = __alloc(sizeof(diff_count_t) * m);
+  agp_object_t * anchor = NULL;
+  size_t best = 0, first = 0, i, j;
+
+  for(i = 0; i < m; i++){
+    counts[i].object = strips[i].object;
+    counts[i].units = strips[i].last - strips[i].first + 1;
+    counts[i].first = i;
+  }
+  qsort(counts, m, sizeof(diff_count_t), __count_cmp);
+
+  for(i = 0; i < m; i = j){
+    size_t units = 0;
+    for(j = i; j < m && counts[j].object == counts[i].object; j++)
+      units += counts[j].units;
+    if(units > best || (units == best && counts[i].first < first)){
+      best = units;
+      first = counts[i].first;
+      anchor = counts[i].object;
+    }
+  }
+
+  free(counts);
+  return anchor;
+}
+
+static void __move(diff_t * diff, diff_strip_t * strip,
+                   agp_scaffold_t * target, int direction){
+  script_op_t op = { .verb = SCRIPT_MOVE };
+
+  __segment(&op, strip->left, strip->right);
+  op.target = __ref(target);
+  op.direction = direction;
+  __emit(diff, &op);
+}
+
+static void __create(diff_t * diff, str_id_t name, agp_scaffold_t * left,
+                     agp_scaffold_t * right){
+  script_op_t op = { .verb = SCRIPT_CREATE };
+
+  __segment(&op, left, right);
+  op.object = name;
+  __emit(diff, &op);
+}
+
+/* move an object out of the way of one of to with its name */
+static void __rename(diff_t * diff, agp_object_t * object){
+  agp_graph_t * agp = diff->from;
+  char name[64];
+  str_id_t id;
+
+  do {
+    snprintf(name, sizeof(name), "magpie_diff%zu", ++diff->temporary);
+    id = str_pool_find(name, strlen(name));
+  } while(id != STR_ID_NONE && (agp_graph_object(agp, id) ||
+                                agp_graph_object(diff->to, id)));
+
+  agp_scaffold_t * first = agp_graph_first(agp, object);
+  script_op_t op = { .verb = SCRIPT_CREATE };
+  op.left  = __ref(first);
+  op.range = SCRIPT_THRU_END;
+  op.object = str_pool_intern(name, strlen(name));
+  __emit(diff, &op);
+}
+
+/* build an object of to out of its units */
+static void __build(diff_t * diff, str_id_t name, diff_unit_t * units,
+                    size_t n, diff_strip_t * strips, char * keep){
+  agp_graph_t * agp = diff->from;
+  size_t m = __strips(diff, units, n, strips), i;
+
+  agp_object_t * anchor = __anchor(strips, m);
+  __longest(strips, m, anchor, keep);
+
+  /* set every run right where it is */
+  for(i = 0; i < m; i++){
+    diff_strip_t * strip = strips + i;
+    if(strip->fix < 0)
+      continue;
+
+    script_op_t op = { .verb = (script_verb_t) strip->fix };
+    __segment(&op, strip->left, strip->right);
+    __emit(diff, &op);
+
+    strip->left  = units[strip->first].record;
+    strip->right = units[strip->last].record;
+  }
+
+  /* whatever is between the kept runs goes to the end of the object,
+     in the order it was */
+  diff_strip_t * last = NULL;
+  size_t first_kept = m;
+  for(i = 0; i < m; i++){
+    if(!keep[i])
+      continue;
+    if(first_kept == m)
+      first_kept = i;
+
+    agp_scaffold_t * between = last ? __next(agp, last->right, 1) : NULL;
+    if(between && between != strips[i].left){
+      diff_strip_t other = { .left = between,
+                             .right = __next(agp, strips[i].left, -1) };
+      agp_scaffold_t * end = agp_graph_last(agp, between);
+      if(agp_is_gap(end))
+        end = agp_graph_neighbor(agp, end, -1);
+      __move(diff, &other, end, 1);
+    }
+    last = strips + i;
+  }
+
+  /* and the other runs go next to the one before them, or in front of
+     the first kept one */
+  last = NULL;
+  for(i = 0; i < m; i++){
+    diff_strip_t * strip = strips + i;
+
+    if(!keep[i] && last){
+      if(__next(agp, last->right, 1) != strip->left)
+        __move(diff, strip, last->right, 1);
+    } else if(!keep[i]){
+      if(__next(agp, strips[first_kept].left, -1) != strip->right)
+        __move(diff, strip, strips[first_kept].left, -1);
+    }
+    last = strip;
+  }
+
+  agp_scaffold_t * left = units[0].record, * right = units[n - 1].record;
+  agp_object_t * object = agp_graph_record_object(agp, left);
+  int whole = agp_graph_distance(agp, left, right) == (long) object->count;
+
+  if(object->name == name && whole)
+    return;
+
+  agp_object_t * taken = agp_graph_object(agp, name);
+  if(taken)
+    __rename(diff, taken);
+  __create(diff, name, left, right);
+}
+
+size_t agp_graph_diff(agp_graph_t * from, agp_graph_t * to, FILE * script,
+                      size_t * joined){
+  diff_t diff = { from, to, script, 0, 0 };
+  size_t n = kh_size(to->objects), i, most = 0;
+
+  agp_graph_set_engine(from, AGP_ENGINE_TREE);
+  agp_graph_flatten(to);
+  agp_object_t ** objects = agp_graph_sorted_objects(to);
+
+  __split_all(&diff, objects, n);
+
+  size_t * offsets = __alloc(sizeof(size_t) * (n + 1));
+  *joined = 0;
+  diff_unit_t * units = __match(&diff, objects, n, offsets, joined);
+
+  for(i = 0; i < n; i++)
+    if(offsets[i + 1] - offsets[i] > most)
+      most = offsets[i + 1] - offsets[i];
+
+  diff_strip_t * strips = __alloc(sizeof(diff_strip_t) * most);
+  char * keep = __alloc(most);
+
+  for(i = 0; i < n; i++)
+    if(offsets[i + 1] > offsets[i])
+      __build(&diff, objects[i]->name, units + offsets[i],
+              offsets[i + 1] - offsets[i], strips, keep);
+
+  /* what the script made has to be to, but for joins and gaps */
+  if(kh_size(from->objects) != n)
+    __fail("the script leaves %zu objects for %zu\n",
+           (size_t) kh_size(from->objects), n);
+  for(i = 0; i < n; i++){
+    agp_object_t * object = agp_graph_object(from, objects[i]->name);
+    agp_scaffold_t * cur = object ? agp_graph_first(from, object) : NULL;
+    size_t j = offsets[i];
+
+    if(cur && agp_is_gap(cur))
+      cur = __next(from, cur, 1);
+    for(; cur && j < offsets[i + 1]; cur = __next(from, cur, 1), j++)
+      if(cur != units[j].record ||
+         cur->component.seq.orientation != units[j].orientation)
+        break;
+    if(cur || j != offsets[i + 1])
+      __fail("the script doesn't rebuild %s\n",
+             str_pool_get(objects[i]->name));
+  }
+
+  free(keep);
+  free(strips);
+  free(units);
+  free(offsets);
+  free(objects);
+
+  return diff.ops;
+}
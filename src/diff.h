@@ -0,0 +1,27 @@
+#ifndef DIFF_H_
+#define DIFF_H_
+
+#include <stdio.h>
+
+#include "agp-graph.h"
+
+/* Script turning one graph into another. Sequences of from are first
+   SPLIT wherever to has a component boundary inside them, so that
+   components match by their (contig, start, end) keys. Every object of
+   to is then built in the object of from holding most of it: runs of
+   its components that are already together (forwards, or backwards so
+   that one REV or REVCOMP sets them right) stay where they are if they
+   are on the longest increasing subsequence of the runs, found in
+   O(n log n), and the rest are MOVEd next to them. The object is then
+   CREATEd out of them under its own name.
+
+   from is edited along the way, with the tree engine, and ends up
+   holding the objects of to. Scripts can't join sequences, so a
+   component of to made of several of from is left as pieces next to
+   each other for --simplify to join; joined is set to how many. Gaps
+   come out as the default gaps of edits. Exits if the graphs don't
+   hold the same sequence. Returns the number of operations written */
+size_t agp_graph_diff(agp_graph_t* from, agp_graph_t* to, FILE* script,
+                      size_t* joined);
+
+#endif // DIFF_H_
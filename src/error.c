@@ -0,0 +1,38 @@
+#include "error.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* each thread has its own trap */
+static __thread error_trap_t * error_trap = NULL;
+
+void error_fail(const char * format, ...){
+  va_list args;
+  va_start(args, format);
+
+  if(!error_trap){
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(EXIT_FAILURE);
+  }
+
+  error_trap_t * trap = error_trap;
+  size_t len;
+
+  vsnprintf(trap->message, sizeof(trap->message), format, args);
+  va_end(args);
+
+  len = strlen(trap->message);
+  if(len > 0 && trap->message[len - 1] == '\n')
+    trap->message[len - 1] = '\0';
+
+  longjmp(trap->jump, 1);
+}
+
+error_trap_t * error_set_trap(error_trap_t * trap){
+  error_trap_t * previous = error_trap;
+  error_trap = trap;
+  return previous;
+}
@@ -0,0 +1,25 @@
+#ifndef ERROR_H_
+#define ERROR_H_
+
+#include <setjmp.h>
+
+/* Errors the graph and the script runner can't go on from. magpie
+   writes the message to stderr and exits. A library caller
+   (magpie.h) sets a trap around each call instead: the message is kept
+   in the trap, without its final newline, and error_fail jumps back to
+   it. Traps are per thread: an error on a thread that set none still
+   exits */
+typedef struct {
+  jmp_buf jump;
+  char message[1024];
+} error_trap_t;
+
+/* report an error, printf style, and don't return */
+void error_fail(const char* format, ...);
+
+/* trap errors of the calling thread from now on (NULL to stop),
+   returning the trap that was set before. The trap's jump must be set
+   with setjmp first */
+error_trap_t * error_set_trap(error_trap_t*);
+
+#endif // ERROR_H_
@@ -0,0 +1,413 @@
+#include "fasta.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "agp-write.h"
+#include "parallel.h"
+
+__KHASH_IMPL(fasta_seq,  ,
+             str_id_t, fasta_seq_t,
+             1, kh_int_hash_func, kh_int_hash_equal)
+
+/* bases per line of output, as samtools writes them */
+#define FASTA_LINE 60
+
+/* bases per piece of work, a whole number of lines so pieces can be
+   wrapped on their own */
+#define FASTA_PIECE (FASTA_LINE * 16384)
+#define FASTA_PIECES_PER_THREAD 4
+
+#define fasta_fail(fasta, ...) do {                                     \
+    fprintf(stderr, "%s: ", (fasta)->path);                             \
+    fprintf(stderr, __VA_ARGS__);                                       \
+    fputc('\n', stderr);                                                \
+    exit(EXIT_FAILURE); } while (0)
+
+static void __add(fasta_t * fasta, const char * name, size_t len,
+                  fasta_seq_t seq){
+  str_id_t id = str_pool_find(name, len);
+  int ret;
+
+  if(id == STR_ID_NONE)
+    return;
+
+  /* last full line, then whatever is left */
+  size_t span = seq.line_bases == 0 ? 0 :
+    (seq.length / seq.line_bases) * seq.line_width +
+    seq.length % seq.line_bases;
+  if(seq.offset > fasta->size || span > fasta->size - seq.offset ||
+     (seq.length > 0 && seq.line_bases == 0) ||
+     seq.line_width < seq.line_bases)
+    fasta_fail(fasta, "Index doesn't match the file for %.*s",
+               (int) len, name);
+
+  khiter_t k = kh_put(fasta_seq, fasta->seqs, id, &ret);
+  if(ret == 0)
+    fasta_fail(fasta, "Sequence %.*s found more than once", (int) len, name);
+  kh_value(fasta->seqs, k) = seq;
+}
+
+/* read name, length, offset, line bases and line width from a .fai */
+static void __read_fai(fasta_t * fasta, FILE * fai){
+  char * line = NULL;
+  size_t capacity = 0;
+
+  while(getline(&line, &capacity, fai) > 0){
+    size_t len = strcspn(line, "\t\n");
+    fasta_seq_t seq;
+
+    if(line[len] != '\t' ||
+       sscanf(line + len + 1, "%lu %zu %u %u", &seq.length, &seq.offset,
+              &seq.line_bases, &seq.line_width) != 4)
+      fasta_fail(fasta, "Malformed .fai line: %s", line);
+
+    __add(fasta, line, len, seq);
+  }
+
+  free(line);
+}
+
+/* index the mapped file the way samtools faidx would */
+static void __scan(fasta_t * fasta){
+  const char * cur = fasta->data, * end = fasta->data + fasta->size;
+
+  while(cur < end){
+    if(*cur != '>')
+      fasta_fail(fasta, "Expected a '>' header at byte %zu",
+                 (size_t) (cur - fasta->data));
+
+    const char * nl = memchr(cur, '\n', end - cur);
+    if(!nl) nl = end;
+
+    const char * name = cur + 1;
+    size_t len = strcspn(name, " \t\r\n");
+    if(name + len > nl) len = nl - name;
+
+    fasta_seq_t seq = { 0, (nl < end ? nl + 1 : end) - fasta->data, 0, 0 };
+    int short_line = 0;
+
+    for(cur = nl + 1; cur < end && *cur != '>'; cur = nl + 1){
+      nl = memchr(cur, '\n', end - cur);
+      if(!nl) nl = end;
+
+      size_t width = nl - cur + 1, bases = nl - cur;
+      if(bases > 0 && cur[bases - 1] == '\r')
+        bases--;
+
+      if(seq.line_width == 0){
+        seq.line_bases = bases;
+        seq.line_width = width;
+      } else if(short_line || bases > seq.line_bases){
+        fasta_fail(fasta, "Lines of %.*s have different lengths, so it "
+                   "can't be indexed", (int) len, name);
+      }
+
+      if(bases < seq.line_bases)
+        short_line = 1;
+      seq.length += bases;
+    }
+
+    __add(fasta, name, len, seq);
+  }
+}
+
+fasta_t * fasta_open(const char * path){
+  fasta_t * fasta = calloc(1, sizeof(fasta_t));
+  struct stat st;
+  int fd = -1;
+
+  fasta->path = path;
+  fasta->seqs = kh_init(fasta_seq);
+
+  FILE * file = fopen(path, "r");
+  if(file)
+    fd = fileno(file);
+  if(fd < 0 || fstat(fd, &st) != 0)
+    fasta_fail(fasta, "Failed to open: %s", strerror(errno));
+  if(!S_ISREG(st.st_mode) || st.st_size == 0)
+    fasta_fail(fasta, "Must be a regular, non-empty file");
+
+  fasta->size = st.st_size;
+  fasta->data = mmap(NULL, fasta->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(fasta->data == MAP_FAILED)
+    fasta_fail(fasta, "Failed to map: %s", strerror(errno));
+  fclose(file);
+
+  if(fasta->size >= 2 && memcmp(fasta->data, "\x1f\x8b", 2) == 0)
+    fasta_fail(fasta, "Compressed FASTA can't be indexed, decompress it "
+               "first");
+
+  char * fai_path = malloc(strlen(path) + 5);
+  sprintf(fai_path, "%s.fai", path);
+
+  FILE * fai = fopen(fai_path, "r");
+  if(fai){
+    __read_fai(fasta, fai);
+    fclose(fai);
+  } else {
+    posix_madvise((void*) fasta->data, fasta->size, POSIX_MADV_SEQUENTIAL);
+    __scan(fasta);
+  }
+  free(fai_path);
+
+  posix_madvise((void*) fasta->data, fasta->size, POSIX_MADV_RANDOM);
+  return fasta;
+}
+
+void fasta_close(fasta_t * fasta){
+  munmap((void*) fasta->data, fasta->size);
+  kh_destroy(fasta_seq, fasta->seqs);
+  free(fasta);
+}
+
+static const fasta_seq_t * __seq(fasta_t * fasta, str_id_t name){
+  khiter_t k = kh_get(fasta_seq, fasta->seqs, name);
+  return k == kh_end(fasta->seqs) ? NULL : &kh_value(fasta->seqs, k);
+}
+
+/* every component must be inside a sequence of the FASTA, checked up
+   front so the workers can't fail */
+static void __check(fasta_t * fasta, agp_object_t ** objects, int size){
+  int i;
+
+  for(i = 0; i < size; i++){
+    agp_scaffold_t * cur;
+
+    for(cur = objects[i]->head; cur != NULL; cur = cur->next){
+      if(cur->type != 'W')
+        continue;
+
+      const fasta_seq_t * seq = __seq(fasta, cur->component.seq.name);
+      if(!seq)
+        fasta_fail(fasta, "No sequence for contig %s (in %s)",
+                   str_pool_get(cur->component.seq.name),
+                   str_pool_get(objects[i]->name));
+
+      if(cur->component.seq.start < 1 ||
+         cur->component.seq.end > seq->length)
+        fasta_fail(fasta, "Component %s:%lu-%lu (in %s) is outside the "
+                   "contig, which is %lu bases long",
+                   str_pool_get(cur->component.seq.name),
+                   cur->component.seq.start, cur->component.seq.end,
+                   str_pool_get(objects[i]->name), seq->length);
+    }
+  }
+}
+
+/* Reverse complement. Both ends are swapped through a table at once, so
+   the string is only walked once; IUPAC codes and case are kept */
+static unsigned char fasta_complement[256];
+
+static void __complement_init(void){
+  static const char pairs[] = "ATCGRYKMBVDHNNSSWWatcgrykmbvdhnnssww";
+  int i;
+
+  for(i = 0; i < 256; i++)
+    fasta_complement[i] = i;
+  for(i = 0; pairs[i]; i += 2){
+    fasta_complement[(unsigned char) pairs[i]]     = pairs[i + 1];
+    fasta_complement[(unsigned char) pairs[i + 1]] = pairs[i];
+  }
+}
+
+static void __reverse_complement(char * s, size_t n){
+  unsigned char * l = (unsigned char*) s, * r = l + n;
+
+  while(r - l > 1){
+    unsigned char t = fasta_complement[*--r];
+    *r = fasta_complement[*l];
+    *l++ = t;
+  }
+  if(r - l == 1)
+    *l = fasta_complement[*l];
+}
+
+/* n bases of a sequence from pos (0 based), without the line ends */
+static void __copy(fasta_t * fasta, const fasta_seq_t * seq,
+                   unsigned long pos, unsigned long n, char * out){
+  while(n > 0){
+    unsigned long line = pos / seq->line_bases;
+    unsigned long column = pos % seq->line_bases;
+    unsigned long take = seq->line_bases - column < n ?
+      seq->line_bases - column : n;
+
+    memcpy(out, fasta->data + seq->offset + line * seq->line_width + column,
+           take);
+    out += take;
+    pos += take;
+    n   -= take;
+  }
+}
+
+/* n bases of a record from offset (0 based, on the record's strand) */
+static void __fetch(fasta_t * fasta, const agp_scaffold_t * record,
+                    unsigned long offset, unsigned long n, char * out){
+  if(agp_is_gap(record)){
+    memset(out, 'N', n);
+    return;
+  }
+
+  const fasta_seq_t * seq = __seq(fasta, record->component.seq.name);
+  if(record->component.seq.orientation == '-'){
+    __copy(fasta, seq, record->component.seq.end - offset - n, n, out);
+    __reverse_complement(out, n);
+  } else {
+    __copy(fasta, seq, record->component.seq.start - 1 + offset, n, out);
+  }
+}
+
+/* A piece of a scaffold: length bases from offset into record, which
+   start a line. The first piece has the header, the last one the
+   scaffold's last line end */
+typedef struct {
+  agp_object_t * object;
+  agp_scaffold_t * record;
+  unsigned long offset, length;
+  int first, last;
+
+  char * bases, * out;
+  size_t used, size, bases_size;
+} fasta_piece_t;
+
+typedef struct {
+  fasta_t * fasta;
+  fasta_piece_t * pieces;
+} fasta_job_t;
+
+static void * __grow(void * data, size_t * size, size_t need){
+  if(need <= *size)
+    return data;
+
+  free(data);
+  *size = need;
+  data = malloc(need);
+  if(!data){
+    fprintf(stderr, "Out of memory while writing FASTA\n");
+    exit(EXIT_FAILURE);
+  }
+  return data;
+}
+
+static void __fill_piece(void * data, size_t i){
+  fasta_job_t * job = data;
+  fasta_piece_t * piece = job->pieces + i;
+  size_t name_len = str_pool_len(piece->object->name);
+  size_t need = piece->length + piece->length / FASTA_LINE + name_len + 4;
+  unsigned long left = piece->length, offset = piece->offset, j;
+  agp_scaffold_t * record = piece->record;
+
+  piece->out   = __grow(piece->out, &piece->size, need);
+  piece->bases = __grow(piece->bases, &piece->bases_size,
+                        piece->length + 1);
+
+  char * cur = piece->bases;
+  while(left > 0){
+    unsigned long n = agp_record_length(record) - offset;
+    if(n > left) n = left;
+
+    __fetch(job->fasta, record, offset, n, cur);
+    cur    += n;
+    left   -= n;
+    offset  = 0;
+    record  = record->next;
+  }
+
+  cur = piece->out;
+  if(piece->first){
+    *cur++ = '>';
+    memcpy(cur, str_pool_get(piece->object->name), name_len);
+    cur += name_len;
+    *cur++ = '\n';
+  }
+
+  for(j = 0; j < piece->length; j += FASTA_LINE){
+    unsigned long n = piece->length - j < FASTA_LINE ?
+      piece->length - j : FASTA_LINE;
+
+    memcpy(cur, piece->bases + j, n);
+    cur += n;
+    if(n == FASTA_LINE || piece->last)
+      *cur++ = '\n';
+  }
+
+  piece->used = cur - piece->out;
+}
+
+size_t agp_graph_print_fasta(agp_graph_t * agp, fasta_t * fasta, FILE * out,
+                             int threads, int compress){
+  int size = kh_size(agp->objects), i = 0;
+  agp_object_t ** objects = agp_graph_sorted_objects(agp);
+  size_t batch = (size_t) threads * FASTA_PIECES_PER_THREAD, n, j;
+  fasta_piece_t * pieces = calloc(batch, sizeof(fasta_piece_t));
+  fasta_job_t job = { fasta, pieces };
+  agp_writer_t writer;
+
+  /* where the next piece starts */
+  agp_scaffold_t * record = NULL;
+  unsigned long offset = 0;
+
+  agp_graph_flatten(agp);
+  __check(fasta, objects, size);
+  __complement_init();
+
+  if(compress)
+    agp_writer_init_bgzf(&writer, out, threads);
+  else
+    agp_writer_init(&writer, out);
+
+  while(i < size){
+    /* cut the next pieces, walking the records on this thread */
+    for(n = 0; n < batch && i < size; n++){
+      fasta_piece_t * piece = pieces + n;
+
+      piece->first = record == NULL;
+      if(piece->first){
+        record = objects[i]->head;
+        offset = 0;
+      }
+
+      piece->object = objects[i];
+      piece->record = record;
+      piece->offset = offset;
+      piece->length = 0;
+
+      while(record && piece->length < FASTA_PIECE){
+        unsigned long left = agp_record_length(record) - offset;
+
+        if(piece->length + left > FASTA_PIECE){
+          offset += FASTA_PIECE - piece->length;
+          piece->length = FASTA_PIECE;
+        } else {
+          piece->length += left;
+          offset = 0;
+          record = record->next;
+        }
+      }
+
+      piece->last = record == NULL;
+      if(piece->last)
+        i++;
+    }
+
+    parallel_for(threads, n, __fill_piece, &job);
+
+    for(j = 0; j < n; j++)
+      agp_writer_write(&writer, pieces[j].out, pieces[j].used);
+  }
+
+  agp_writer_close(&writer);
+
+  for(j = 0; j < batch; j++){
+    free(pieces[j].bases);
+    free(pieces[j].out);
+  }
+  free(pieces);
+  free(objects);
+
+  return writer.total;
+}
@@ -0,0 +1,45 @@
+#ifndef FASTA_H_
+#define FASTA_H_
+
+#include <stdio.h>
+
+#include "klib/khash.h"
+#include "agp-graph.h"
+
+/* Contig FASTA for building scaffold sequences. The file is memory
+   mapped and located through its samtools .fai index (made in memory
+   when there is none), so a component range is found without reading
+   anything before it. Every line of a sequence but its last must have
+   the same length, as samtools faidx requires. */
+typedef struct {
+  unsigned long length;
+  size_t offset;
+  unsigned int line_bases, line_width;
+} fasta_seq_t;
+
+/* sequences are keyed on their interned names. Only names already in
+   the string pool (the contigs of the graph) are kept */
+KHASH_DECLARE(fasta_seq, str_id_t, fasta_seq_t);
+
+typedef struct {
+  const char * path;
+  const char * data;
+  size_t size;
+  khash_t(fasta_seq) * seqs;
+} fasta_t;
+
+/* map and index a FASTA file. Read the agp file first, so the contig
+   names are known */
+fasta_t * fasta_open(const char* path);
+void fasta_close(fasta_t*);
+
+/* write the scaffolds of the graph as FASTA, objects in order, with
+   the sequence of every component (reverse complemented on the minus
+   strand) and a run of N for every gap. Scaffolds are cut into pieces
+   filled on up to threads threads and written in order. With compress
+   set the output is BGZF. Exits if a component isn't in the FASTA.
+   Returns the number of bytes written before compression */
+size_t agp_graph_print_fasta(agp_graph_t*, fasta_t*, FILE*, int threads,
+                             int compress);
+
+#endif // FASTA_H_
@@ -0,0 +1,205 @@
+#include "gzip.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "parallel.h"
+
+static void * __alloc(size_t size){
+  void * data = malloc(size);
+  if(!data){
+    fprintf(stderr, "Out of memory while (de)compressing\n");
+    exit(EXIT_FAILURE);
+  }
+  return data;
+}
+
+static void __refill(gzip_reader_t * reader){
+  reader->pending = fread(reader->in, 1, GZIP_READ_SIZE, reader->file);
+  if(reader->pending < GZIP_READ_SIZE){
+    if(ferror(reader->file)){
+      fprintf(stderr, "Failed to read input\n");
+      exit(EXIT_FAILURE);
+    }
+    reader->eof = 1;
+  }
+}
+
+void gzip_reader_init(gzip_reader_t * reader, FILE * file){
+  memset(reader, 0, sizeof(gzip_reader_t));
+  reader->file = file;
+  reader->in   = __alloc(GZIP_READ_SIZE);
+
+  __refill(reader);
+  reader->gzip = reader->pending >= 2 &&
+    reader->in[0] == 0x1f && reader->in[1] == 0x8b;
+
+  if(reader->gzip){
+    /* 16 is gzip framing, not zlib */
+    if(inflateInit2(&reader->z, 15 + 16) != Z_OK){
+      fprintf(stderr, "Failed to start decompressing input\n");
+      exit(EXIT_FAILURE);
+    }
+    reader->z.next_in  = reader->in;
+    reader->z.avail_in = reader->pending;
+  }
+}
+
+static size_t __read_plain(gzip_reader_t * reader, char * out,
+                           size_t size){
+  if(reader->pending == 0){
+    if(reader->eof)
+      return 0;
+    __refill(reader);
+  }
+
+  size_t n = reader->pending < size ? reader->pending : size;
+  memcpy(out, reader->in, n);
+  memmove(reader->in, reader->in + n, reader->pending - n);
+  reader->pending -= n;
+  return n;
+}
+
+size_t gzip_read(gzip_reader_t * reader, char * out, size_t size){
+  z_stream * z = &reader->z;
+
+  if(!reader->gzip)
+    return __read_plain(reader, out, size);
+
+  z->next_out  = (unsigned char*) out;
+  z->avail_out = size;
+
+  while(z->avail_out == size && !reader->done){
+    if(z->avail_in == 0 && !reader->eof){
+      __refill(reader);
+      z->next_in  = reader->in;
+      z->avail_in = reader->pending;
+    }
+
+    int ret = inflate(z, Z_NO_FLUSH);
+
+    if(ret == Z_STREAM_END){
+      /* another member may follow */
+      if(z->avail_in == 0 && !reader->eof){
+        __refill(reader);
+        z->next_in  = reader->in;
+        z->avail_in = reader->pending;
+      }
+      if(z->avail_in == 0)
+        reader->done = 1;
+      else
+        inflateReset(z);
+    } else if(ret == Z_BUF_ERROR && z->avail_in == 0 && reader->eof){
+      fprintf(stderr, "Unexpected end of compressed input\n");
+      exit(EXIT_FAILURE);
+    } else if(ret != Z_OK && ret != Z_BUF_ERROR){
+      fprintf(stderr, "Failed to decompress input: %s\n",
+              z->msg ? z->msg : "corrupt data");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  return size - z->avail_out;
+}
+
+void gzip_reader_close(gzip_reader_t * reader){
+  if(reader->gzip)
+    inflateEnd(&reader->z);
+  free(reader->in);
+  reader->in = NULL;
+}
+
+/* BGZF. A block is a gzip header with a BC extra field holding the
+   block size less one, raw deflate data, then CRC32 and length */
+#define BGZF_HEADER  18
+#define BGZF_TRAILER 8
+
+const unsigned char gzip_bgzf_eof[28] = {
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+  0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00
+};
+
+static void __put_le(unsigned char * out, unsigned long value, int bytes){
+  int i;
+  for(i = 0; i < bytes; i++, value >>= 8)
+    out[i] = value & 0xff;
+}
+
+static size_t __block(unsigned char * out, const char * data, size_t len,
+                      int level){
+  static const unsigned char header[BGZF_HEADER - 2] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+    0x42, 0x43, 0x02, 0x00
+  };
+  z_stream z;
+  int ret;
+
+  memset(&z, 0, sizeof(z));
+  if(deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+    fprintf(stderr, "Failed to start compressing output\n");
+    exit(EXIT_FAILURE);
+  }
+
+  z.next_in   = (unsigned char*) data;
+  z.avail_in  = len;
+  z.next_out  = out + BGZF_HEADER;
+  z.avail_out = GZIP_BGZF_MAX - BGZF_HEADER - BGZF_TRAILER;
+  ret = deflate(&z, Z_FINISH);
+  size_t packed = z.total_out;
+  deflateEnd(&z);
+
+  /* data that doesn't compress is stored, which always fits */
+  if(ret != Z_STREAM_END)
+    return level == 0 ? 0 : __block(out, data, len, 0);
+
+  size_t size = BGZF_HEADER + packed + BGZF_TRAILER;
+  memcpy(out, header, sizeof(header));
+  __put_le(out + 16, size - 1, 2);
+  __put_le(out + BGZF_HEADER + packed,
+           crc32(crc32(0, NULL, 0), (const unsigned char*) data, len), 4);
+  __put_le(out + BGZF_HEADER + packed + 4, len, 4);
+
+  return size;
+}
+
+void gzip_bgzf_init(gzip_bgzf_t * bgzf, int threads, int level){
+  memset(bgzf, 0, sizeof(gzip_bgzf_t));
+  bgzf->threads = threads;
+  bgzf->level   = level;
+}
+
+static void __compress_block(void * data, size_t i){
+  gzip_bgzf_t * bgzf = data;
+  size_t start = i * GZIP_BGZF_DATA;
+  size_t len = bgzf->len - start < GZIP_BGZF_DATA ?
+    bgzf->len - start : GZIP_BGZF_DATA;
+
+  bgzf->sizes[i] = __block(bgzf->blocks + i * GZIP_BGZF_MAX,
+                           bgzf->data + start, len, bgzf->level);
+}
+
+size_t gzip_bgzf_compress(gzip_bgzf_t * bgzf, const char * data,
+                          size_t len){
+  size_t n = (len + GZIP_BGZF_DATA - 1) / GZIP_BGZF_DATA;
+
+  if(n > bgzf->m){
+    free(bgzf->blocks);
+    free(bgzf->sizes);
+    bgzf->m      = n;
+    bgzf->blocks = __alloc((size_t) GZIP_BGZF_MAX * n);
+    bgzf->sizes  = __alloc(sizeof(size_t) * n);
+  }
+
+  bgzf->data = data;
+  bgzf->len  = len;
+  parallel_for(bgzf->threads, n, __compress_block, bgzf);
+
+  return n;
+}
+
+void gzip_bgzf_free(gzip_bgzf_t * bgzf){
+  free(bgzf->blocks);
+  free(bgzf->sizes);
+  memset(bgzf, 0, sizeof(gzip_bgzf_t));
+}
@@ -0,0 +1,60 @@
+#ifndef GZIP_H_
+#define GZIP_H_
+
+#include <stdio.h>
+#include <zlib.h>
+
+/* Input that may be gzip compressed, told apart by its magic bytes.
+   Members of a concatenated file (as bgzip writes) are read one after
+   the other. Anything else is passed through as it is */
+#define GZIP_READ_SIZE (1 << 16)
+
+typedef struct {
+  FILE * file;
+  int gzip, eof, done;
+  z_stream z;
+
+  /* bytes read from file and not used yet */
+  unsigned char * in;
+  size_t pending;
+} gzip_reader_t;
+
+void gzip_reader_init(gzip_reader_t*, FILE*);
+
+/* read up to size bytes of (decompressed) data into out. Returns 0 at
+   the end of the input. Exits on corrupt or truncated input */
+size_t gzip_read(gzip_reader_t*, char* out, size_t size);
+
+void gzip_reader_close(gzip_reader_t*);
+
+/* BGZF output: gzip members holding at most GZIP_BGZF_DATA bytes each,
+   with their size in an extra field, and an empty member at the end.
+   Blocks are independent, so they are compressed concurrently. Any
+   gzip reader takes it, and it can be indexed by bgzip and tabix */
+#define GZIP_BGZF_DATA 0xff00
+#define GZIP_BGZF_MAX  0x10000
+
+typedef struct {
+  int threads, level;
+
+  /* compressed blocks, GZIP_BGZF_MAX bytes apart, and their sizes */
+  unsigned char * blocks;
+  size_t * sizes;
+  size_t m;
+
+  /* input of the call in progress */
+  const char * data;
+  size_t len;
+} gzip_bgzf_t;
+
+extern const unsigned char gzip_bgzf_eof[28];
+
+void gzip_bgzf_init(gzip_bgzf_t*, int threads, int level);
+
+/* compress len bytes into blocks of GZIP_BGZF_DATA bytes (the last
+   one maybe shorter), left in blocks and sizes. Returns how many */
+size_t gzip_bgzf_compress(gzip_bgzf_t*, const char* data, size_t len);
+
+void gzip_bgzf_free(gzip_bgzf_t*);
+
+#endif // GZIP_H_
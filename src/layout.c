@@ -0,0 +1,154 @@
+#include "layout.h"
+
+#include <stdlib.h>
+#include <limits.h>
+
+__KHASH_IMPL(layout,  ,
+             str_id_t, layout_scaffold_t,
+             1, kh_int_hash_func, kh_int_hash_equal)
+
+static int __piece_cmp(const void * a, const void * b){
+  const layout_piece_t * l = a, * r = b;
+  return (l->start > r->start) - (l->start < r->start);
+}
+
+layout_t * layout_build(agp_graph_t * agp){
+  layout_t * layout = kh_init(layout);
+  khiter_t k;
+  int ret;
+
+  agp_graph_flatten(agp);
+  for (k = kh_begin(agp->objects); k != kh_end(agp->objects); k++){
+    if (!kh_exist(agp->objects, k)) continue;
+    agp_object_t * object = kh_value(agp->objects, k);
+    layout_scaffold_t scaffold = { malloc(sizeof(layout_piece_t) *
+                                          (object->count + 1)), 0,
+                                   object->length };
+    agp_scaffold_t * cur;
+
+    if(!scaffold.pieces){
+      fprintf(stderr, "Out of memory while keeping scaffold layout\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for(cur = object->head; cur != NULL; cur = cur->next)
+      if(cur->type == 'W'){
+        layout_piece_t piece = { cur->object_start, cur->object_end,
+                                 cur->component.seq.name,
+                                 cur->component.seq.start,
+                                 cur->component.seq.end,
+                                 cur->component.seq.orientation };
+        scaffold.pieces[scaffold.n++] = piece;
+      }
+
+    qsort(scaffold.pieces, scaffold.n, sizeof(layout_piece_t), __piece_cmp);
+    khiter_t put = kh_put(layout, layout, object->name, &ret);
+    kh_value(layout, put) = scaffold;
+  }
+
+  return layout;
+}
+
+void layout_destroy(layout_t * layout){
+  khiter_t k;
+
+  for (k = kh_begin(layout); k != kh_end(layout); k++)
+    if (kh_exist(layout, k))
+      free(kh_value(layout, k).pieces);
+  kh_destroy(layout, layout);
+}
+
+#define __min(a, b) ((a) < (b) ? (a) : (b))
+
+int layout_run(agp_graph_t * agp, layout_t * layout, str_id_t name,
+               unsigned long pos, unsigned long end, layout_run_t * run){
+  unsigned long left = end - pos + 1, cpos = pos;
+  str_id_t contig = name;
+  int forward = 1;
+
+  if(layout){
+    khiter_t k = kh_get(layout, layout, name);
+    if(k == kh_end(layout))
+      return -1;
+
+    /* first piece starting after pos */
+    const layout_scaffold_t * scaffold = &kh_value(layout, k);
+    size_t lo = 0, hi = scaffold->n;
+    while(lo < hi){
+      size_t mid = lo + (hi - lo) / 2;
+      if(scaffold->pieces[mid].start <= pos)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    /* in a gap, up to the next piece */
+    if(lo == 0 || scaffold->pieces[lo - 1].end < pos){
+      unsigned long next = lo < scaffold->n ? scaffold->pieces[lo].start :
+        ULONG_MAX;
+      run->record = NULL;
+      run->length = __min(left, next - pos);
+      run->pos = 0;
+      run->reverse = 0;
+      return 0;
+    }
+
+    const layout_piece_t * piece = scaffold->pieces + lo - 1;
+    contig = piece->contig;
+    left = __min(left, piece->end - pos + 1);
+    if(piece->orientation == '-'){
+      cpos = piece->contig_end - (pos - piece->start);
+      forward = 0;
+    } else {
+      cpos = piece->contig_start + (pos - piece->start);
+    }
+  }
+
+  agp_scaffold_t * record = agp_graph_component_at(agp, contig, cpos);
+  if(!record)
+    return -1;
+
+  const agp_seqinfo_t * seq = &record->component.seq;
+  run->record = record;
+  run->length = __min(left, forward ? seq->end - cpos + 1 :
+                      cpos - seq->start + 1);
+  if(seq->orientation == '-'){
+    run->pos = record->object_start + (seq->end - cpos);
+    run->reverse = forward;
+  } else {
+    run->pos = record->object_start + (cpos - seq->start);
+    run->reverse = !forward;
+  }
+
+  return 0;
+}
+
+int layout_span(agp_graph_t * agp, layout_t * layout, str_id_t name,
+                unsigned long start, unsigned long end, layout_span_t * span){
+  unsigned long pos = start;
+  layout_run_t run;
+
+  if(end < start || layout_run(agp, layout, name, start, end, &run) != 0 ||
+     !run.record)
+    return -1;
+
+  span->object  = run.record->object;
+  span->start   = run.pos;
+  span->reverse = run.reverse;
+
+  /* every run has to carry on where the first one would have been */
+  for(pos += run.length; pos <= end; pos += run.length){
+    if(layout_run(agp, layout, name, pos, end, &run) != 0)
+      return -1;
+    if(!run.record)
+      continue;
+
+    unsigned long offset = pos - start;
+    if(run.record->object != span->object || run.reverse != span->reverse ||
+       run.pos != (span->reverse ? span->start - offset :
+                   span->start + offset))
+      return -1;
+  }
+
+  return run.record ? 0 : -1;
+}
@@ -0,0 +1,62 @@
+#ifndef LAYOUT_H_
+#define LAYOUT_H_
+
+#include "klib/khash.h"
+#include "agp-graph.h"
+
+/* The scaffolds as read, kept before the script runs: for every one,
+   its sequence components by their positions in the agp file. With the
+   positions of the graph after renumbering (agp_graph_renumber or
+   printing), this maps any base of the old scaffolds to the new ones,
+   in O(log n) per lookup. */
+typedef struct {
+  unsigned long start, end;          /* on the old scaffold */
+  str_id_t contig;
+  unsigned long contig_start, contig_end;
+  char orientation;
+} layout_piece_t;
+
+typedef struct {
+  layout_piece_t * pieces;           /* sorted by start */
+  size_t n;
+  unsigned long length;
+} layout_scaffold_t;
+
+KHASH_DECLARE(layout, str_id_t, layout_scaffold_t);
+
+typedef khash_t(layout) layout_t;
+
+/* keep the layout of every scaffold. Call before editing the graph */
+layout_t * layout_build(agp_graph_t*);
+void layout_destroy(layout_t*);
+
+/* bases of an old scaffold that stay together on one record of the
+   graph. pos is where the first one is on the record's object, and
+   reverse is set if the rest run backwards from it. record is NULL
+   for a run of gap */
+typedef struct {
+  agp_scaffold_t * record;
+  unsigned long length, pos;
+  int reverse;
+} layout_run_t;
+
+/* run starting at pos on scaffold name, up to end. With a NULL layout
+   name is a contig, and pos a position on it. Returns -1 for an
+   unknown name or a base the graph doesn't have */
+int layout_run(agp_graph_t*, layout_t*, str_id_t name,
+               unsigned long pos, unsigned long end, layout_run_t*);
+
+/* where bases start to end of a scaffold (or contig, with a NULL
+   layout) went, if they stayed together and in order on one object */
+typedef struct {
+  agp_object_t * object;
+  unsigned long start;               /* position of the old start */
+  int reverse;
+} layout_span_t;
+
+/* Returns -1 if start or end is in a gap or unknown, or if the bases
+   were split up */
+int layout_span(agp_graph_t*, layout_t*, str_id_t name,
+                unsigned long start, unsigned long end, layout_span_t*);
+
+#endif // LAYOUT_H_
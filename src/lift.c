@@ -0,0 +1,460 @@
+#include "lift.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "agp-write.h"
+#include "stream.h"
+
+#define BED_COLUMNS 12
+#define GFF_COLUMNS 9
+
+typedef struct {
+  agp_graph_t * graph;
+  layout_t * layout;
+
+  /* new sequence regions written (GFF) */
+  int written;
+} lift_job_t;
+
+/* split a line at tabs into at most max fields, the last one holding
+   the rest. Returns the number of fields */
+static int __fields(const char * line, size_t len, const char ** fields,
+                    size_t * lens, int max){
+  const char * cur = line, * end = line + len;
+  int n = 0;
+
+  while(n < max){
+    const char * tab = n < max - 1 ? memchr(cur, '\t', end - cur) : NULL;
+    fields[n] = cur;
+    lens[n++] = (tab ? tab : end) - cur;
+    if(!tab)
+      break;
+    cur = tab + 1;
+  }
+
+  return n;
+}
+
+static int __number(const char * s, size_t len, unsigned long * value){
+  size_t i;
+
+  *value = 0;
+  for(i = 0; i < len; i++){
+    if(s[i] < '0' || s[i] > '9')
+      return -1;
+    *value = *value * 10 + (s[i] - '0');
+  }
+  return len > 0 ? 0 : -1;
+}
+
+static int __unmapped(stream_buffer_t * buffer, const char * line,
+                      size_t len){
+  stream_put(buffer, "# unmapped: ", 12);
+  stream_put(buffer, line, len);
+  stream_put(buffer, "\n", 1);
+  return STREAM_SKIP;
+}
+
+static void __put_ulong(stream_buffer_t * buffer, unsigned long value){
+  char number[24];
+  stream_put(buffer, number, sprintf(number, "%lu", value));
+}
+
+/* where a boundary between bases (0 based, as BED has them) of a span
+   goes */
+static unsigned long __boundary(const layout_span_t * span,
+                                unsigned long first, unsigned long b){
+  if(span->reverse)
+    return span->start + first - b - 1;
+  return span->start + b - first;
+}
+
+/* check the blocks of a BED12 feature against its length and write
+   them, from the other end if it is reversed */
+static int __blocks(stream_buffer_t * buffer, const char ** fields,
+                    const size_t * lens, unsigned long length, int reverse){
+  unsigned long count, * sizes, * starts;
+  int trailing = lens[10] > 0 && fields[10][lens[10] - 1] == ',';
+  size_t i;
+  int list;
+
+  /* every block takes at least a digit of each list */
+  if(__number(fields[9], lens[9], &count) != 0 || count > lens[10] ||
+     count > lens[11])
+    return -1;
+
+  sizes  = malloc(sizeof(unsigned long) * (count + 1));
+  starts = malloc(sizeof(unsigned long) * (count + 1));
+  if(!sizes || !starts){
+    fprintf(stderr, "Out of memory while lifting\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(list = 0; list < 2; list++){
+    const char * cur = fields[10 + list], * end = cur + lens[10 + list];
+    unsigned long * values = list ? starts : sizes;
+
+    for(i = 0; i < count; i++){
+      const char * comma = memchr(cur, ',', end - cur);
+      if(__number(cur, (comma ? comma : end) - cur, values + i) != 0)
+        break;
+      cur = comma ? comma + 1 : end;
+    }
+    if(i < count || cur != end)
+      break;
+  }
+
+  for(i = 0; list == 2 && i < count; i++)
+    if(sizes[i] > length || starts[i] > length - sizes[i])
+      list = 0;
+
+  if(list != 2){
+    free(sizes);
+    free(starts);
+    return -1;
+  }
+
+  for(list = 0; list < 2; list++){
+    stream_put(buffer, "\t", 1);
+    if(!reverse){
+      stream_put(buffer, fields[10 + list], lens[10 + list]);
+      continue;
+    }
+    for(i = count; i-- > 0;){
+      if(list == 0)
+        __put_ulong(buffer, sizes[i]);
+      else
+        __put_ulong(buffer, length - starts[i] - sizes[i]);
+      if(i > 0 || trailing)
+        stream_put(buffer, ",", 1);
+    }
+  }
+
+  free(sizes);
+  free(starts);
+  return 0;
+}
+
+static int __lift_bed(void * arg, const char * line, size_t len,
+                      stream_buffer_t * buffer, char * error, size_t size){
+  lift_job_t * job = arg;
+  const char * fields[BED_COLUMNS];
+  size_t lens[BED_COLUMNS];
+  unsigned long start, end, thick[2];
+  layout_span_t span;
+  int n, i;
+
+  if(*line == '#' || stream_starts(line, len, "track") ||
+     stream_starts(line, len, "browser")){
+    stream_put(buffer, line, len);
+    stream_put(buffer, "\n", 1);
+    return STREAM_SKIP;
+  }
+
+  n = __fields(line, len, fields, lens, BED_COLUMNS);
+  if(n < 3){
+    snprintf(error, size, "Expected at least 3 columns");
+    return STREAM_ERROR;
+  }
+  if(__number(fields[1], lens[1], &start) != 0 ||
+     __number(fields[2], lens[2], &end) != 0 || end < start){
+    snprintf(error, size, "Expected a start and an end after it");
+    return STREAM_ERROR;
+  }
+  /* BED7 has a thickStart without a thickEnd */
+  for(i = 6; i < n && i < 8; i++)
+    if(__number(fields[i], lens[i], thick + i - 6) != 0 ||
+       thick[i - 6] < start || thick[i - 6] > end ||
+       (i == 7 && thick[1] < thick[0])){
+      snprintf(error, size, "Expected thickStart and thickEnd in the "
+               "feature");
+      return STREAM_ERROR;
+    }
+
+  /* an empty feature goes with the base after it */
+  unsigned long first = start + 1, last = end > start ? end : first;
+  str_id_t name = str_pool_find(fields[0], lens[0]);
+  if(name == STR_ID_NONE ||
+     layout_span(job->graph, job->layout, name, first, last, &span) != 0)
+    return __unmapped(buffer, line, len);
+
+  unsigned long a = __boundary(&span, first, start);
+  unsigned long b = __boundary(&span, first, end);
+  str_id_t object = span.object->name;
+
+  stream_put(buffer, str_pool_get(object), str_pool_len(object));
+  stream_put(buffer, "\t", 1);
+  __put_ulong(buffer, span.reverse ? b : a);
+  stream_put(buffer, "\t", 1);
+  __put_ulong(buffer, span.reverse ? a : b);
+
+  for(i = 3; i < n; i++){
+    if(i == 5 && span.reverse && lens[i] == 1){
+      char strand = stream_flip(fields[i][0]);
+      stream_put(buffer, "\t", 1);
+      stream_put(buffer, &strand, 1);
+    } else if(i == 6 || i == 7){
+      a = __boundary(&span, first,
+                     thick[span.reverse && n >= 8 ? 7 - i : i - 6]);
+      stream_put(buffer, "\t", 1);
+      __put_ulong(buffer, a);
+    } else if(i == 10 && n == BED_COLUMNS){
+      if(__blocks(buffer, fields, lens, end - start, span.reverse) != 0){
+        snprintf(error, size, "Expected blockCount, blockSizes and "
+                 "blockStarts in the feature");
+        return STREAM_ERROR;
+      }
+      break;
+    } else {
+      stream_put(buffer, "\t", 1);
+      stream_put(buffer, fields[i], lens[i]);
+    }
+  }
+  stream_put(buffer, "\n", 1);
+
+  return STREAM_LINE;
+}
+
+/* directives are copied, with the new sequence regions in place of the
+   first old one */
+static int __gff_header(void * arg, const char * line, size_t len,
+                        agp_writer_t * writer){
+  lift_job_t * job = arg;
+
+  if(!line || *line != '#')
+    return STREAM_SKIP;
+
+  if(stream_starts(line, len, "##FASTA"))
+    return STREAM_END;
+
+  if(stream_starts(line, len, "##sequence-region")){
+    if(!job->written)
+      stream_objects(job->graph, writer, "##sequence-region ", " 1 %lu\n");
+    job->written = 1;
+  } else {
+    agp_writer_write(writer, line, len);
+    agp_writer_write(writer, "\n", 1);
+  }
+
+  return STREAM_LINE;
+}
+
+static int __lift_gff(void * arg, const char * line, size_t len,
+                      stream_buffer_t * buffer, char * error, size_t size){
+  lift_job_t * job = arg;
+  const char * fields[GFF_COLUMNS];
+  size_t lens[GFF_COLUMNS];
+  unsigned long start, end;
+  layout_span_t span;
+  int i;
+
+  if(stream_starts(line, len, "##FASTA") || *line == '>')
+    return STREAM_END;
+  if(*line == '#'){
+    if(!stream_starts(line, len, "##sequence-region")){
+      stream_put(buffer, line, len);
+      stream_put(buffer, "\n", 1);
+    }
+    return STREAM_SKIP;
+  }
+
+  if(__fields(line, len, fields, lens, GFF_COLUMNS) < GFF_COLUMNS){
+    snprintf(error, size, "Expected %d columns", GFF_COLUMNS);
+    return STREAM_ERROR;
+  }
+  if(__number(fields[3], lens[3], &start) != 0 ||
+     __number(fields[4], lens[4], &end) != 0 || end < start){
+    snprintf(error, size, "Expected a start and an end after it");
+    return STREAM_ERROR;
+  }
+
+  str_id_t name = str_pool_find(fields[0], lens[0]);
+  if(name == STR_ID_NONE ||
+     layout_span(job->graph, job->layout, name, start, end, &span) != 0)
+    return __unmapped(buffer, line, len);
+
+  str_id_t object = span.object->name;
+  unsigned long other = span.reverse ? span.start - (end - start) :
+    span.start + (end - start);
+
+  stream_put(buffer, str_pool_get(object), str_pool_len(object));
+  for(i = 1; i < GFF_COLUMNS; i++){
+    stream_put(buffer, "\t", 1);
+    if(i == 3)
+      __put_ulong(buffer, span.reverse ? other : span.start);
+    else if(i == 4)
+      __put_ulong(buffer, span.reverse ? span.start : other);
+    else if(i == 6 && span.reverse && lens[i] == 1){
+      char strand = stream_flip(fields[i][0]);
+      stream_put(buffer, &strand, 1);
+    } else
+      stream_put(buffer, fields[i], lens[i]);
+  }
+  stream_put(buffer, "\n", 1);
+
+  return STREAM_LINE;
+}
+
+size_t agp_graph_lift_bed(agp_graph_t * agp, layout_t * layout, FILE * in,
+                          FILE * out, int threads, int compress){
+  lift_job_t job = { agp, layout, 0 };
+  stream_t stream = { NULL, __lift_bed, &job, "BED" };
+  return stream_lift(&stream, agp, in, out, threads, compress);
+}
+
+size_t agp_graph_lift_gff(agp_graph_t * agp, layout_t * layout, FILE * in,
+                          FILE * out, int threads, int compress){
+  lift_job_t job = { agp, layout, 0 };
+  stream_t stream = { __gff_header, __lift_gff, &job, "GFF" };
+  return stream_lift(&stream, agp, in, out, threads, compress);
+}
+
+/* Chains. Blocks are 0 based, q on the query strand */
+typedef struct {
+  unsigned long size, t, q;
+} lift_block_t;
+
+typedef struct {
+  str_id_t target;
+  unsigned long target_size;
+  agp_object_t * query;
+  int reverse;
+
+  lift_block_t * blocks;
+  size_t n, m, id;
+} lift_chain_t;
+
+static void __chain_write(lift_chain_t * chain, agp_writer_t * writer){
+  lift_block_t * first = chain->blocks, * last = chain->blocks + chain->n - 1;
+  unsigned long score = 0;
+  char line[128];
+  size_t i;
+
+  if(chain->n == 0)
+    return;
+
+  for(i = 0; i < chain->n; i++)
+    score += chain->blocks[i].size;
+
+  agp_writer_write(writer, line, sprintf(line, "chain %lu ", score));
+  agp_writer_write(writer, str_pool_get(chain->target),
+                   str_pool_len(chain->target));
+  agp_writer_write(writer, line,
+                   sprintf(line, " %lu + %lu %lu ", chain->target_size,
+                           first->t, last->t + last->size));
+  agp_writer_write(writer, str_pool_get(chain->query->name),
+                   str_pool_len(chain->query->name));
+  agp_writer_write(writer, line,
+                   sprintf(line, " %lu %c %lu %lu %zu\n", chain->query->length,
+                           chain->reverse ? '-' : '+', first->q,
+                           last->q + last->size, ++chain->id));
+
+  for(i = 0; i + 1 < chain->n; i++){
+    lift_block_t * block = chain->blocks + i, * next = block + 1;
+    agp_writer_write(writer, line,
+                     sprintf(line, "%lu\t%lu\t%lu\n", block->size,
+                             next->t - block->t - block->size,
+                             next->q - block->q - block->size));
+  }
+  agp_writer_write(writer, line, sprintf(line, "%lu\n\n", last->size));
+
+  chain->n = 0;
+}
+
+/* add a block, starting a new chain if it can't go on the current one */
+static void __chain_add(lift_chain_t * chain, agp_writer_t * writer,
+                        str_id_t target, unsigned long target_size,
+                        const layout_run_t * run, unsigned long t){
+  agp_object_t * query = run->record->object;
+  lift_block_t block = { run->length, t, run->reverse ?
+                         query->length - run->pos : run->pos - 1 };
+  lift_block_t * last = chain->n ? chain->blocks + chain->n - 1 : NULL;
+
+  if(last && (chain->target != target || chain->query != query ||
+              chain->reverse != run->reverse ||
+              block.t < last->t + last->size ||
+              block.q < last->q + last->size)){
+    __chain_write(chain, writer);
+    last = NULL;
+  }
+
+  if(!last){
+    chain->target = target;
+    chain->target_size = target_size;
+    chain->query = query;
+    chain->reverse = run->reverse;
+  }
+
+  /* carrying straight on, as after a split */
+  if(last && block.t == last->t + last->size &&
+     block.q == last->q + last->size){
+    last->size += block.size;
+    return;
+  }
+
+  if(chain->n == chain->m){
+    chain->m = chain->m ? chain->m * 2 : 64;
+    chain->blocks = realloc(chain->blocks, sizeof(lift_block_t) * chain->m);
+    if(!chain->blocks){
+      fprintf(stderr, "Out of memory while writing chains\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  chain->blocks[chain->n++] = block;
+}
+
+static int __name_cmp(const void * a, const void * b){
+  return strcmp(str_pool_get(*(const str_id_t *) a),
+                str_pool_get(*(const str_id_t *) b));
+}
+
+size_t agp_graph_print_chain(agp_graph_t * agp, layout_t * layout, FILE * out,
+                             int compress){
+  str_id_t * names = malloc(sizeof(str_id_t) * (kh_size(layout) + 1));
+  lift_chain_t chain = { 0 };
+  agp_writer_t writer;
+  size_t n = 0, i, j;
+  khiter_t k;
+
+  if(!names){
+    fprintf(stderr, "Out of memory while writing chains\n");
+    exit(EXIT_FAILURE);
+  }
+
+  agp_graph_renumber(agp);
+  if(compress)
+    agp_writer_init_bgzf(&writer, out, 1);
+  else
+    agp_writer_init(&writer, out);
+
+  for (k = kh_begin(layout); k != kh_end(layout); k++)
+    if (kh_exist(layout, k))
+      names[n++] = kh_key(layout, k);
+  qsort(names, n, sizeof(str_id_t), __name_cmp);
+
+  for(i = 0; i < n; i++){
+    const layout_scaffold_t * scaffold =
+      &kh_value(layout, kh_get(layout, layout, names[i]));
+
+    for(j = 0; j < scaffold->n; j++){
+      const layout_piece_t * piece = scaffold->pieces + j;
+      unsigned long pos = piece->start;
+      layout_run_t run;
+
+      for(; pos <= piece->end; pos += run.length){
+        if(layout_run(agp, layout, names[i], pos, piece->end, &run) != 0 ||
+           !run.record)
+          break;
+        __chain_add(&chain, &writer, names[i], scaffold->length, &run,
+                    pos - 1);
+      }
+    }
+  }
+  __chain_write(&chain, &writer);
+  agp_writer_close(&writer);
+
+  free(chain.blocks);
+  free(names);
+  return chain.id;
+}
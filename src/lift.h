@@ -0,0 +1,32 @@
+#ifndef LIFT_H_
+#define LIFT_H_
+
+#include <stdio.h>
+
+#include "agp-graph.h"
+#include "layout.h"
+
+/* Liftover of annotations from the scaffolds as read (layout) to the
+   scaffolds of the graph. Both take gzip input, and write BGZF with
+   compress set. A feature is moved only if all of it stayed together
+   and in order; if it was reversed its strand is flipped. Features that
+   were split up, or start or end in a gap, are written as comments
+   ("# unmapped: " and the line). Lines are lifted on up to threads
+   threads (see stream.h). Return the number of features moved */
+
+/* BED, with thickStart/thickEnd and blocks moved along */
+size_t agp_graph_lift_bed(agp_graph_t*, layout_t*, FILE* in, FILE* out,
+                          int threads, int compress);
+
+/* GFF3. sequence-region lines are replaced by the new scaffolds, and a
+   FASTA section is dropped */
+size_t agp_graph_lift_gff(agp_graph_t*, layout_t*, FILE* in, FILE* out,
+                          int threads, int compress);
+
+/* write the UCSC chain file from the scaffolds as read (target) to the
+   scaffolds of the graph (query), with every run of bases that stayed
+   together as a block. Returns the number of chains */
+size_t agp_graph_print_chain(agp_graph_t*, layout_t*, FILE* out,
+                             int compress);
+
+#endif // LIFT_H_
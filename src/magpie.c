@@ -0,0 +1,262 @@
+#include "magpie.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "agp-graph.h"
+#include "script.h"
+#include "error.h"
+
+struct MAGPIE_S {
+  agp_graph_t * graph;
+  char error[1024];
+};
+
+/* handles holding a graph. Names of all graphs are in the one string
+   pool, which is released as soon as no handle holds a graph */
+static int magpie_graphs = 0;
+
+static magpie_status_t __status(magpie_t * m, magpie_status_t status,
+                                const char * message){
+  snprintf(m->error, sizeof(m->error), "%s", message);
+  return status;
+}
+
+static void __drop(magpie_t * m){
+  if(!m->graph)
+    return;
+
+  agp_graph_destroy(m->graph);
+  m->graph = NULL;
+  if(--magpie_graphs == 0)
+    str_pool_destroy();
+}
+
+/* run step with errors trapped. Returns -1 with the message in the
+   handle if it failed */
+typedef void (*magpie_step_t)(magpie_t*, void*);
+
+static int __trap(magpie_t * m, magpie_step_t step, void * arg){
+  error_trap_t trap, * previous = error_set_trap(&trap);
+
+  if(setjmp(trap.jump)){
+    error_set_trap(previous);
+    __status(m, MAGPIE_ERROR_FAILED, trap.message);
+    return -1;
+  }
+
+  step(m, arg);
+  error_set_trap(previous);
+  return 0;
+}
+
+magpie_t * magpie_open(void){
+  return calloc(1, sizeof(magpie_t));
+}
+
+void magpie_close(magpie_t * m){
+  if(!m)
+    return;
+  __drop(m);
+  free(m);
+}
+
+void magpie_unload(magpie_t * m){
+  __drop(m);
+  __status(m, MAGPIE_OK, "");
+}
+
+const char * magpie_error(const magpie_t * m){
+  return m->error;
+}
+
+typedef struct {
+  const char * data;
+  size_t len;
+} magpie_load_t;
+
+static void __load(magpie_t * m, void * arg){
+  magpie_load_t * load = arg;
+  agp_graph_read_buffer(m->graph, load->data, load->len);
+}
+
+magpie_status_t magpie_load(magpie_t * m, const char * data, size_t len){
+  magpie_load_t load = { data, len };
+
+  __drop(m);
+  m->graph = agp_graph_init();
+  magpie_graphs++;
+  if(__trap(m, __load, &load) != 0){
+    __drop(m);
+    return MAGPIE_ERROR_PARSE;
+  }
+  return __status(m, MAGPIE_OK, "");
+}
+
+static void __run_op(magpie_t * m, void * arg){
+  script_op_run(arg, m->graph);
+}
+
+magpie_status_t magpie_run(magpie_t * m, const char * text, size_t * done){
+  char error[sizeof(m->error) - 64];
+  script_t * script;
+  size_t i;
+
+  if(done)
+    *done = 0;
+  if(!m->graph)
+    return __status(m, MAGPIE_ERROR_NO_GRAPH, "No graph loaded");
+
+  script = script_compile_string(text, error, sizeof(error));
+  if(!script)
+    return __status(m, MAGPIE_ERROR_SCRIPT, error);
+
+  for(i = 0; i < script->n; i++){
+    const script_op_t * op = script->ops + i;
+    str_id_t names[3];
+
+    if(script_op_check(op, m->graph, names, error, sizeof(error)) < 0){
+      snprintf(m->error, sizeof(m->error), "line %zu, column %zu: %s",
+               op->line, op->column, error);
+      script_destroy(script);
+      return MAGPIE_ERROR_SCRIPT;
+    }
+
+    /* the check should have caught anything that stops an operation,
+       but if one fails half way there is no telling what it left */
+    if(__trap(m, __run_op, (void*) op) != 0){
+      script_destroy(script);
+      __drop(m);
+      return MAGPIE_ERROR_FAILED;
+    }
+
+    if(done)
+      (*done)++;
+  }
+
+  script_destroy(script);
+  return __status(m, MAGPIE_OK, "");
+}
+
+static void __simplify(magpie_t * m, void * arg){
+  *(int*) arg = agp_graph_simplify(m->graph);
+}
+
+magpie_status_t magpie_simplify(magpie_t * m, size_t * combined){
+  int n = 0;
+
+  if(!m->graph)
+    return __status(m, MAGPIE_ERROR_NO_GRAPH, "No graph loaded");
+  if(__trap(m, __simplify, &n) != 0){
+    __drop(m);
+    return MAGPIE_ERROR_FAILED;
+  }
+
+  if(combined)
+    *combined = n;
+  return __status(m, MAGPIE_OK, "");
+}
+
+static void __print(magpie_t * m, void * arg){
+  agp_graph_print(m->graph, arg);
+}
+
+magpie_status_t magpie_write(magpie_t * m, char ** data, size_t * len){
+  FILE * file;
+
+  *data = NULL;
+  *len = 0;
+  if(!m->graph)
+    return __status(m, MAGPIE_ERROR_NO_GRAPH, "No graph loaded");
+
+  file = open_memstream(data, len);
+  if(!file)
+    return __status(m, MAGPIE_ERROR_IO, "Out of memory while writing");
+
+  /* printing only fails on the stream, and leaves the graph whole */
+  int failed = __trap(m, __print, file);
+  if(fclose(file) != 0 && !failed){
+    __status(m, MAGPIE_ERROR_IO, "Failed to write the agp");
+    failed = -1;
+  }
+
+  if(failed){
+    free(*data);
+    *data = NULL;
+    *len = 0;
+    return MAGPIE_ERROR_IO;
+  }
+
+  return __status(m, MAGPIE_OK, "");
+}
+
+magpie_status_t magpie_foreach_scaffold(magpie_t * m, magpie_scaffold_fn fn,
+                                        void * arg){
+  agp_object_t ** objects;
+  size_t i, size;
+
+  if(!m->graph)
+    return __status(m, MAGPIE_ERROR_NO_GRAPH, "No graph loaded");
+
+  size = kh_size(m->graph->objects);
+  objects = agp_graph_sorted_objects(m->graph);
+  for(i = 0; i < size; i++){
+    magpie_scaffold_t scaffold = { str_pool_get(objects[i]->name),
+                                   objects[i]->length, objects[i]->count };
+    if(fn(&scaffold, arg) != 0)
+      break;
+  }
+
+  free(objects);
+  return __status(m, MAGPIE_OK, "");
+}
+
+magpie_status_t magpie_foreach_component(magpie_t * m, const char * name,
+                                         magpie_component_fn fn, void * arg){
+  agp_object_t * object = NULL;
+  agp_scaffold_t * cur;
+  str_id_t id;
+  unsigned long position = 0;
+  unsigned int part = 0;
+
+  if(!m->graph)
+    return __status(m, MAGPIE_ERROR_NO_GRAPH, "No graph loaded");
+
+  id = str_pool_find(name, strlen(name));
+  if(id != STR_ID_NONE)
+    object = agp_graph_object(m->graph, id);
+  if(!object){
+    snprintf(m->error, sizeof(m->error), "No scaffold %s", name);
+    return MAGPIE_ERROR_NOT_FOUND;
+  }
+
+  /* positions and part numbers are worked out here rather than by
+     renumbering, which would go through the whole graph */
+  agp_graph_flatten_object(m->graph, object);
+  for(cur = object->head; cur != NULL; cur = cur->next){
+    magpie_component_t component = { .scaffold = str_pool_get(id),
+                                     .part = ++part, .type = cur->type };
+
+    component.start = position + 1;
+    position += agp_record_length(cur);
+    component.end = position;
+
+    if(agp_is_gap(cur)){
+      component.gap_length = cur->component.gap.length;
+      component.gap_type   = str_pool_get(cur->component.gap.type);
+      component.linkage    = cur->component.gap.linkage;
+      component.evidence   = str_pool_get(cur->component.gap.evidence);
+    } else {
+      component.id          = str_pool_get(cur->component.seq.name);
+      component.id_start    = cur->component.seq.start;
+      component.id_end      = cur->component.seq.end;
+      component.orientation = cur->component.seq.orientation;
+    }
+
+    if(fn(&component, arg) != 0)
+      break;
+  }
+
+  return __status(m, MAGPIE_OK, "");
+}
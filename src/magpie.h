@@ -0,0 +1,114 @@
+#ifndef MAGPIE_H_
+#define MAGPIE_H_
+
+#include <stddef.h>
+
+/* libmagpie: the agp graph and the script runner of magpie, for
+   programs that edit assemblies without going through files or a
+   separate process. Build it with make libmagpie.a or libmagpie.so.
+
+   A handle holds one graph. Nothing exits or prints: every call
+   returns a status, and the message of the last error is kept by the
+   handle (magpie_error). Names are interned in one pool for the whole
+   process, so the library must only be called from one thread at a
+   time, even for different handles; which thread doesn't matter. The
+   pool is released as soon as no handle holds a graph, so a host that
+   loads one assembly after another doesn't keep the names of the old
+   ones.
+
+   Only the magpie_ functions are exported by libmagpie.so. */
+#define MAGPIE_API_VERSION 2
+
+#if defined(__GNUC__)
+#define MAGPIE_EXPORT __attribute__((visibility("default")))
+#else
+#define MAGPIE_EXPORT
+#endif
+
+typedef enum {
+  MAGPIE_OK = 0,
+  MAGPIE_ERROR_PARSE,      /* the agp couldn't be read */
+  MAGPIE_ERROR_SCRIPT,     /* the script doesn't compile, or one of its
+                              operations can't run on the graph */
+  MAGPIE_ERROR_NOT_FOUND,  /* no such scaffold */
+  MAGPIE_ERROR_NO_GRAPH,   /* nothing loaded, or the graph was dropped */
+  MAGPIE_ERROR_IO,         /* the output couldn't be written */
+  MAGPIE_ERROR_FAILED      /* an edit failed half way; the graph is
+                              dropped */
+} magpie_status_t;
+
+typedef struct MAGPIE_S magpie_t;
+
+/* new handle, or NULL if out of memory */
+MAGPIE_EXPORT magpie_t * magpie_open(void);
+MAGPIE_EXPORT void magpie_close(magpie_t*);
+
+/* drop the graph of a handle, keeping the handle */
+MAGPIE_EXPORT void magpie_unload(magpie_t*);
+
+/* message of the last error, "" if the last call went through */
+MAGPIE_EXPORT const char * magpie_error(const magpie_t*);
+
+/* read an agp file held in memory (uncompressed), replacing the graph
+   of the handle. The buffer needn't be NUL terminated and can be freed
+   as soon as this returns */
+MAGPIE_EXPORT magpie_status_t magpie_load(magpie_t*, const char* data,
+                                         size_t len);
+
+/* compile a script and run it on the graph. Every operation is checked
+   before it runs, so on MAGPIE_ERROR_SCRIPT the operations before the
+   bad one stay applied and the graph can still be used. done, if not
+   NULL, is set to the number of operations applied */
+MAGPIE_EXPORT magpie_status_t magpie_run(magpie_t*, const char* script,
+                                        size_t* done);
+
+/* combine contiguous components (magpie -s). combined, if not NULL, is
+   set to the number of components combined */
+MAGPIE_EXPORT magpie_status_t magpie_simplify(magpie_t*, size_t* combined);
+
+/* write the graph as an agp file into a new buffer, NUL terminated,
+   that the caller frees */
+MAGPIE_EXPORT magpie_status_t magpie_write(magpie_t*, char** data,
+                                          size_t* len);
+
+typedef struct {
+  const char * name;
+  unsigned long length;      /* bases, gaps included */
+  size_t components;         /* records, gaps included */
+} magpie_scaffold_t;
+
+/* a record of a scaffold. Positions are 1-based and inclusive, as in
+   agp files. Strings are only good during the callback */
+typedef struct {
+  const char * scaffold;
+  unsigned long start, end;
+  unsigned int part;
+  char type;                 /* W for sequences, N or U for gaps */
+
+  /* sequences */
+  const char * id;
+  unsigned long id_start, id_end;
+  char orientation;
+
+  /* gaps */
+  unsigned long gap_length;
+  const char * gap_type, * linkage, * evidence;
+} magpie_component_t;
+
+/* Callbacks return 0 to go on, anything else to stop. They must not
+   call back into the handle */
+typedef int (*magpie_scaffold_fn)(const magpie_scaffold_t*, void* arg);
+typedef int (*magpie_component_fn)(const magpie_component_t*, void* arg);
+
+/* scaffolds in the order they are written */
+MAGPIE_EXPORT magpie_status_t magpie_foreach_scaffold(magpie_t*,
+                                                     magpie_scaffold_fn,
+                                                     void* arg);
+
+/* records of one scaffold, in order */
+MAGPIE_EXPORT magpie_status_t magpie_foreach_component(magpie_t*,
+                                                      const char* scaffold,
+                                                      magpie_component_fn,
+                                                      void* arg);
+
+#endif // MAGPIE_H_
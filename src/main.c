@@ -5,14 +5,153 @@
 
 #include "args.h"
 #include "agp-graph.h"
+#include "agp-snapshot.h"
 #include "script.h"
+#include "session.h"
+#include "stats.h"
+#include "fasta.h"
+#include "pairs.h"
+#include "lift.h"
+#include "diff.h"
+#include "parallel.h"
+
+/* outputs named *.gz are written as BGZF */
+static int __gzip_name(const char * path){
+  size_t len = strlen(path);
+  return len > 3 && strcmp(path + len - 3, ".gz") == 0;
+}
+
+/* optional files, opened before anything is done. NULL if path is */
+static FILE * __open(const char * path, const char * mode,
+                     const char * what){
+  FILE * file = path ? fopen(path, mode) : NULL;
+  if(path && !file){
+    fprintf(stderr, "Failed to open %s file '%s': %s\n", what, path,
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return file;
+}
+
+/* close an output opened by __open */
+static void __close(FILE * file, const char * path, const char * what){
+  if(file && fclose(file) != 0){
+    fprintf(stderr, "Failed to write %s file '%s': %s\n", what, path,
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* --fork: every script runs on its own fork of the graph as read, up
+   to threads of them at once, and is written to its own output */
+typedef struct {
+  const arguments_t * args;
+  agp_graph_t ** forks;
+  script_t ** scripts;
+  FILE ** outs;
+  int * simplified;
+} fork_job_t;
+
+static void __fork_task(void * data, size_t i){
+  fork_job_t * job = data;
+  agp_graph_t * fork = job->forks[i];
+
+  script_run(job->scripts[i], fork);
+  if(job->args->simplify)
+    job->simplified[i] = agp_graph_simplify(fork);
+
+  if(__gzip_name(job->args->fork_outs[i]))
+    agp_graph_print_bgzf(fork, job->outs[i], 1);
+  else
+    agp_graph_print(fork, job->outs[i]);
+
+  agp_graph_destroy(fork);
+  script_destroy(job->scripts[i]);
+}
+
+/* scripts and outputs are opened by the caller, before the graph is
+   read. With --check, the scripts are only checked */
+static void __run_forks(const arguments_t * args, agp_graph_t * graph,
+                        FILE ** scripts, FILE ** outs){
+  int n = args->forks, i;
+  fork_job_t job = { args, malloc(sizeof(agp_graph_t*) * n),
+                     malloc(sizeof(script_t*) * n), outs,
+                     calloc(n, sizeof(int)) };
+
+  if(!job.forks || !job.scripts || !job.simplified){
+    fprintf(stderr, "Out of memory while forking the graph\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < n; i++){
+    job.scripts[i] = script_compile(scripts[i]);
+    fclose(scripts[i]);
+  }
+
+  if(args->check){
+    for(i = 0; i < n; i++){
+      script_check(job.scripts[i], graph);
+      fprintf(stderr, "Script %s OK: %zu operations\n",
+              args->fork_scripts[i], job.scripts[i]->n);
+      script_destroy(job.scripts[i]);
+    }
+  } else {
+    for(i = 0; i < n; i++)
+      job.forks[i] = agp_graph_fork(graph);
+    parallel_for(args->threads, n, __fork_task, &job);
+
+    for(i = 0; i < n; i++){
+      __close(outs[i], args->fork_outs[i], "output");
+      if(args->simplify)
+        fprintf(stderr, "Simplified %d components in %s\n",
+                job.simplified[i], args->fork_outs[i]);
+    }
+  }
+
+  free(job.forks);
+  free(job.scripts);
+  free(job.simplified);
+}
+
+/* magpie diff: script from one agp file to another */
+static int __diff(const arguments_t * args){
+  FILE* from_file = __open(args->agp, "r", "AGP");
+  FILE* to_file   = __open(args->diff, "r", "AGP");
+  FILE* out       = __open(args->out, "w", "output");
+  size_t joined;
+
+  agp_graph_t * from = agp_graph_read_threads(from_file, args->threads);
+  fclose(from_file);
+  agp_graph_t * to = agp_graph_read_threads(to_file, args->threads);
+  fclose(to_file);
+
+  size_t ops = agp_graph_diff(from, to, out, &joined);
+  __close(out, args->out, "output");
+
+  fprintf(stderr, "Diff: %zu operations\n", ops);
+  if(joined)
+    fprintf(stderr, "%zu components of %s are joined from several of %s: "
+            "run the script with --simplify\n", joined, args->diff,
+            args->agp);
+
+  agp_graph_destroy(from);
+  agp_graph_destroy(to);
+  str_pool_destroy();
+  return EXIT_SUCCESS;
+}
 
 int main(int argc, char *argv[]) {
     arguments_t args = parse_options(argc, argv);
+    if(args.diff)
+      return __diff(&args);
+
+    stats_t stats;
+    stats_start(&stats);
 
     FILE* script = fopen(args.script, "r");
-    FILE* agp = fopen(args.agp, "r");
-    FILE* out = fopen(args.out, "w");
+    const char* input = args.load_snapshot ? args.load_snapshot : args.agp;
+    FILE* agp = fopen(input, "r");
+    FILE* out = args.check ? NULL : fopen(args.out, "w");
 
     /* Did script file open */
     if(!script){
@@ -21,31 +160,198 @@ int main(int argc, char *argv[]) {
       exit(EXIT_FAILURE);
     }
 
-    /* Did agp file open */
+    /* Did agp file (or snapshot) open */
     if(!agp){
-      fprintf(stderr, "Failed to open AGP file '%s': %s\n",
-              args.agp, strerror(errno));
+      fprintf(stderr, "Failed to open %s file '%s': %s\n",
+              args.load_snapshot ? "snapshot" : "AGP", input,
+              strerror(errno));
       exit(EXIT_FAILURE);
     }
 
     /* Did out file open */
-    if(!out){
+    if(!args.check && !out){
       fprintf(stderr, "Failed to open output file '%s': %s\n",
               args.out, strerror(errno));
       exit(EXIT_FAILURE);
     }
 
-    agp_graph_t * graph = agp_graph_read(agp);
+    FILE* fasta_out = NULL;
+    if(args.fasta_out && !args.check &&
+       !(fasta_out = fopen(args.fasta_out, "w"))){
+      fprintf(stderr, "Failed to open FASTA output file '%s': %s\n",
+              args.fasta_out, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    /* outputs following the agp, and their inputs */
+    if(args.check)
+      args.pairs_in = args.chain_out = args.bed_in = args.gff_in = NULL;
+    FILE* pairs_in  = __open(args.pairs_in, "r", "pairs");
+    FILE* pairs_out = __open(args.pairs_in ? args.pairs_out : NULL, "w",
+                             "pairs output");
+    FILE* chain_out = __open(args.chain_out, "w", "chain output");
+    FILE* bed_in    = __open(args.bed_in, "r", "BED");
+    FILE* bed_out   = __open(args.bed_in ? args.bed_out : NULL, "w",
+                             "BED output");
+    FILE* gff_in    = __open(args.gff_in, "r", "GFF");
+    FILE* gff_out   = __open(args.gff_in ? args.gff_out : NULL, "w",
+                             "GFF output");
+
+    FILE** fork_scripts = malloc(sizeof(FILE*) * (args.forks + 1));
+    FILE** fork_outs    = malloc(sizeof(FILE*) * (args.forks + 1));
+    int i;
+    for(i = 0; i < args.forks; i++){
+      fork_scripts[i] = __open(args.fork_scripts[i], "r", "script");
+      fork_outs[i] = __open(args.check ? NULL : args.fork_outs[i], "w",
+                            "output");
+    }
+
+    FILE* trace = NULL;
+    if(args.trace && !(trace = fopen(args.trace, "w"))){
+      fprintf(stderr, "Failed to open trace file '%s': %s\n",
+              args.trace, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    agp_graph_t * graph = args.load_snapshot ?
+      agp_graph_load_snapshot(agp) :
+      agp_graph_read_threads(agp, args.threads);
+    fclose(agp);
+
+    if(args.save_snapshot){
+      FILE* snapshot = fopen(args.save_snapshot, "w");
+      if(!snapshot){
+        fprintf(stderr, "Failed to open snapshot file '%s': %s\n",
+                args.save_snapshot, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+      agp_graph_save_snapshot(graph, snapshot);
+      fclose(snapshot);
+    }
+
+    if(args.tree)
+      agp_graph_set_engine(graph, AGP_ENGINE_TREE);
+    if(args.natural)
+      agp_graph_set_order(graph, AGP_ORDER_NATURAL);
+
+    /* the contig names are known once the graph is read */
+    fasta_t * fasta = fasta_out ? fasta_open(args.fasta_in) : NULL;
+
+    /* lifting from the old scaffolds needs them as they were read */
+    layout_t * layout = (pairs_in && !args.pairs_contigs) || chain_out ||
+      bed_in || gff_in ? layout_build(graph) : NULL;
+    stats_lap(&stats, STATS_READ);
+
+    script_t * compiled = script_compile(script);
+    stats_lap(&stats, STATS_COMPILE);
+
+    /* the forks share the graph as read, so they run first */
+    if(args.forks){
+      __run_forks(&args, graph, fork_scripts, fork_outs);
+      stats_lap(&stats, STATS_SCRIPT);
+    }
+    free(fork_scripts);
+    free(fork_outs);
+    free(args.fork_scripts);
+    free(args.fork_outs);
+
+    if(args.check){
+      script_check(compiled, graph);
+      fprintf(stderr, "Script OK: %zu operations\n", compiled->n);
+      stats_lap(&stats, STATS_SCRIPT);
+      if(args.stats)
+        stats_print(&stats, graph, stderr);
+
+      script_destroy(compiled);
+      agp_graph_destroy(graph);
+      str_pool_destroy();
+      return EXIT_SUCCESS;
+    }
+
+    if(args.interactive)
+      session_run(graph, compiled, stdin);
+    else if(trace)
+      script_run_trace(compiled, graph, trace);
+    else
+      script_run_threads(compiled, graph, args.threads);
+    script_destroy(compiled);
+    stats_lap(&stats, STATS_SCRIPT);
+
+    if(trace && fclose(trace) != 0){
+      fprintf(stderr, "Failed to write trace file '%s': %s\n",
+              args.trace, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
 
-    run_script(script, graph);
     if(args.simplify){
       fprintf(stderr, "Simplified %d components\n",
-              agp_graph_simplify(graph));
+              agp_graph_simplify_threads(graph, args.threads));
     };
-    agp_graph_print(graph, out);
+    stats_lap(&stats, STATS_SIMPLIFY);
+
+    if(__gzip_name(args.out))
+      agp_graph_print_bgzf(graph, out, args.threads);
+    else
+      agp_graph_print_threads(graph, out, args.threads);
+    fflush(out);
+
+    if(fasta){
+      agp_graph_print_fasta(graph, fasta, fasta_out, args.threads,
+                            __gzip_name(args.fasta_out));
+      fasta_close(fasta);
+
+      if(fclose(fasta_out) != 0){
+        fprintf(stderr, "Failed to write FASTA output file '%s': %s\n",
+                args.fasta_out, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if(pairs_in){
+      size_t pairs = agp_graph_lift_pairs(graph, args.pairs_contigs ? NULL :
+                                          layout, pairs_in, pairs_out,
+                                          args.threads,
+                                          __gzip_name(args.pairs_out));
+      fprintf(stderr, "Lifted %zu pairs\n", pairs);
+      fclose(pairs_in);
+      __close(pairs_out, args.pairs_out, "pairs output");
+    }
+
+    if(chain_out){
+      agp_graph_print_chain(graph, layout, chain_out,
+                            __gzip_name(args.chain_out));
+      __close(chain_out, args.chain_out, "chain output");
+    }
+
+    if(bed_in){
+      size_t features = agp_graph_lift_bed(graph, layout, bed_in, bed_out,
+                                           args.threads,
+                                           __gzip_name(args.bed_out));
+      fprintf(stderr, "Lifted %zu BED features\n", features);
+      fclose(bed_in);
+      __close(bed_out, args.bed_out, "BED output");
+    }
+
+    if(gff_in){
+      size_t features = agp_graph_lift_gff(graph, layout, gff_in, gff_out,
+                                           args.threads,
+                                           __gzip_name(args.gff_out));
+      fprintf(stderr, "Lifted %zu GFF features\n", features);
+      fclose(gff_in);
+      __close(gff_out, args.gff_out, "GFF output");
+    }
+
+    if(layout)
+      layout_destroy(layout);
+    stats_lap(&stats, STATS_PRINT);
+
+    if(args.stats)
+      stats_print(&stats, graph, stderr);
 
     agp_graph_destroy(graph);
     graph = NULL;
 
+    str_pool_destroy();
+
 
 }
@@ -0,0 +1,166 @@
+#include "pairs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream.h"
+
+/* columns before the ones passed through as they are */
+#define PAIRS_COLUMNS 7
+
+typedef struct {
+  agp_graph_t * graph;
+  layout_t * layout;
+
+  /* header lines seen, and new chromsizes written */
+  int seen, written;
+} pairs_job_t;
+
+/* One side of a pair */
+typedef struct {
+  const char * chrom;
+  size_t len;
+  unsigned long pos;
+  char strand;
+} pairs_side_t;
+
+/* move a side to the new scaffolds. Returns -1 if it has no place
+   there */
+static int __lift(agp_graph_t * agp, layout_t * layout, pairs_side_t * side){
+  str_id_t name = str_pool_find(side->chrom, side->len);
+  layout_run_t run;
+
+  if(name == STR_ID_NONE ||
+     layout_run(agp, layout, name, side->pos, side->pos, &run) != 0 ||
+     !run.record)
+    return -1;
+
+  str_id_t object = run.record->object->name;
+  side->chrom = str_pool_get(object);
+  side->len   = str_pool_len(object);
+  side->pos   = run.pos;
+  if(run.reverse)
+    side->strand = stream_flip(side->strand);
+
+  return 0;
+}
+
+static char * __put_side(char * out, const pairs_side_t * side){
+  return out + sprintf(out, "%.*s\t%lu\t", (int) side->len, side->chrom,
+                       side->pos);
+}
+
+static int __lift_line(void * arg, const char * line, size_t len,
+                       stream_buffer_t * buffer, char * error, size_t size){
+  pairs_job_t * job = arg;
+  const char * fields[PAIRS_COLUMNS], * cur = line, * end = line + len;
+  const char * rest = NULL;
+  size_t lens[PAIRS_COLUMNS];
+  pairs_side_t sides[2];
+  int i;
+
+  if(*line == '#')
+    return STREAM_SKIP;
+
+  for(i = 0; i < PAIRS_COLUMNS; i++){
+    const char * tab = memchr(cur, '\t', end - cur);
+    if(!tab && i < PAIRS_COLUMNS - 1){
+      snprintf(error, size, "Expected at least %d columns", PAIRS_COLUMNS);
+      return STREAM_ERROR;
+    }
+
+    fields[i] = cur;
+    lens[i]   = (tab ? tab : end) - cur;
+    cur = tab ? tab + 1 : end;
+    if(i == PAIRS_COLUMNS - 1)
+      rest = tab;
+  }
+
+  for(i = 0; i < 2; i++){
+    const char * pos = fields[2 + 2 * i];
+    size_t j, n = lens[2 + 2 * i];
+
+    sides[i].chrom  = fields[1 + 2 * i];
+    sides[i].len    = lens[1 + 2 * i];
+    sides[i].strand = lens[5 + i] == 1 ? fields[5 + i][0] : 0;
+    sides[i].pos    = 0;
+
+    if(n == 0 || sides[i].strand == 0){
+      snprintf(error, size, "Expected a position and a strand for side %d",
+               i + 1);
+      return STREAM_ERROR;
+    }
+    for(j = 0; j < n; j++){
+      if(pos[j] < '0' || pos[j] > '9'){
+        snprintf(error, size, "Position %d isn't a number", i + 1);
+        return STREAM_ERROR;
+      }
+      sides[i].pos = sides[i].pos * 10 + (pos[j] - '0');
+    }
+
+    if(__lift(job->graph, job->layout, sides + i) != 0){
+      sides[i].chrom  = "!";
+      sides[i].len    = 1;
+      sides[i].pos    = 0;
+      sides[i].strand = '-';
+    }
+  }
+
+  size_t extra = rest ? (size_t) (end - rest) : 0;
+  char * out = stream_reserve(buffer, lens[0] + sides[0].len + sides[1].len +
+                              extra + 64);
+  char * start = out;
+
+  memcpy(out, fields[0], lens[0]);
+  out += lens[0];
+  *out++ = '\t';
+  out = __put_side(out, sides);
+  out = __put_side(out, sides + 1);
+  *out++ = sides[0].strand;
+  *out++ = '\t';
+  *out++ = sides[1].strand;
+  if(rest){
+    memcpy(out, rest, extra);
+    out += extra;
+  }
+  *out++ = '\n';
+
+  buffer->used += out - start;
+  return STREAM_LINE;
+}
+
+/* the header is copied with the new chromsizes just before the
+   columns line (or the first pair) */
+static int __header(void * arg, const char * line, size_t len,
+                    agp_writer_t * writer){
+  pairs_job_t * job = arg;
+
+  if(!line || *line != '#'){
+    if(job->seen && !job->written)
+      stream_objects(job->graph, writer, "#chromsize: ", " %lu\n");
+    job->written = 1;
+    return STREAM_SKIP;
+  }
+
+  job->seen = 1;
+  if(!job->written && stream_starts(line, len, "#columns")){
+    stream_objects(job->graph, writer, "#chromsize: ", " %lu\n");
+    job->written = 1;
+  }
+  if(!stream_starts(line, len, "#chromsize") &&
+     !stream_starts(line, len, "#sorted") &&
+     !stream_starts(line, len, "#shape")){
+    agp_writer_write(writer, line, len);
+    agp_writer_write(writer, "\n", 1);
+  }
+
+  return STREAM_LINE;
+}
+
+size_t agp_graph_lift_pairs(agp_graph_t * agp, layout_t * layout,
+                            FILE * in, FILE * out, int threads,
+                            int compress){
+  pairs_job_t job = { agp, layout, 0, 0 };
+  stream_t stream = { __header, __lift_line, &job, "Pairs" };
+  return stream_lift(&stream, agp, in, out, threads, compress);
+}
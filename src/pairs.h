@@ -0,0 +1,22 @@
+#ifndef PAIRS_H_
+#define PAIRS_H_
+
+#include <stdio.h>
+
+#include "agp-graph.h"
+#include "layout.h"
+
+/* read Hi-C pairs (4DN .pairs format, gzip or not) from in and write
+   them to out with both sides moved to the scaffolds of the graph,
+   through layout if the positions are on the scaffolds as read (see
+   layout.h), or straight from the contigs if layout is NULL. Positions
+   in gaps, or on unknown sequences, become unmapped ("!", 0, "-").
+   The header's chromsize lines are replaced by the new scaffolds, and
+   since pairs may leave their order, any sorted and shape lines are
+   dropped. Lines are lifted on up to threads threads (see stream.h).
+   With compress set the output is BGZF. Returns the number of pairs */
+size_t agp_graph_lift_pairs(agp_graph_t*, layout_t* layout,
+                            FILE* in, FILE* out, int threads,
+                            int compress);
+
+#endif // PAIRS_H_
@@ -0,0 +1,63 @@
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct {
+  void (*fn)(void*, size_t);
+  void * arg;
+  size_t n, next;
+  pthread_mutex_t lock;
+} parallel_job_t;
+
+static void * __worker(void * data){
+  parallel_job_t * job = data;
+
+  while(1){
+    pthread_mutex_lock(&job->lock);
+    size_t i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+
+    if(i >= job->n)
+      break;
+    job->fn(job->arg, i);
+  }
+
+  return NULL;
+}
+
+void parallel_for(int threads, size_t n,
+                  void (*fn)(void* arg, size_t i), void* arg){
+  size_t i;
+
+  if(threads <= 1 || n <= 1){
+    for(i = 0; i < n; i++)
+      fn(arg, i);
+    return;
+  }
+
+  if((size_t) threads > n)
+    threads = (int) n;
+
+  parallel_job_t job = { fn, arg, n, 0 };
+  pthread_mutex_init(&job.lock, NULL);
+
+  pthread_t * workers = malloc(sizeof(pthread_t) * threads);
+  int t, ret;
+  for(t = 1; t < threads; t++){
+    if((ret = pthread_create(workers + t, NULL, __worker, &job)) != 0){
+      fprintf(stderr, "Failed to start thread: %s\n", strerror(ret));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  __worker(&job);
+
+  for(t = 1; t < threads; t++)
+    pthread_join(workers[t], NULL);
+
+  pthread_mutex_destroy(&job.lock);
+  free(workers);
+}
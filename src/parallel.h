@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+
+/* call fn(arg, i) for every i in [0, n), spread over up to threads
+   threads (the calling thread included). Items are handed out in
+   increasing order, and the call returns once all of them are done. */
+void parallel_for(int threads, size_t n,
+                  void (*fn)(void* arg, size_t i), void* arg);
+
+#endif // PARALLEL_H_
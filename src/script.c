@@ -1,182 +1,737 @@
 #include "script.h"
 
-#include "klib/kdq.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "klib/khash.h"
+#include "parallel.h"
+#include "error.h"
+
+#define fail(line, column, ...) do {                                    \
+    char __message[1024];                                               \
+    snprintf(__message, sizeof(__message), __VA_ARGS__);                \
+    error_fail("Script error: line %zu, column %zu: %s\n",              \
+               (size_t) (line), (size_t) (column), __message); } while (0)
+
+/* Tokenizer. The script is read a line at a time; words are separated
+   by any number of blanks, newlines and semi-colons, and '#' starts a
+   comment that runs to the end of the line. */
+typedef struct {
+  char * s;
+  size_t len, cap;
+  size_t line, column;
+} token_t;
+
+typedef struct {
+  FILE * file;
+  char * buffer;
+  size_t capacity, line;
+  const char *cur, *end;
+
+  /* current token, and the one after it when peeked */
+  token_t tokens[2];
+  int peeked;
+
+  /* if set, errors are written to error and jump back here instead of
+     exiting (see script_compile_string) */
+  jmp_buf * recover;
+  char * error;
+  size_t error_size;
+} lexer_t;
+
+#define lex_fail(lex, line, column, ...) do {                           \
+    if((lex)->recover){                                                 \
+      int __n = snprintf((lex)->error, (lex)->error_size,               \
+                         "line %zu, column %zu: ", (size_t) (line),     \
+                         (size_t) (column));                            \
+      if(__n >= 0 && (size_t) __n < (lex)->error_size)                  \
+        snprintf((lex)->error + __n, (lex)->error_size - __n,           \
+                 __VA_ARGS__);                                          \
+      longjmp(*(lex)->recover, 1);                                      \
+    }                                                                   \
+    fail(line, column, __VA_ARGS__); } while (0)
+
+#define __is_sep(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' ||       \
+                     (c) == '\n' || (c) == ';')
+
+static int __lex(lexer_t * lex, token_t * token){
+  while(1){
+    while(lex->cur < lex->end && __is_sep(*lex->cur)) lex->cur++;
+
+    if(lex->cur < lex->end && *lex->cur != '#')
+      break;
+
+    ssize_t len = getline(&lex->buffer, &lex->capacity, lex->file);
+    if(len <= 0)
+      return 0;
+
+    lex->line++;
+    lex->cur = lex->buffer;
+    lex->end = lex->buffer + len;
+  }
+
+  const char * start = lex->cur;
+  while(lex->cur < lex->end && !__is_sep(*lex->cur) && *lex->cur != '#')
+    lex->cur++;
+
+  token->len    = lex->cur - start;
+  token->line   = lex->line;
+  token->column = start - lex->buffer + 1;
+
+  if(token->len + 1 > token->cap){
+    char * s = realloc(token->s, token->len + 1);
+    if(!s){
+      error_fail("Out of memory while reading script\n");
+    }
+    token->s = s;
+    token->cap = token->len + 1;
+  }
+  memcpy(token->s, start, token->len);
+  token->s[token->len] = '\0';
+
+  return 1;
+}
+
+/* next token, or NULL at the end of the script */
+static token_t * __next(lexer_t * lex){
+  if(lex->peeked){
+    token_t tmp = lex->tokens[0];
+    lex->tokens[0] = lex->tokens[1];
+    lex->tokens[1] = tmp;
+    lex->peeked = 0;
+    return lex->tokens;
+  }
+
+  return __lex(lex, lex->tokens) ? lex->tokens : NULL;
+}
+
+static token_t * __peek(lexer_t * lex){
+  if(!lex->peeked)
+    lex->peeked = __lex(lex, lex->tokens + 1);
+  return lex->peeked ? lex->tokens + 1 : NULL;
+}
+
+static token_t * __expect(lexer_t * lex){
+  token_t * token = __next(lex);
+  if(!token) lex_fail(lex, lex->line, 1, "Unexpected end to script");
+  return token;
+}
 
-#define fail(...) do { fprintf(stderr, __VA_ARGS__); \
-    exit(EXIT_FAILURE); } while (0);
+static void __expect_word(lexer_t * lex, const char * word,
+                          const char * error){
+  token_t * token = __expect(lex);
+  if(strcmp(token->s, word) != 0)
+    lex_fail(lex, token->line, token->column, "%s", error);
+}
+
+/* format a reference the way it is written */
+static const char * __ref_str(const agp_component_ref_t * ref, char * buf,
+                              size_t size){
+  if(ref->at)
+    snprintf(buf, size, "%s@%lu", str_pool_get(ref->key.name),
+             ref->key.start);
+  else
+    snprintf(buf, size, "%s:%lu-%lu", str_pool_get(ref->key.name),
+             ref->key.start, ref->key.end);
+  return buf;
+}
+
+static void __parse_ref(lexer_t * lex, agp_component_ref_t * ref){
+  token_t * token = __expect(lex);
+
+  if(agp_component_ref_parse(token->s, ref) != 0)
+    lex_fail(lex, token->line, token->column, "Cannot find %s in agp file",
+             token->s);
+}
+
+static void __parse_segment(lexer_t * lex, script_op_t * op){
+  __parse_ref(lex, &op->left);
+  op->range = SCRIPT_SINGLE;
+
+  token_t * token = __peek(lex);
+  if(token && strcmp(token->s, "THRU") == 0){
+    __next(lex); // remove THRU
 
-typedef char* cstr_t;
-KDQ_INIT(cstr_t);
+    token = __peek(lex);
+    if(token && strcmp(token->s, "END") == 0){
+      __next(lex);
+      op->range = SCRIPT_THRU_END;
+    } else {
+      __parse_ref(lex, &op->right);
+      op->range = SCRIPT_THRU;
+    }
+  }
+}
 
-char* __slurp_file(FILE* file){
-  char * text = NULL;
-  int size = 0;
-  while(!feof(file)){
-    text = realloc(text, (size + 2048) * sizeof(char));
-    size += fread(text+size, 1, 2048, file);
+static void __parse_move(lexer_t * lex, script_op_t * op){
+  __parse_segment(lex, op);
+
+  token_t * token = __expect(lex);
+  if(strcmp(token->s, "AFTER") == 0){
+    op->direction = 1;
+  } else if(strcmp(token->s, "BEFORE") == 0){
+    op->direction = -1;
+  } else {
+    lex_fail(lex, token->line, token->column, "Expected BEFORE or AFTER");
   }
-  text[size] = 0;
 
-  /* erase comments */
+  __parse_ref(lex, &op->target);
+}
+
+static void __parse_create(lexer_t * lex, script_op_t * op){
+  token_t * token = __expect(lex);
+  op->object = str_pool_intern(token->s, token->len);
 
-  char * c = text;
-  while(c && *c != '\0'){
-    if(*c == '#') {
-      while(c && *c != '\0' && *c != '\n'){
-        *c = ' ';
-        c++;
+  __expect_word(lex, "FROM",
+                "Expected FROM after name of new object in CREATE");
+  __parse_segment(lex, op);
+}
+
+static void __parse_split(lexer_t * lex, script_op_t * op){
+  __parse_ref(lex, &op->target);
+  __expect_word(lex, "AT", "Expected AT after sequence in SPLIT");
+
+  token_t * token = __expect(lex);
+  size_t i;
+
+  op->pos = 0;
+  for(i = 0; i < token->len; i++){
+    unsigned int digit = (unsigned char) token->s[i] - '0';
+    if(digit > 9 || op->pos > (ULONG_MAX - digit) / 10)
+      break;
+    op->pos = op->pos * 10 + digit;
+  }
+
+  if(i < token->len || op->pos == 0)
+    lex_fail(lex, token->line, token->column,
+             "Position must be a positive integer: %s", token->s);
+}
+
+static void __compile(lexer_t * lex, script_t * script){
+  token_t * token;
+
+  while((token = __next(lex)) != NULL){
+    if(script->n == script->m){
+      script->m = script->m ? script->m * 2 : 64;
+      script->ops = realloc(script->ops, sizeof(script_op_t) * script->m);
+      if(!script->ops){
+        error_fail("Out of memory while compiling script\n");
       }
     }
-    c++;
+
+    script_op_t * op = script->ops + script->n++;
+    memset(op, 0, sizeof(script_op_t));
+    op->line   = token->line;
+    op->column = token->column;
+
+    if     (strcmp(token->s, "MOVE"   ) == 0) op->verb = SCRIPT_MOVE;
+    else if(strcmp(token->s, "REV"    ) == 0) op->verb = SCRIPT_REV;
+    else if(strcmp(token->s, "REVCOMP") == 0) op->verb = SCRIPT_REVCOMP;
+    else if(strcmp(token->s, "CREATE" ) == 0) op->verb = SCRIPT_CREATE;
+    else if(strcmp(token->s, "SPLIT"  ) == 0) op->verb = SCRIPT_SPLIT;
+    else{
+      lex_fail(lex, token->line, token->column, "Unknown directive: %s",
+               token->s);
+    }
+
+    switch(op->verb){
+    case SCRIPT_MOVE:    __parse_move(lex, op);    break;
+    case SCRIPT_REV:
+    case SCRIPT_REVCOMP: __parse_segment(lex, op); break;
+    case SCRIPT_CREATE:  __parse_create(lex, op);  break;
+    case SCRIPT_SPLIT:   __parse_split(lex, op);   break;
+    }
   }
-  
-  return text;
 }
 
-cstr_t* __next_token(kdq_t(cstr_t)* tokens, int expected){
-  cstr_t* token = kdq_shift(cstr_t, tokens);
+static void __lexer_free(lexer_t * lex){
+  free(lex->tokens[0].s);
+  free(lex->tokens[1].s);
+  free(lex->buffer);
+}
 
-  if(!token && expected) fail("Unexpected end to script\n");
+script_t * script_compile(FILE * file){
+  script_t * script = calloc(1, sizeof(script_t));
+  lexer_t lex = { .file = file };
 
-   return token;
+  __compile(&lex, script);
+  __lexer_free(&lex);
+
+  return script;
 }
 
+script_t * script_compile_string(const char * text, char * error,
+                                 size_t size){
+  script_t * script = calloc(1, sizeof(script_t));
+  size_t len = strlen(text);
+  jmp_buf recover;
+
+  if(len == 0)
+    return script;
+
+  FILE * file = fmemopen((void*) text, len, "r");
+  if(!file){
+    snprintf(error, size, "Failed to read script: %s", strerror(errno));
+    script_destroy(script);
+    return NULL;
+  }
+
+  lexer_t lex = { .file = file, .recover = &recover,
+                  .error = error, .error_size = size };
 
-typedef struct { agp_scaffold_t *left, *right; } segment_t;
+  if(setjmp(recover)){
+    __lexer_free(&lex);
+    fclose(file);
+    script_destroy(script);
+    return NULL;
+  }
 
-agp_scaffold_t* __get_component(agp_graph_t * graph, char* key){
-  agp_scaffold_t *comp = agp_graph_component(graph, key);
-  if(!comp) fail("Cannot find %s in agp file\n", key);
+  __compile(&lex, script);
+  __lexer_free(&lex);
+  fclose(file);
 
-  return comp;
+  return script;
 }
 
-int __parse_segment(kdq_t(cstr_t)* tokens, agp_graph_t* graph, segment_t* seg){
-  int ret = 1;
-  cstr_t* token = __next_token(tokens, 1);
-  seg->left  = __get_component(graph, *token);
-  seg->right = seg->left;
+void script_destroy(script_t * script){
+  free(script->ops);
+  free(script);
+}
 
-  if(kdq_size(tokens) > 0 && strcmp(kdq_first(tokens), "THRU") == 0){
-    kdq_shift(cstr_t, tokens); // remove THRU
-    token = __next_token(tokens, 1);
 
-    if(strcmp(*token, "END") == 0) {
-      agp_scaffold_t* cur = seg->left;
-      while(cur && cur->next != NULL){
-        cur = cur->next;
-      }
-      seg->right = cur;
-    } else {
-      seg->right  = __get_component(graph, *token);
+/* Running. Each operation is run in three steps: its references are
+   resolved to records, it is checked against the graph, and then
+   applied. Errors are returned in the task so the parallel runner can
+   report the same one as a serial run. */
+typedef struct {
+  const script_op_t * op;
+  agp_scaffold_t *left, *right, *target;
+  char error[1024];
+} task_t;
+
+#define task_fail(task, ...) do {                                       \
+    snprintf((task)->error, sizeof((task)->error), __VA_ARGS__);        \
+    return -1; } while (0)
+
+static int __resolve(agp_graph_t * graph, task_t * task,
+                     const agp_component_ref_t * ref,
+                     agp_scaffold_t ** record){
+  char buf[1024];
+
+  *record = agp_graph_resolve(graph, ref);
+  if(!*record)
+    task_fail(task, "Cannot find %s in agp file",
+              __ref_str(ref, buf, sizeof(buf)));
+  return 0;
+}
+
+static int __touched(agp_graph_t * graph, task_t * task, str_id_t names[3]);
+
+static int __lookup(agp_graph_t * graph, task_t * task){
+  const script_op_t * op = task->op;
+
+  if(op->verb == SCRIPT_SPLIT)
+    return __resolve(graph, task, &op->target, &task->target);
+
+  if(__resolve(graph, task, &op->left, &task->left) != 0)
+    return -1;
+
+  switch(op->range){
+  case SCRIPT_SINGLE:
+    task->right = task->left;
+    break;
+  case SCRIPT_THRU:
+    if(__resolve(graph, task, &op->right, &task->right) != 0)
+      return -1;
+    break;
+  case SCRIPT_THRU_END:
+    task->right = agp_graph_last(graph, task->left);
+    break;
+  }
+
+  if(op->verb == SCRIPT_MOVE)
+    return __resolve(graph, task, &op->target, &task->target);
+  return 0;
+}
+
+/* On a fork (agp_graph_fork), the objects an operation changes are
+   copied from the base first, and the operation resolved again on the
+   copies */
+static int __prepare(agp_graph_t * graph, task_t * task){
+  str_id_t names[3];
+  int n, i, copied = 0;
+
+  if(__lookup(graph, task) != 0)
+    return -1;
+  if(!graph->base)
+    return 0;
+
+  n = __touched(graph, task, names);
+  for(i = 0; i < n; i++){
+    agp_object_t * object = agp_graph_object(graph, names[i]);
+
+    if(object && agp_graph_shared(graph, object)){
+      agp_graph_own(graph, names[i]);
+      copied = 1;
     }
   }
 
-  agp_scaffold_t* cur = seg->left;
-  while(cur && cur != seg->right){
-    ret++;
-    cur = cur->next;
+  return copied ? __lookup(graph, task) : 0;
+}
+
+static int __connected(agp_graph_t * graph, task_t * task){
+  const script_op_t * op = task->op;
+
+  if(op->verb != SCRIPT_SPLIT &&
+     agp_graph_distance(graph, task->left, task->right) < 0){
+    char left[1024], right[1024];
+    task_fail(task, "Given segment ends are not connected: %s - %s",
+              __ref_str(&op->left, left, sizeof(left)),
+              op->range == SCRIPT_THRU_END ? "END" :
+              __ref_str(&op->right, right, sizeof(right)));
   }
 
-  if(!cur)
-    fail("Given segment ends are not connected: %s - %s",
-         seg->left->component.seq.key,
-         seg->right->component.seq.key);
+  return 0;
+}
+
+static int __split_inside(task_t * task){
+  const script_op_t * op = task->op;
+
+  if(op->pos >= task->target->component.seq.end ||
+     op->pos <= task->target->component.seq.start)
+    task_fail(task, "Position (%lu) must be between start (%lu) and "
+              "end (%lu) of segment", op->pos,
+              task->target->component.seq.start,
+              task->target->component.seq.end);
 
-  return ret;
+  return 0;
 }
 
-void __parse_move(kdq_t(cstr_t)* tokens, agp_graph_t* graph){
-  segment_t seg;
-  int seg_size = __parse_segment(tokens, graph, &seg);
-  
-  agp_scaffold_t* target = NULL;
-  cstr_t* token = __next_token(tokens, 1);
-  
-  int direction = 0;
-  if(strcmp(*token, "AFTER") == 0){
-    direction = 1;
-  } else if(strcmp(*token, "BEFORE") == 0){
-    direction = -1;
-  } else {
-    fail("Expected BEFORE or AFTER");
+/* whether the MOVE target is inside its own segment. Lists are only
+   walked over the segment, which moving it walks anyway, rather than
+   to the end of the object */
+static int __within(agp_graph_t * graph, task_t * task){
+  agp_scaffold_t * cur;
+
+  if(graph->engine == AGP_ENGINE_TREE)
+    return agp_graph_distance(graph, task->left, task->target) >= 0 &&
+      agp_graph_distance(graph, task->target, task->right) >= 0;
+
+  for(cur = task->left; cur != NULL; cur = agp_graph_neighbor(graph, cur, 1)){
+    if(cur == task->target)
+      return 1;
+    if(cur == task->right)
+      break;
+  }
+  return 0;
+}
+
+/* everything the graph would stop on, or trip over, is checked before
+   an operation is applied, so a bad operation is reported with its
+   line without changing the graph */
+#define __flank(r) (!(r) || agp_is_gap(r))
+
+static int __guard(agp_graph_t * graph, task_t * task){
+  const script_op_t * op = task->op;
+  char buf[1024];
+
+  if(op->verb == SCRIPT_SPLIT)
+    return __split_inside(task);
+
+  if(__connected(graph, task) != 0)
+    return -1;
+
+  if(!__flank(agp_graph_neighbor(graph, task->left, -1)) ||
+     !__flank(agp_graph_neighbor(graph, task->right, 1)))
+    task_fail(task, "AGP file must be Sequence - Gap - Sequence. The "
+              "range specified isn't flanked by gaps");
+
+  if(op->verb == SCRIPT_MOVE){
+    if(__within(graph, task))
+      task_fail(task, "Cannot move a segment next to its own sequence %s",
+                __ref_str(&op->target, buf, sizeof(buf)));
+
+    if(!__flank(agp_graph_neighbor(graph, task->target, op->direction)))
+      task_fail(task, "AGP file must be Sequence - Gap - Sequence. %s "
+                "isn't flanked by gaps",
+                __ref_str(&op->target, buf, sizeof(buf)));
   }
 
-  token = kdq_shift(cstr_t, tokens);
-  target = __get_component(graph, *token);
-  
-  agp_scaffold_t * start = agp_graph_isolate(graph, seg.left, seg.right);
-  agp_graph_insert(graph, start, target, direction);
+  if(op->verb == SCRIPT_CREATE){
+    agp_object_t * object = agp_graph_object(graph, op->object);
+
+    /* an object can only be made again out of all of itself */
+    if(object &&
+       (object != agp_graph_record_object(graph, task->left) ||
+        agp_graph_distance(graph, task->left, task->right) !=
+        (long) object->count))
+      task_fail(task, "Cannot create object: %s already exists",
+                str_pool_get(op->object));
+  }
+
+  return 0;
+}
+
+/* resolve and check an operation. Returns -1 with the error in task */
+static int __ready(agp_graph_t * graph, task_t * task){
+  if(__prepare(graph, task) != 0 || __guard(graph, task) != 0)
+    return -1;
+  return 0;
 }
 
-void __parse_reverse(kdq_t(cstr_t)* tokens, agp_graph_t* graph, int complement){
-  segment_t seg;
-  int size = __parse_segment(tokens, graph, &seg);
-  agp_graph_reverse(graph, seg.left, seg.right, complement);
- 
+/* apply an operation that is ready */
+static void __execute(agp_graph_t * graph, task_t * task){
+  const script_op_t * op = task->op;
+  agp_scaffold_t * start;
+
+  switch(op->verb){
+  case SCRIPT_MOVE:
+    start = agp_graph_isolate(graph, task->left, task->right);
+    agp_graph_insert(graph, start, task->target, op->direction);
+    break;
+
+  case SCRIPT_REV:
+  case SCRIPT_REVCOMP:
+    agp_graph_reverse(graph, task->left, task->right,
+                      op->verb == SCRIPT_REVCOMP);
+    break;
+
+  case SCRIPT_CREATE:
+    start = agp_graph_isolate(graph, task->left, task->right);
+    agp_graph_create_object(graph, op->object, start);
+    break;
+
+  case SCRIPT_SPLIT:
+    agp_graph_split(graph, task->target, op->pos);
+    break;
+  }
 }
 
-void __parse_create(kdq_t(cstr_t)* tokens, agp_graph_t* graph){
-  cstr_t object;
-  cstr_t* token = __next_token(tokens, 1);
-  object = *token;
+#define __task_fail(task) fail((task)->op->line, (task)->op->column,    \
+                               "%s", (task)->error)
+
+void script_run(script_t * script, agp_graph_t * graph){
+  task_t task;
+  size_t i;
+
+  for(i = 0; i < script->n; i++){
+    task.op = script->ops + i;
 
-  token = __next_token(tokens, 1);
-  if(strcmp(*token, "FROM") != 0 )
-    fail("Expected FROM after name of new object in CREATE\n");
+    if(__ready(graph, &task) != 0)
+      __task_fail(&task);
+    __execute(graph, &task);
+  }
+}
 
-  segment_t seg;
-  int size = __parse_segment(tokens, graph, &seg);
+/* the script is run on a fork, which only copies the objects it
+   changes, so every check of a real run is made */
+void script_check(script_t * script, agp_graph_t * graph){
+  agp_graph_t * fork = agp_graph_fork(graph);
 
-  agp_scaffold_t * start = agp_graph_isolate(graph, seg.left, seg.right);
-  agp_graph_create(graph, object, start);
+  script_run(script, fork);
+  agp_graph_destroy(fork);
 }
 
-void __parse_split(kdq_t(cstr_t)* tokens, agp_graph_t* graph){
-  cstr_t* token = __next_token(tokens, 1);
-  agp_scaffold_t* target = __get_component(graph, *token);
+static const char * const script_verbs[] =
+  { "MOVE", "REV", "REVCOMP", "CREATE", "SPLIT" };
 
-  token = __next_token(tokens, 1);
+static uint64_t __nanoseconds(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-  if(strcmp(*token, "AT") != 0 )
-    fail("Expected AT after sequence in SPLIT\n");
+void script_run_trace(script_t * script, agp_graph_t * graph,
+                      FILE * trace){
+  task_t task;
+  size_t i, walked;
 
+  for(i = 0; i < script->n; i++){
+    task.op = script->ops + i;
 
-  token = __next_token(tokens, 1);
+    walked = 0;
+    agp_graph_count_walks(graph, &walked);
+    uint64_t start = __nanoseconds();
 
-  long long pos = atoll(*token);
-  if( pos <= 0 )
-    fail("Position must be a positive integer: %s\n", *token);
+    if(__ready(graph, &task) != 0)
+      __task_fail(&task);
+    __execute(graph, &task);
 
-  agp_graph_split(graph, target, (unsigned long) pos);
+    uint64_t elapsed = __nanoseconds() - start;
+    fprintf(trace, "{\"line\":%zu,\"column\":%zu,\"verb\":\"%s\","
+            "\"walked\":%zu,\"ns\":%llu}\n", task.op->line,
+            task.op->column, script_verbs[task.op->verb], walked,
+            (unsigned long long) elapsed);
+  }
+
+  agp_graph_count_walks(graph, NULL);
 }
 
+void run_script(FILE * file, agp_graph_t * graph){
+  script_t * script = script_compile(file);
+  script_run(script, graph);
+  script_destroy(script);
+}
 
-void run_script(FILE* file, agp_graph_t* graph){
-  char* text = __slurp_file(file);
-  kdq_t(cstr_t)* tokens = kdq_init(cstr_t);
+/* Parallel running. Which objects an operation touches depends on the
+   operations before it, so the script is run in waves: operations are
+   resolved and checked in order against the graph as left by the
+   previous wave, and added to the wave while none of the objects they
+   touch (by name, including the one CREATE makes) is touched by an
+   earlier operation of the wave. A wave's operations are then
+   independent, so they run concurrently and their checks, which only
+   look at the objects they touch, still hold. An operation that fails
+   to resolve or check, or that touches a claimed object, starts the
+   next wave. */
+#define SCRIPT_WAVE 4096
+
+/* smaller waves run on the calling thread: starting threads for them
+   costs more than their operations */
+#define SCRIPT_WAVE_MIN 64
+
+KHASH_SET_INIT_INT(claims)
+
+typedef struct {
+  agp_graph_t * graph;
+  task_t * tasks;
+} wave_t;
+
+static void __run_task(void * data, size_t i){
+  wave_t * wave = data;
+  __execute(wave->graph, wave->tasks + i);
+}
 
+/* objects touched by a resolved task. Returns how many */
+static int __touched(agp_graph_t * graph, task_t * task, str_id_t names[3]){
+  int n = 0;
 
-  char * token = strtok(text, "\n ;");
-  while(token != NULL){
-    kdq_push(cstr_t, tokens, token);
-    token = strtok(NULL, "\n ;");
+  if(task->op->verb == SCRIPT_SPLIT){
+    names[n++] = agp_graph_record_object(graph, task->target)->name;
+    return n;
   }
 
-  while(kdq_size(tokens)){
-    token = *(kdq_shift(cstr_t, tokens));
-    
-    if     (strcmp(token, "MOVE"   ) == 0) __parse_move(tokens, graph);
-    else if(strcmp(token, "REV"    ) == 0) __parse_reverse(tokens, graph, 0);
-    else if(strcmp(token, "REVCOMP") == 0) __parse_reverse(tokens, graph, 1);
-    else if(strcmp(token, "CREATE" ) == 0) __parse_create(tokens, graph);
-    else if(strcmp(token, "SPLIT" )  == 0) __parse_split(tokens, graph);
-    else{
-      fail("Unknown directive: %s", token);
+  names[n++] = agp_graph_record_object(graph, task->left)->name;
+  if(task->op->range == SCRIPT_THRU)
+    names[n++] = agp_graph_record_object(graph, task->right)->name;
+  if(task->op->verb == SCRIPT_MOVE)
+    names[n++] = agp_graph_record_object(graph, task->target)->name;
+  if(task->op->verb == SCRIPT_CREATE)
+    names[n++] = task->op->object;
+
+  return n;
+}
+
+void script_run_threads(script_t * script, agp_graph_t * graph,
+                        int threads){
+  if(threads <= 1){
+    script_run(script, graph);
+    return;
+  }
+
+  task_t * tasks = malloc(sizeof(task_t) * SCRIPT_WAVE);
+  khash_t(claims) * claims = kh_init(claims);
+  wave_t wave = { graph, tasks };
+  size_t i = 0;
+
+  while(i < script->n){
+    size_t n = 0;
+    kh_clear(claims, claims);
+
+    while(i + n < script->n && n < SCRIPT_WAVE){
+      task_t * task = tasks + n;
+      str_id_t names[3];
+      int j, count, ret;
+
+      task->op = script->ops + i + n;
+      if(__ready(graph, task) != 0){
+        if(n == 0) __task_fail(task);
+        break;
+      }
+
+      count = __touched(graph, task, names);
+      for(j = 0; j < count; j++)
+        if(kh_get(claims, claims, names[j]) != kh_end(claims))
+          break;
+      if(j < count)
+        break;
+
+      for(j = 0; j < count; j++)
+        kh_put(claims, claims, names[j], &ret);
+      n++;
     }
+
+    int workers = n < SCRIPT_WAVE_MIN ? 1 : threads;
+    graph->shared = workers > 1;
+    parallel_for(workers, n, __run_task, &wave);
+    graph->shared = 0;
+
+    i += n;
+  }
+
+  kh_destroy(claims, claims);
+  free(tasks);
+}
+
+
+/* Single operations */
+int script_op_check(const script_op_t * op, agp_graph_t * graph,
+                    str_id_t names[3], char * error, size_t size){
+  task_t task = { .op = op };
+
+  if(__ready(graph, &task) != 0){
+    snprintf(error, size, "%s", task.error);
+    return -1;
   }
 
-  if(text) free(text);
-  text = NULL;
+  return __touched(graph, &task, names);
 }
 
+void script_op_run(const script_op_t * op, agp_graph_t * graph){
+  task_t task = { .op = op };
+
+  if(__ready(graph, &task) != 0)
+    __task_fail(&task);
+  __execute(graph, &task);
+}
+
+static void __write_segment(const script_op_t * op, FILE * file){
+  char buf[1024];
+
+  fputs(__ref_str(&op->left, buf, sizeof(buf)), file);
+  if(op->range == SCRIPT_THRU)
+    fprintf(file, " THRU %s", __ref_str(&op->right, buf, sizeof(buf)));
+  else if(op->range == SCRIPT_THRU_END)
+    fputs(" THRU END", file);
+}
+
+void script_op_write(const script_op_t * op, FILE * file){
+  char buf[1024];
+
+  switch(op->verb){
+  case SCRIPT_MOVE:
+    fputs("MOVE ", file);
+    __write_segment(op, file);
+    fprintf(file, " %s %s", op->direction == 1 ? "AFTER" : "BEFORE",
+            __ref_str(&op->target, buf, sizeof(buf)));
+    break;
+  case SCRIPT_REV:
+  case SCRIPT_REVCOMP:
+    fputs(op->verb == SCRIPT_REV ? "REV " : "REVCOMP ", file);
+    __write_segment(op, file);
+    break;
+  case SCRIPT_CREATE:
+    fprintf(file, "CREATE %s FROM ", str_pool_get(op->object));
+    __write_segment(op, file);
+    break;
+  case SCRIPT_SPLIT:
+    fprintf(file, "SPLIT %s AT %lu",
+            __ref_str(&op->target, buf, sizeof(buf)), op->pos);
+    break;
+  }
+  fputc('\n', file);
+}
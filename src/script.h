@@ -4,6 +4,89 @@
 #include <stdio.h>
 #include "agp-graph.h"
 
+/* Scripts are compiled into an array of operations before anything is
+   run, so syntax errors and unknown names are caught up front. Every
+   operation keeps the line and column of its verb for error
+   messages. */
+typedef enum {
+  SCRIPT_MOVE,
+  SCRIPT_REV,
+  SCRIPT_REVCOMP,
+  SCRIPT_CREATE,
+  SCRIPT_SPLIT
+} script_verb_t;
+
+/* how a segment ends: at its first sequence, at a second one, or at
+   the end of the object (THRU END) */
+typedef enum { SCRIPT_SINGLE, SCRIPT_THRU, SCRIPT_THRU_END } script_range_t;
+
+typedef struct {
+  script_verb_t verb;
+  size_t line, column;
+
+  /* segment of MOVE, REV, REVCOMP and CREATE */
+  agp_component_ref_t left, right;
+  script_range_t range;
+
+  /* MOVE target (with direction 1 for AFTER, -1 for BEFORE), or the
+     sequence to SPLIT */
+  agp_component_ref_t target;
+  int direction;
+
+  str_id_t object;       /* CREATE */
+  unsigned long pos;     /* SPLIT */
+} script_op_t;
+
+typedef struct {
+  script_op_t * ops;
+  size_t n, m;
+} script_t;
+
+/* compile a script. Names are looked up in the string pool, so the agp
+   file must be read first */
+script_t * script_compile(FILE*);
+
+/* check a compiled script against the graph without changing it, by
+   running it on a fork of the graph (agp_graph_fork). Everything
+   script_run would stop on is caught, and reported the same way. The
+   graph can't itself be a fork */
+void script_check(script_t*, agp_graph_t*);
+
+void script_run(script_t*, agp_graph_t*);
+
+/* same as script_run, with operations on different objects run
+   concurrently on up to threads threads. The result, and the error
+   reported for a bad script, are the same as script_run */
+void script_run_threads(script_t*, agp_graph_t*, int threads);
+void script_destroy(script_t*);
+
+/* same as script_run, writing a line of JSON to trace for every
+   operation: its line, column and verb, the records walked to resolve
+   and apply it, and the nanoseconds it took */
+void script_run_trace(script_t*, agp_graph_t*, FILE* trace);
+
+/* compile and run */
 void run_script(FILE*, agp_graph_t*);
 
+/* compile a script held in a string. Instead of exiting on an error,
+   NULL is returned with the message in error, starting with the line
+   and column as script errors do */
+script_t * script_compile_string(const char* text, char* error,
+                                 size_t size);
+
+/* check that a single operation can run on the graph as it is now,
+   including everything that would otherwise stop the program, such as
+   missing flanking gaps. Returns -1 with the message in error if it
+   can't. Otherwise names is filled with the objects it would change
+   (including the one CREATE makes, some maybe more than once) and
+   their number is returned */
+int script_op_check(const script_op_t*, agp_graph_t*, str_id_t names[3],
+                    char* error, size_t size);
+
+/* run a single operation that passed script_op_check */
+void script_op_run(const script_op_t*, agp_graph_t*);
+
+/* write an operation as a line of script */
+void script_op_write(const script_op_t*, FILE*);
+
 #endif //SCRIPT_H_
@@ -0,0 +1,607 @@
+#include "session.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "error.h"
+
+/* Operations are undone by the graph's own edits: the segment is
+   taken out and put back where it was, next to the sequences it was
+   between, and the gaps the operation replaced (the segment's flanks,
+   and the target's for MOVE) are set back as they were. Sequences are
+   kept by their keys, which undoing the later operations gives back,
+   and gaps by their fields, so an entry costs the same however long
+   the objects are.
+
+   A MOVE or CREATE next to a gap with no sequence beyond it (an object
+   starting or ending with a gap, or two gaps in a row) can't be put
+   back that way, and keeps a copy of the objects it changes, as they
+   were before it, instead. */
+typedef struct {
+  char type;             /* 0 if there was no gap */
+  agp_gapinfo_t info;
+} session_gap_t;
+
+/* an object as it was, record by record. exists is 0 for an object the
+   operation makes. Only the name is kept unless the entry is whole */
+typedef struct {
+  str_id_t name;
+  int exists;
+  agp_scaffold_t * records;
+  size_t n;
+} session_image_t;
+
+typedef struct {
+  script_op_t op;
+
+  /* the ends of the segment, or the sequence SPLIT as it is after; the
+     sequences before and after it (named STR_ID_NONE if there are none)
+     and its object; its flanking gaps and the target's */
+  agp_component_key_t left, right, prev, next, target;
+  str_id_t object;
+  session_gap_t gaps[3];
+
+  /* the objects changed, copied if whole */
+  session_image_t images[3];
+  int n_images, whole;
+} session_entry_t;
+
+typedef struct {
+  char * name;
+  size_t position;
+} session_checkpoint_t;
+
+typedef struct {
+  agp_graph_t * graph;
+
+  /* entries before position are applied, the ones after it have been
+     undone and can be redone */
+  session_entry_t * entries;
+  size_t n, m, position;
+
+  session_checkpoint_t * checkpoints;
+  size_t n_checkpoints, m_checkpoints;
+
+  /* report the objects each operation changed */
+  int verbose;
+} session_t;
+
+static const char * const session_help =
+  "  {script line}      apply the operations on the line\n"
+  "  UNDO [n]           undo the last n operations (default 1)\n"
+  "  REDO [n]           redo n undone operations (default 1)\n"
+  "  CHECKPOINT name    name the current point of the journal\n"
+  "  RESTORE name       undo or redo back to a checkpoint\n"
+  "  SHOW object        print the records of an object\n"
+  "  SAVE file          write the graph as an agp file\n"
+  "  JOURNAL file       write the operations applied so far as a script\n"
+  "  QUIT\n";
+
+static void __image(session_t * session, session_image_t * image,
+                    str_id_t name){
+  agp_object_t * object = agp_graph_object(session->graph, name);
+  agp_scaffold_t * cur;
+
+  image->exists  = object != NULL;
+  image->records = NULL;
+  image->n       = 0;
+  if(!object)
+    return;
+
+  agp_graph_flatten_object(session->graph, object);
+  image->records = malloc(sizeof(agp_scaffold_t) * (object->count + 1));
+  if(!image->records){
+    error_fail("Out of memory while journaling\n");
+  }
+
+  for(cur = object->head; cur != NULL; cur = cur->next)
+    image->records[image->n++] = *cur;
+}
+
+/* put the objects of a whole entry back the way they were before it */
+static void __restore(session_t * session, session_entry_t * entry){
+  agp_graph_t * graph = session->graph;
+  int i;
+  size_t j;
+
+  for(i = 0; i < entry->n_images; i++)
+    agp_graph_remove_object(graph, entry->images[i].name);
+
+  for(i = 0; i < entry->n_images; i++){
+    session_image_t * image = entry->images + i;
+
+    for(j = 0; j < image->n; j++){
+      agp_scaffold_t * record = agp_graph_alloc(graph);
+      *record = image->records[j];
+      record->next = record->prev = NULL;
+
+      if(agp_graph_append(graph, image->name, record) != 0){
+        error_fail("Journal doesn't match the graph: %s\n",
+                   str_pool_get(image->name));
+      }
+    }
+  }
+}
+
+#define __key(r) ((agp_component_key_t) { (r)->component.seq.name,  \
+        (r)->component.seq.start, (r)->component.seq.end })
+#define __no_key ((agp_component_key_t) { STR_ID_NONE, 0, 0 })
+
+static agp_scaffold_t * __record(session_t * session,
+                                 agp_component_key_t key){
+  agp_scaffold_t * record;
+
+  if(key.name == STR_ID_NONE)
+    return NULL;
+  record = agp_graph_component(session->graph, key);
+  if(!record){
+    error_fail("Journal doesn't match the graph: %s:%lu-%lu\n",
+               str_pool_get(key.name), key.start, key.end);
+  }
+  return record;
+}
+
+static void __gap_save(session_gap_t * gap, const agp_scaffold_t * record){
+  gap->type = record ? record->type : 0;
+  if(record)
+    gap->info = record->component.gap;
+}
+
+/* keep the flank of a record in one direction, and the sequence beyond
+   it. Returns -1 if the flank is a gap with no sequence beyond it */
+static int __flank(session_t * session, agp_scaffold_t * record,
+                   int direction, session_gap_t * gap,
+                   agp_component_key_t * beyond){
+  agp_scaffold_t * flank, * next = NULL;
+
+  flank = agp_graph_neighbor(session->graph, record, direction);
+  if(flank)
+    next = agp_graph_neighbor(session->graph, flank, direction);
+
+  __gap_save(gap, flank);
+  *beyond = next && !agp_is_gap(next) ? __key(next) : __no_key;
+  return flank && (!next || agp_is_gap(next)) ? -1 : 0;
+}
+
+/* set the gap next to a record back to a kept one */
+static void __gap_put(session_t * session, agp_component_key_t key,
+                      int direction, const session_gap_t * gap){
+  agp_scaffold_t * flank;
+
+  if(!gap->type)
+    return;
+  flank = agp_graph_neighbor(session->graph, __record(session, key),
+                             direction);
+  if(flank && agp_is_gap(flank))
+    agp_graph_set_gap(session->graph, flank, gap->type, &gap->info);
+}
+
+/* journal an operation that passed script_op_check, before it runs */
+static void __journal(session_t * session, session_entry_t * entry,
+                      const str_id_t names[3], int n){
+  agp_graph_t * graph = session->graph;
+  const script_op_t * op = &entry->op;
+  agp_scaffold_t * left, * right;
+  agp_component_key_t beyond;
+  int i, j;
+
+  entry->n_images = 0;
+  entry->whole    = 0;
+  for(i = 0; i < n; i++){
+    for(j = 0; j < entry->n_images; j++)
+      if(entry->images[j].name == names[i])
+        break;
+    if(j == entry->n_images){
+      entry->images[j].name    = names[i];
+      entry->images[j].records = NULL;
+      entry->n_images++;
+    }
+  }
+
+  if(op->verb == SCRIPT_SPLIT){
+    entry->left = __key(agp_graph_resolve(graph, &op->target));
+    entry->left.end = op->pos;
+    return;
+  }
+
+  left = agp_graph_resolve(graph, &op->left);
+  if(op->range == SCRIPT_SINGLE)
+    right = left;
+  else if(op->range == SCRIPT_THRU)
+    right = agp_graph_resolve(graph, &op->right);
+  else
+    right = agp_graph_last(graph, left);
+
+  entry->object = agp_graph_record_object(graph, left)->name;
+  entry->left   = __key(left);
+  entry->right  = agp_is_gap(right) ? __no_key : __key(right);
+
+  if(__flank(session, left, -1, entry->gaps, &entry->prev) != 0 ||
+     __flank(session, right, 1, entry->gaps + 1, &entry->next) != 0)
+    entry->whole = 1;
+
+  if(op->verb == SCRIPT_MOVE){
+    agp_scaffold_t * target = agp_graph_resolve(graph, &op->target);
+
+    entry->target = __key(target);
+    if(__flank(session, target, op->direction, entry->gaps + 2,
+               &beyond) != 0)
+      entry->whole = 1;
+  }
+
+  /* REV puts back its own gaps, wherever they are, but any operation
+     needs a segment ending in a sequence (THRU END may end in a gap) */
+  if(op->verb == SCRIPT_REV || op->verb == SCRIPT_REVCOMP)
+    entry->whole = 0;
+  if(agp_is_gap(right))
+    entry->whole = 1;
+
+  if(entry->whole)
+    for(i = 0; i < entry->n_images; i++)
+      __image(session, entry->images + i, entry->images[i].name);
+}
+
+/* put a segment taken out by MOVE or CREATE back where it was */
+static void __put_back(session_t * session, session_entry_t * entry,
+                       agp_scaffold_t * segment){
+  agp_graph_t * graph = session->graph;
+
+  if(entry->prev.name != STR_ID_NONE)
+    agp_graph_insert(graph, segment, __record(session, entry->prev), 1);
+  else if(entry->next.name != STR_ID_NONE)
+    agp_graph_insert(graph, segment, __record(session, entry->next), -1);
+  else
+    agp_graph_create_object(graph, entry->object, segment);
+
+  __gap_put(session, entry->left, -1, entry->gaps);
+  __gap_put(session, entry->right, 1, entry->gaps + 1);
+}
+
+/* take an entry's operation back. The graph is as the operation left
+   it, the entries after it having been undone */
+static void __take_back(session_t * session, session_entry_t * entry){
+  agp_graph_t * graph = session->graph;
+  const script_op_t * op = &entry->op;
+  agp_scaffold_t * segment;
+
+  if(entry->whole){
+    __restore(session, entry);
+    return;
+  }
+
+  switch(op->verb){
+  case SCRIPT_MOVE:
+    segment = agp_graph_isolate(graph, __record(session, entry->left),
+                                __record(session, entry->right));
+    __gap_put(session, entry->target, op->direction, entry->gaps + 2);
+    __put_back(session, entry, segment);
+    break;
+
+  case SCRIPT_REV:
+  case SCRIPT_REVCOMP:
+    agp_graph_reverse(graph, __record(session, entry->right),
+                      __record(session, entry->left),
+                      op->verb == SCRIPT_REVCOMP);
+    __gap_put(session, entry->left, -1, entry->gaps);
+    __gap_put(session, entry->right, 1, entry->gaps + 1);
+    break;
+
+  case SCRIPT_CREATE:
+    segment = agp_graph_isolate(graph, __record(session, entry->left),
+                                __record(session, entry->right));
+    __put_back(session, entry, segment);
+    break;
+
+  case SCRIPT_SPLIT:
+    agp_graph_unsplit(graph, __record(session, entry->left));
+    break;
+  }
+}
+
+static void __entry_free(session_entry_t * entry){
+  int i;
+  for(i = 0; i < entry->n_images; i++)
+    free(entry->images[i].records);
+}
+
+/* forget the undone operations, and the checkpoints among them */
+static void __truncate(session_t * session){
+  size_t i, j;
+
+  for(i = session->position; i < session->n; i++)
+    __entry_free(session->entries + i);
+  session->n = session->position;
+
+  for(i = j = 0; i < session->n_checkpoints; i++){
+    if(session->checkpoints[i].position <= session->position)
+      session->checkpoints[j++] = session->checkpoints[i];
+    else
+      free(session->checkpoints[i].name);
+  }
+  session->n_checkpoints = j;
+}
+
+static void __report(session_t * session, const session_entry_t * entry){
+  int i;
+
+  for(i = 0; i < entry->n_images; i++){
+    str_id_t name = entry->images[i].name;
+    agp_object_t * object = agp_graph_object(session->graph, name);
+
+    if(object)
+      fprintf(stderr, "  %s: %zu records, %lu bp\n", str_pool_get(name),
+              object->count, object->length);
+    else
+      fprintf(stderr, "  %s: removed\n", str_pool_get(name));
+  }
+}
+
+static int __apply(session_t * session, const script_op_t * op,
+                   char * error, size_t size){
+  str_id_t names[3];
+  int n = script_op_check(op, session->graph, names, error, size);
+
+  if(n < 0)
+    return -1;
+
+  __truncate(session);
+  if(session->n == session->m){
+    session->m = session->m ? session->m * 2 : 64;
+    session->entries = realloc(session->entries,
+                               sizeof(session_entry_t) * session->m);
+    if(!session->entries){
+      error_fail("Out of memory while journaling\n");
+    }
+  }
+
+  session_entry_t * entry = session->entries + session->n;
+  entry->op = *op;
+  __journal(session, entry, names, n);
+
+  script_op_run(op, session->graph);
+  session->n++;
+  session->position++;
+
+  if(session->verbose)
+    __report(session, entry);
+  return 0;
+}
+
+static int __undo(session_t * session){
+  if(session->position == 0)
+    return -1;
+
+  session_entry_t * entry = session->entries + --session->position;
+  __take_back(session, entry);
+
+  fputs("Undone: ", stderr);
+  script_op_write(&entry->op, stderr);
+  return 0;
+}
+
+/* the graph is back to what it was when the entry was made, so the
+   entry still holds */
+static int __redo(session_t * session){
+  char error[1024];
+  str_id_t names[3];
+
+  if(session->position == session->n)
+    return -1;
+
+  session_entry_t * entry = session->entries + session->position;
+  if(script_op_check(&entry->op, session->graph, names,
+                     error, sizeof(error)) < 0){
+    fprintf(stderr, "Error: %s\n", error);
+    return -1;
+  }
+
+  script_op_run(&entry->op, session->graph);
+  session->position++;
+
+  fputs("Redone: ", stderr);
+  script_op_write(&entry->op, stderr);
+  return 0;
+}
+
+static session_checkpoint_t * __checkpoint(session_t * session,
+                                           const char * name){
+  size_t i;
+  for(i = 0; i < session->n_checkpoints; i++)
+    if(strcmp(session->checkpoints[i].name, name) == 0)
+      return session->checkpoints + i;
+  return NULL;
+}
+
+static void __set_checkpoint(session_t * session, const char * name){
+  session_checkpoint_t * checkpoint = __checkpoint(session, name);
+
+  if(!checkpoint){
+    if(session->n_checkpoints == session->m_checkpoints){
+      session->m_checkpoints = session->m_checkpoints ?
+        session->m_checkpoints * 2 : 8;
+      session->checkpoints =
+        realloc(session->checkpoints,
+                sizeof(session_checkpoint_t) * session->m_checkpoints);
+    }
+    checkpoint = session->checkpoints + session->n_checkpoints++;
+    checkpoint->name = strdup(name);
+  }
+
+  checkpoint->position = session->position;
+  fprintf(stderr, "Checkpoint %s at operation %zu\n", name,
+          session->position);
+}
+
+static void __restore_checkpoint(session_t * session, const char * name){
+  session_checkpoint_t * checkpoint = __checkpoint(session, name);
+
+  if(!checkpoint){
+    fprintf(stderr, "Error: unknown checkpoint %s\n", name);
+    return;
+  }
+
+  size_t position = checkpoint->position;
+  while(session->position > position)
+    __undo(session);
+  while(session->position < position)
+    if(__redo(session) != 0)
+      break;
+}
+
+static void __save(session_t * session, const char * path, int journal){
+  FILE * file = fopen(path, "w");
+  size_t i;
+
+  if(!file){
+    fprintf(stderr, "Error: failed to open '%s': %s\n", path,
+            strerror(errno));
+    return;
+  }
+
+  if(journal){
+    for(i = 0; i < session->position; i++)
+      script_op_write(&session->entries[i].op, file);
+  } else if(strlen(path) > 3 &&
+            strcmp(path + strlen(path) - 3, ".gz") == 0){
+    agp_graph_print_bgzf(session->graph, file, 1);
+  } else {
+    agp_graph_print(session->graph, file);
+  }
+
+  if(fclose(file) != 0)
+    fprintf(stderr, "Error: failed to write '%s': %s\n", path,
+            strerror(errno));
+  else
+    fprintf(stderr, "Wrote %s\n", path);
+}
+
+static void __show(session_t * session, const char * name){
+  str_id_t id = str_pool_find(name, strlen(name));
+  agp_object_t * object =
+    id == STR_ID_NONE ? NULL : agp_graph_object(session->graph, id);
+
+  if(!object){
+    fprintf(stderr, "Error: no object %s\n", name);
+    return;
+  }
+
+  fflush(stderr);
+  agp_graph_print_object(session->graph, object, stderr);
+}
+
+static void __script_line(session_t * session, const char * line){
+  char error[1024];
+  size_t i;
+  script_t * script = script_compile_string(line, error, sizeof(error));
+
+  if(!script){
+    fprintf(stderr, "Error: %s\n", error);
+    return;
+  }
+
+  for(i = 0; i < script->n; i++)
+    if(__apply(session, script->ops + i, error, sizeof(error)) != 0){
+      fprintf(stderr, "Error: %s\n", error);
+      break;
+    }
+
+  script_destroy(script);
+}
+
+#define __word(s) (strlen(s) == len && strncmp(word, s, len) == 0)
+
+/* run one line. Returns 1 to end the session */
+static int __command(session_t * session, char * line){
+  char * word = line + strspn(line, " \t\r\n;");
+  size_t len = strcspn(word, " \t\r\n;#");
+
+  if(len == 0)
+    return 0;
+
+  if(!__word("QUIT") && !__word("EXIT") && !__word("HELP") &&
+     !__word("UNDO") && !__word("REDO") && !__word("CHECKPOINT") &&
+     !__word("RESTORE") && !__word("SHOW") && !__word("SAVE") &&
+     !__word("JOURNAL")){
+    __script_line(session, line);
+    return 0;
+  }
+
+  /* the argument, if any, is a single word */
+  char * arg = word + len;
+  arg += strspn(arg, " \t");
+  arg[strcspn(arg, " \t\r\n;#")] = '\0';
+
+  long count = *arg ? strtol(arg, NULL, 10) : 1;
+
+  if(__word("QUIT") || __word("EXIT"))
+    return 1;
+
+  if(__word("HELP")){
+    fputs(session_help, stderr);
+  } else if(__word("UNDO")){
+    for(; count > 0; count--)
+      if(__undo(session) != 0){
+        fputs("Nothing to undo\n", stderr);
+        break;
+      }
+  } else if(__word("REDO")){
+    for(; count > 0; count--)
+      if(session->position == session->n){
+        fputs("Nothing to redo\n", stderr);
+        break;
+      } else if(__redo(session) != 0){
+        break;
+      }
+  } else {
+    if(!*arg){
+      fprintf(stderr, "Error: %.*s needs an argument\n", (int) len, word);
+      return 0;
+    }
+
+    if(__word("CHECKPOINT"))   __set_checkpoint(session, arg);
+    else if(__word("RESTORE")) __restore_checkpoint(session, arg);
+    else if(__word("SHOW"))    __show(session, arg);
+    else if(__word("SAVE"))    __save(session, arg, 0);
+    else                       __save(session, arg, 1);
+  }
+
+  return 0;
+}
+
+void session_run(agp_graph_t * graph, script_t * script, FILE * in){
+  session_t session = { .graph = graph };
+  char error[1024];
+  size_t i;
+
+  for(i = 0; i < script->n; i++){
+    const script_op_t * op = script->ops + i;
+
+    if(__apply(&session, op, error, sizeof(error)) != 0){
+      fprintf(stderr, "Script error: line %zu, column %zu: %s\n",
+              op->line, op->column, error);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  session.verbose = 1;
+  int prompt = isatty(fileno(in));
+  char * line = NULL;
+  size_t capacity = 0;
+
+  while(1){
+    if(prompt)
+      fputs("magpie> ", stderr);
+    if(getline(&line, &capacity, in) < 0 || __command(&session, line))
+      break;
+  }
+
+  free(line);
+  for(i = 0; i < session.n; i++)
+    __entry_free(session.entries + i);
+  free(session.entries);
+  for(i = 0; i < session.n_checkpoints; i++)
+    free(session.checkpoints[i].name);
+  free(session.checkpoints);
+}
@@ -0,0 +1,30 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <stdio.h>
+
+#include "agp-graph.h"
+#include "script.h"
+
+/* Interactive session. Lines of script are read from in and applied to
+   the graph as they come. Every operation is journaled with where its
+   segment was and the gaps it replaced, so it can be undone without
+   reloading or copying anything. Besides the script verbs, a session
+   takes:
+
+     UNDO [n]           undo the last n operations (default 1)
+     REDO [n]           redo n undone operations
+     CHECKPOINT name    name the current point of the journal
+     RESTORE name       undo or redo back to a checkpoint
+     SHOW object        print the records of an object
+     SAVE file          write the graph as an agp file (BGZF if the
+                        name ends in .gz)
+     JOURNAL file       write the operations applied so far as a script
+     HELP, QUIT
+
+   A bad operation is reported and leaves the graph as it was. Replies
+   go to stderr, so stdout is left for the agp written at the end. The
+   operations of script are applied first, and can be undone too. */
+void session_run(agp_graph_t*, script_t*, FILE* in);
+
+#endif // SESSION_H_
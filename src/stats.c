@@ -0,0 +1,76 @@
+#include "stats.h"
+
+#include <time.h>
+#include <sys/resource.h>
+
+static const char * const stats_phases[] =
+  { "read", "compile", "script", "simplify", "print" };
+
+static double __clock(clockid_t id){
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void stats_start(stats_t * stats){
+  int i;
+  for(i = 0; i < STATS_PHASES; i++)
+    stats->wall[i] = stats->cpu[i] = 0;
+
+  stats->start_wall = __clock(CLOCK_MONOTONIC);
+  stats->start_cpu  = __clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void stats_lap(stats_t * stats, stats_phase_t phase){
+  double wall = __clock(CLOCK_MONOTONIC);
+  double cpu  = __clock(CLOCK_PROCESS_CPUTIME_ID);
+
+  stats->wall[phase] += wall - stats->start_wall;
+  stats->cpu[phase]  += cpu  - stats->start_cpu;
+  stats->start_wall = wall;
+  stats->start_cpu  = cpu;
+}
+
+#define __load(n, buckets) ((buckets) ? (double) (n) / (buckets) : 0)
+
+void stats_print(const stats_t * stats, agp_graph_t * graph, FILE * file){
+  agp_graph_stats_t sizes = agp_graph_stats(graph);
+  str_pool_stats_t pool = str_pool_stats();
+  struct rusage usage;
+  double wall = 0, cpu = 0;
+  int i;
+
+  getrusage(RUSAGE_SELF, &usage);
+
+  fprintf(file, "%-10s %10s %10s\n", "phase", "wall (s)", "cpu (s)");
+  for(i = 0; i < STATS_PHASES; i++){
+    fprintf(file, "%-10s %10.3f %10.3f\n", stats_phases[i],
+            stats->wall[i], stats->cpu[i]);
+    wall += stats->wall[i];
+    cpu  += stats->cpu[i];
+  }
+  fprintf(file, "%-10s %10.3f %10.3f\n", "total", wall, cpu);
+
+  fprintf(file, "objects            %zu\n", sizes.objects);
+  fprintf(file, "records            %zu\n", sizes.sequences + sizes.gaps);
+  fprintf(file, "  sequences        %zu\n", sizes.sequences);
+  fprintf(file, "  gaps             %zu\n", sizes.gaps);
+  fprintf(file, "  released         %zu\n", sizes.released);
+
+  fprintf(file, "load factors\n");
+  fprintf(file, "  objects          %.3f (%zu buckets)\n",
+          __load(sizes.objects, sizes.object_buckets), sizes.object_buckets);
+  fprintf(file, "  components       %.3f (%zu buckets)\n",
+          __load(sizes.sequences, sizes.component_buckets),
+          sizes.component_buckets);
+  fprintf(file, "  contigs          %.3f (%zu buckets)\n",
+          __load(sizes.contigs, sizes.contig_buckets), sizes.contig_buckets);
+  fprintf(file, "  strings          %.3f (%zu buckets)\n",
+          __load(pool.strings, pool.buckets), pool.buckets);
+
+  fprintf(file, "memory\n");
+  fprintf(file, "  graph            %zu bytes\n", sizes.bytes);
+  fprintf(file, "  strings          %zu bytes\n", pool.bytes);
+  fprintf(file, "  allocated        %zu bytes\n", sizes.bytes + pool.bytes);
+  fprintf(file, "  peak resident    %ld kB\n", usage.ru_maxrss);
+}
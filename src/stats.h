@@ -0,0 +1,32 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+
+#include "agp-graph.h"
+
+/* Phases of a run, for --stats */
+typedef enum {
+  STATS_READ,
+  STATS_COMPILE,
+  STATS_SCRIPT,
+  STATS_SIMPLIFY,
+  STATS_PRINT,
+  STATS_PHASES
+} stats_phase_t;
+
+typedef struct {
+  double wall[STATS_PHASES], cpu[STATS_PHASES];
+  double start_wall, start_cpu;
+} stats_t;
+
+/* start timing. Each stats_lap charges the time since the last one
+   (or stats_start) to phase */
+void stats_start(stats_t*);
+void stats_lap(stats_t*, stats_phase_t phase);
+
+/* write the phase times, the sizes of the graph and string pool, and
+   the memory used */
+void stats_print(const stats_t*, agp_graph_t*, FILE*);
+
+#endif // STATS_H_
@@ -0,0 +1,234 @@
+#include "str-pool.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "klib/khash.h"
+#include "error.h"
+
+#define STR_POOL_BLOCK (1 << 20)
+
+#define __slice_hash(key) ((key).hash)
+#define __slice_equal(a, b) \
+  ((a).len == (b).len && memcmp((a).s, (b).s, (a).len) == 0)
+
+KHASH_INIT(str_pool, str_slice_t, str_id_t, 1, __slice_hash, __slice_equal)
+
+static struct {
+  khash_t(str_pool) *index;
+
+  /* id -> string */
+  str_slice_t * strs;
+  size_t size, capacity;
+
+  /* strings are copied into large blocks, which are only released by
+     str_pool_destroy */
+  char ** blocks;
+  size_t n_blocks, m_blocks, used, allocated;
+} pool = {0};
+
+/* room for len bytes, or NULL with the pool as it was */
+static char * __pool_alloc(size_t len){
+  /* long strings get a block of their own */
+  size_t need = len > STR_POOL_BLOCK / 4 ? len : STR_POOL_BLOCK;
+
+  if(need != STR_POOL_BLOCK || pool.n_blocks == 0 ||
+     pool.used + len > STR_POOL_BLOCK){
+    if(pool.n_blocks == pool.m_blocks){
+      size_t m_blocks = pool.m_blocks ? pool.m_blocks * 2 : 16;
+      char ** blocks = realloc(pool.blocks, sizeof(char*) * m_blocks);
+      if(!blocks)
+        return NULL;
+      pool.blocks = blocks;
+      pool.m_blocks = m_blocks;
+    }
+
+    char * block = malloc(need);
+    if(!block)
+      return NULL;
+    pool.allocated += need;
+
+    if(need != STR_POOL_BLOCK){
+      /* keep the current block as the last one, so it stays open */
+      if(pool.n_blocks > 0){
+        pool.blocks[pool.n_blocks] = pool.blocks[pool.n_blocks - 1];
+        pool.blocks[pool.n_blocks - 1] = block;
+      } else {
+        pool.blocks[pool.n_blocks] = block;
+        pool.used = STR_POOL_BLOCK;
+      }
+      pool.n_blocks++;
+      return block;
+    }
+
+    pool.blocks[pool.n_blocks++] = block;
+    pool.used = 0;
+  }
+
+  char * ret = pool.blocks[pool.n_blocks - 1] + pool.used;
+  pool.used += len;
+  return ret;
+}
+
+str_slice_t str_slice(const char* s, size_t len){
+  str_slice_t slice = { s, (uint32_t) len, 0 };
+  size_t i;
+
+  for(i = 0; i < len; i++)
+    slice.hash = (slice.hash << 5) - slice.hash + (uint32_t) s[i];
+
+  return slice;
+}
+
+str_id_t str_pool_intern(const char* s, size_t len){
+  return str_pool_intern_slice(str_slice(s, len));
+}
+
+str_id_t str_pool_intern_slice(str_slice_t key){
+  int ret;
+  khiter_t k;
+
+  if(!pool.index){
+    pool.index = kh_init(str_pool);
+    /* id 0 is reserved for the empty string */
+    pool.size = 0;
+    str_pool_intern("", 0);
+  }
+
+  /* room for an id first, so that running out of memory leaves the
+     pool as it was */
+  if(pool.size == pool.capacity){
+    size_t capacity = pool.capacity ? pool.capacity * 2 : 1024;
+    str_slice_t * strs = realloc(pool.strs, sizeof(str_slice_t) * capacity);
+    if(!strs){
+      error_fail("Out of memory while interning strings\n");
+    }
+    pool.strs = strs;
+    pool.capacity = capacity;
+  }
+
+  k = kh_put(str_pool, pool.index, key, &ret);
+  if(ret == 0)
+    return kh_val(pool.index, k);
+  if(ret < 0){
+    error_fail("Out of memory while interning strings\n");
+  }
+
+  /* new string, copy it into the pool so it outlives the caller's
+     buffer */
+  char * copy = __pool_alloc(key.len + 1);
+  if(!copy){
+    kh_del(str_pool, pool.index, k);
+    error_fail("Out of memory while interning strings\n");
+  }
+  memcpy(copy, key.s, key.len);
+  copy[key.len] = '\0';
+
+  key.s = copy;
+  kh_key(pool.index, k) = key;
+  kh_val(pool.index, k) = (str_id_t) pool.size;
+  pool.strs[pool.size] = key;
+
+  return (str_id_t) pool.size++;
+}
+
+str_id_t str_pool_find(const char* s, size_t len){
+  khiter_t k;
+
+  if(!pool.index)
+    return len == 0 ? 0 : STR_ID_NONE;
+
+  k = kh_get(str_pool, pool.index, str_slice(s, len));
+  if(k == kh_end(pool.index))
+    return STR_ID_NONE;
+  return kh_val(pool.index, k);
+}
+
+const char* str_pool_get(str_id_t id){
+  return pool.strs[id].s;
+}
+
+size_t str_pool_len(str_id_t id){
+  return pool.strs[id].len;
+}
+
+size_t str_pool_size(void){
+  return pool.size;
+}
+
+str_pool_stats_t str_pool_stats(void){
+  str_pool_stats_t stats = { pool.size, 0, pool.allocated };
+
+  stats.bytes += pool.capacity * sizeof(str_slice_t);
+
+  if(pool.index){
+    stats.buckets = kh_n_buckets(pool.index);
+    stats.bytes += stats.buckets * (sizeof(str_slice_t) + sizeof(str_id_t)) +
+      (stats.buckets < 16 ? 1 : stats.buckets >> 4) * sizeof(khint32_t);
+  }
+
+  return stats;
+}
+
+str_slice_t str_pool_slice(str_id_t id){
+  return pool.strs[id];
+}
+
+int str_pool_load(const char* bytes, size_t size, const uint32_t* lens,
+                  const uint32_t* hashes, size_t n){
+  size_t i, offset;
+  int ret;
+  khiter_t k;
+
+  if(pool.size > 1 || n == 0 || lens[0] != 0 || size == 0 || bytes[0])
+    return -1;
+
+  if(!pool.index)
+    str_pool_intern("", 0);
+
+  /* all the strings go into one copy, and the index is sized once */
+  char * copy = __pool_alloc(size);
+  if(!copy){
+    error_fail("Out of memory while interning strings\n");
+  }
+  memcpy(copy, bytes, size);
+
+  kh_resize(str_pool, pool.index, n + n / 3 + 1);
+  if(pool.capacity < n){
+    str_slice_t * strs = realloc(pool.strs, sizeof(str_slice_t) * n);
+    if(!strs){
+      error_fail("Out of memory while interning strings\n");
+    }
+    pool.strs = strs;
+    pool.capacity = n;
+  }
+
+  for(i = 1, offset = 1; i < n; i++){
+    str_slice_t key = { copy + offset, lens[i], hashes[i] };
+
+    if(offset + lens[i] >= size || copy[offset + lens[i]] != '\0')
+      return -1;
+
+    k = kh_put(str_pool, pool.index, key, &ret);
+    if(ret == 0)
+      return -1;
+
+    kh_val(pool.index, k) = (str_id_t) pool.size;
+    pool.strs[pool.size++] = key;
+    offset += lens[i] + 1;
+  }
+
+  return 0;
+}
+
+void str_pool_destroy(void){
+  size_t i;
+  for(i = 0; i < pool.n_blocks; i++)
+    free(pool.blocks[i]);
+  free(pool.blocks);
+  free(pool.strs);
+  if(pool.index) kh_destroy(str_pool, pool.index);
+
+  memset(&pool, 0, sizeof(pool));
+}
@@ -0,0 +1,60 @@
+#ifndef STR_POOL_H_
+#define STR_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Global pool of interned strings. Each distinct string is stored once
+   and referred to by a small integer id, so two names are equal iff
+   their ids are equal. Id 0 is always the empty string. */
+typedef uint32_t str_id_t;
+
+/* return the id of the first len bytes of s, adding them to the pool if
+   needed. s does not need to be NUL terminated */
+str_id_t str_pool_intern(const char* s, size_t len);
+
+/* string that has been located and hashed, but not interned yet.
+   str_slice is thread safe, so hashing can be done ahead of interning */
+typedef struct {
+  const char * s;
+  uint32_t len, hash;
+} str_slice_t;
+
+str_slice_t str_slice(const char* s, size_t len);
+str_id_t str_pool_intern_slice(str_slice_t slice);
+
+/* id of a string already in the pool, without adding it. Returns
+   STR_ID_NONE if it isn't there */
+#define STR_ID_NONE ((str_id_t) -1)
+str_id_t str_pool_find(const char* s, size_t len);
+
+/* NUL terminated string for the given id */
+const char* str_pool_get(str_id_t id);
+
+/* length of the string for the given id */
+size_t str_pool_len(str_id_t id);
+
+/* number of strings in the pool */
+size_t str_pool_size(void);
+
+/* strings, buckets of the index and bytes held by the pool */
+typedef struct {
+  size_t strings, buckets, bytes;
+} str_pool_stats_t;
+
+str_pool_stats_t str_pool_stats(void);
+
+/* string for the given id, with its hash */
+str_slice_t str_pool_slice(str_id_t id);
+
+/* fill an empty pool with n strings, stored back to back in bytes (each
+   NUL terminated, the first one empty), with their lengths and hashes.
+   Ids are given in order and no string is hashed again, so a pool saved
+   with str_pool_slice comes back with the same ids. Returns -1 if the
+   pool already holds strings or the strings are malformed */
+int str_pool_load(const char* bytes, size_t size, const uint32_t* lens,
+                  const uint32_t* hashes, size_t n);
+
+void str_pool_destroy(void);
+
+#endif // STR_POOL_H_
@@ -0,0 +1,215 @@
+#include "stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzip.h"
+#include "parallel.h"
+
+/* lines are read STREAM_CHUNK bytes per chunk, a few chunks per thread
+   at a time */
+#define STREAM_CHUNK (1 << 20)
+#define STREAM_CHUNKS_PER_THREAD 4
+
+typedef struct {
+  const char *start, *end;
+  stream_buffer_t out;
+
+  size_t lines, counted;
+  int status;
+  char error[256];
+} stream_chunk_t;
+
+typedef struct {
+  const stream_t * stream;
+  stream_chunk_t * chunks;
+} stream_job_t;
+
+char * stream_reserve(stream_buffer_t * buffer, size_t need){
+  if(buffer->used + need > buffer->size){
+    buffer->size = (buffer->used + need) * 2;
+    buffer->data = realloc(buffer->data, buffer->size);
+    if(!buffer->data){
+      fprintf(stderr, "Out of memory while streaming\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return buffer->data + buffer->used;
+}
+
+void stream_put(stream_buffer_t * buffer, const char * data, size_t len){
+  memcpy(stream_reserve(buffer, len), data, len);
+  buffer->used += len;
+}
+
+/* lines stops at the one that failed or ended the input */
+static void __chunk(void * data, size_t i){
+  stream_job_t * job = data;
+  stream_chunk_t * chunk = job->chunks + i;
+  const stream_t * stream = job->stream;
+  const char * cur = chunk->start;
+
+  chunk->out.used = 0;
+  chunk->lines    = 0;
+  chunk->counted  = 0;
+  chunk->status   = STREAM_SKIP;
+
+  while(cur < chunk->end){
+    const char * nl = memchr(cur, '\n', chunk->end - cur);
+    if(!nl) nl = chunk->end;
+    chunk->lines++;
+
+    if(nl > cur){
+      int status = stream->line(stream->arg, cur, nl - cur, &chunk->out,
+                                chunk->error, sizeof(chunk->error));
+      if(status == STREAM_ERROR || status == STREAM_END){
+        chunk->status = status;
+        return;
+      }
+      chunk->counted += status == STREAM_LINE;
+    }
+
+    cur = nl + 1;
+  }
+}
+
+size_t stream_lines(const stream_t * stream, FILE * in, agp_writer_t * out,
+                    int threads){
+  size_t n_chunks = (size_t) threads * STREAM_CHUNKS_PER_THREAD;
+  size_t size = STREAM_CHUNK * n_chunks, used = 0, line = 0, counted = 0;
+  char * buffer = malloc(size);
+  stream_chunk_t * chunks = calloc(n_chunks, sizeof(stream_chunk_t));
+  stream_job_t job = { stream, chunks };
+  int header = stream->header != NULL, eof = 0, done = 0;
+  gzip_reader_t reader;
+  size_t i;
+
+  if(!buffer || !chunks){
+    fprintf(stderr, "Out of memory while streaming\n");
+    exit(EXIT_FAILURE);
+  }
+
+  gzip_reader_init(&reader, in);
+  while(!eof && !done){
+    size_t n = gzip_read(&reader, buffer + used, size - used);
+    used += n;
+    eof = n == 0;
+
+    /* whole lines only, until the end of the input */
+    const char * cur = buffer, * end = buffer + used;
+    if(!eof){
+      while(end > buffer && end[-1] != '\n')
+        end--;
+      if(end == buffer){
+        if(used == size){
+          size *= 2;
+          buffer = realloc(buffer, size);
+          if(!buffer){
+            fprintf(stderr, "Out of memory while streaming\n");
+            exit(EXIT_FAILURE);
+          }
+        }
+        continue;
+      }
+    }
+
+    while(header && cur < end){
+      const char * nl = memchr(cur, '\n', end - cur);
+      if(!nl) nl = end;
+
+      int status = nl > cur ?
+        stream->header(stream->arg, cur, nl - cur, out) : STREAM_LINE;
+      if(status != STREAM_LINE){
+        header = 0;
+        done = status == STREAM_END;
+        stream->header(stream->arg, NULL, 0, out);
+        break;
+      }
+
+      line++;
+      cur = nl < end ? nl + 1 : end;
+    }
+    if(done)
+      break;
+
+    /* the rest is cut into chunks at line ends */
+    size_t m = 0;
+    while(cur < end){
+      const char * stop = cur + (end - cur) / (n_chunks - m);
+      const char * nl;
+
+      if(stop < end && (nl = memchr(stop, '\n', end - stop)) != NULL)
+        stop = nl + 1;
+      else
+        stop = end;
+
+      chunks[m].start = cur;
+      chunks[m].end   = stop;
+      m++;
+      cur = stop;
+    }
+
+    parallel_for(threads, m, __chunk, &job);
+
+    for(i = 0; i < m && !done; i++){
+      if(chunks[i].status == STREAM_ERROR){
+        fprintf(stderr, "%s error: line %zu: %s\n", stream->what,
+                line + chunks[i].lines, chunks[i].error);
+        exit(EXIT_FAILURE);
+      }
+
+      agp_writer_write(out, chunks[i].out.data, chunks[i].out.used);
+      line    += chunks[i].lines;
+      counted += chunks[i].counted;
+      done = chunks[i].status == STREAM_END;
+    }
+
+    used = buffer + used - end;
+    memmove(buffer, end, used);
+  }
+
+  /* all header */
+  if(header)
+    stream->header(stream->arg, NULL, 0, out);
+
+  gzip_reader_close(&reader);
+  for(i = 0; i < n_chunks; i++)
+    free(chunks[i].out.data);
+  free(chunks);
+  free(buffer);
+
+  return counted;
+}
+
+void stream_objects(agp_graph_t * agp, agp_writer_t * writer,
+                    const char * prefix, const char * format){
+  agp_object_t ** objects = agp_graph_sorted_objects(agp);
+  int size = kh_size(agp->objects), i;
+  char line[64];
+
+  for(i = 0; i < size; i++){
+    agp_writer_write(writer, prefix, strlen(prefix));
+    agp_writer_write(writer, str_pool_get(objects[i]->name),
+                     str_pool_len(objects[i]->name));
+    agp_writer_write(writer, line,
+                     sprintf(line, format, objects[i]->length));
+  }
+
+  free(objects);
+}
+
+size_t stream_lift(const stream_t * stream, agp_graph_t * agp, FILE * in,
+                   FILE * out, int threads, int compress){
+  agp_writer_t writer;
+
+  agp_graph_renumber(agp);
+  if(compress)
+    agp_writer_init_bgzf(&writer, out, threads);
+  else
+    agp_writer_init(&writer, out);
+
+  size_t lines = stream_lines(stream, in, &writer, threads);
+  agp_writer_close(&writer);
+
+  return lines;
+}
@@ -0,0 +1,72 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include "agp-write.h"
+
+/* Line based files (gzip or not) streamed through a function. Lines
+   are read in batches, cut into chunks at line ends, handed to the
+   function on up to threads threads, each chunk into its own buffer,
+   and the buffers are written in order, so memory doesn't grow with
+   the input. Lines are passed without their newline; empty lines are
+   dropped. */
+typedef struct {
+  char * data;
+  size_t used, size;
+} stream_buffer_t;
+
+/* what was done with a line */
+#define STREAM_ERROR -1
+#define STREAM_SKIP   0              /* copied or dropped */
+#define STREAM_LINE   1              /* counted */
+#define STREAM_END    2              /* drop it and the rest of the input */
+
+typedef struct {
+  /* lines at the start of the input, called on this thread, in order,
+     for as long as it returns STREAM_LINE (or until STREAM_END). Then
+     called once more with a NULL line. May be NULL */
+  int (*header)(void * arg, const char * line, size_t len, agp_writer_t*);
+
+  /* every line after the header. On error, the reason goes to error */
+  int (*line)(void * arg, const char * line, size_t len, stream_buffer_t*,
+              char * error, size_t size);
+
+  void * arg;
+
+  /* kind of file, for errors */
+  const char * what;
+} stream_t;
+
+/* room for need more bytes at the end of a buffer */
+char * stream_reserve(stream_buffer_t*, size_t need);
+void stream_put(stream_buffer_t*, const char* data, size_t len);
+
+/* stream in to out. Returns the number of lines counted. Exits with
+   the line number of the first error */
+size_t stream_lines(const stream_t*, FILE* in, agp_writer_t* out,
+                    int threads);
+
+/* Files lifted to the scaffolds of a graph (lift.h, pairs.h) */
+
+/* 1 if a line starts with prefix */
+#define stream_starts(line, len, prefix)                                \
+  ((len) >= strlen(prefix) && strncmp((line), (prefix), strlen(prefix)) == 0)
+
+/* the other strand, for a feature on a reversed component */
+#define stream_flip(strand) ((strand) == '+' ? '-' : (strand) == '-' ? '+' : \
+                             (strand))
+
+/* one header line per object of the graph, in order: prefix, the name,
+   then the length through format */
+void stream_objects(agp_graph_t*, agp_writer_t*, const char* prefix,
+                    const char* format);
+
+/* stream in to out as stream_lines does, out being BGZF if compress is
+   set, once the part numbers and positions of the graph are up to date
+   (agp_graph_renumber) */
+size_t stream_lift(const stream_t*, agp_graph_t*, FILE* in, FILE* out,
+                   int threads, int compress);
+
+#endif // STREAM_H_
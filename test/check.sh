@@ -0,0 +1,344 @@
+#!/bin/sh
+# Checks for make check. Agp files and scripts are made with bench/gen,
+# and magpie must write the same agp however it is run: on one thread or
+# several, with either engine, simplified or not, from plain or gzip
+# input, or a snapshot, or as a fork. magpie diff must give back the
+# edits it is shown, undoing a session must give back its input,
+# annotations, pairs and sequences must be moved as expected, and bad
+# scripts and damaged snapshots must be stopped. One line per check goes
+# to stdout, and the exit status is 1 if any check failed.
+#
+#   CHECK_DATA     where data sets are made (default a temporary
+#                  directory, removed afterwards)
+#   CHECK_THREADS  threads for the parallel runs (default 4)
+
+magpie=./magpie
+gen=bench/gen
+threads=${CHECK_THREADS:-4}
+failed=0
+
+if [ -n "$CHECK_DATA" ]; then
+  data=$CHECK_DATA
+  mkdir -p "$data"
+else
+  data=$(mktemp -d)
+  trap 'rm -rf "$data"' EXIT
+fi
+
+pass(){
+  echo "ok    $1"
+}
+
+fail(){
+  echo "FAIL  $1"
+  [ -s "$data/stderr" ] && sed 's/^/      /' "$data/stderr"
+  failed=1
+}
+
+# run magpie with the given arguments, keeping what it says
+run(){
+  $magpie "$@" 2> "$data/stderr"
+}
+
+# check NAME REFERENCE OUTPUT
+same(){
+  if cmp -s "$2" "$3"; then pass "$1"; else fail "$1"; fi
+}
+
+# variants NAME SCRIPT AGP: the list engine on one thread is the
+# reference the other ways of running are compared to
+variants(){
+  name=$1 script=$2 agp=$3
+
+  gzip -c "$agp" > "$data/input.agp.gz"
+
+  for simplify in "" "-s"; do
+    label="$name${simplify:+ $simplify}"
+
+    if ! run $simplify -o "$data/ref.agp" "$script" "$agp"; then
+      fail "$label: reference run"
+      continue
+    fi
+
+    for way in "-t $threads" "-e tree" "-e tree -t $threads"; do
+      if run $simplify $way -o "$data/out.agp" "$script" "$agp"; then
+        same "$label $way" "$data/ref.agp" "$data/out.agp"
+      else
+        fail "$label $way"
+      fi
+    done
+
+    if run $simplify -t "$threads" -o "$data/out.agp.gz" "$script" \
+           "$data/input.agp.gz"; then
+      gzip -dc "$data/out.agp.gz" > "$data/out.agp"
+      same "$label gzip -t $threads" "$data/ref.agp" "$data/out.agp"
+    else
+      fail "$label gzip -t $threads"
+    fi
+  done
+
+  if run --check "$script" "$agp"; then
+    pass "$name --check"
+  else
+    fail "$name --check"
+  fi
+}
+
+# rejects NAME SCRIPT AGP: the script must stop with a script error,
+# however it is run, and --check must catch it
+rejects(){
+  name=$1 script=$2 agp=$3
+
+  for way in "" "-t $threads" "-e tree" "-e tree -t $threads" "--check"; do
+    run $way -o "$data/out.agp" "$script" "$agp"
+    if [ $? -eq 1 ] && grep -q '^Script error: line' "$data/stderr"; then
+      pass "$name${way:+ $way}"
+    else
+      fail "$name${way:+ $way}"
+    fi
+  done
+}
+
+# sequence components of an agp, by scaffold, without gaps or
+# positions
+components(){
+  awk '$5 == "W" { print $1, $6, $7, $8, $9 }' "$1"
+}
+
+# pairs NAME SCRIPT AGP: pairs between the middles of neighbouring agp
+# lines, gaps too, lifted on several threads and written as BGZF, must
+# be the pairs lifted on one thread
+pairs(){
+  name=$1 script=$2 agp=$3
+
+  awk -F '\t' 'BEGIN { OFS = "\t"; print "## pairs format v1.0"
+                        print "#columns: readID chr1 pos1 chr2 pos2 " \
+                              "strand1 strand2" }
+                { pos = int(($2 + $3) / 2)
+                  if(NR > 1) print "r" NR, last, $1, pos, "+", "-"
+                  last = $1 "\t" pos }' "$agp" > "$data/in.pairs"
+
+  if run -o /dev/null --pairs-in "$data/in.pairs" \
+         --pairs-out "$data/ref.pairs" "$script" "$agp" &&
+     run -t "$threads" -o /dev/null --pairs-in "$data/in.pairs" \
+         --pairs-out "$data/out.pairs.gz" "$script" "$agp"; then
+    gzip -dc "$data/out.pairs.gz" > "$data/out.pairs"
+    same "$name pairs gzip -t $threads" "$data/ref.pairs" "$data/out.pairs"
+  else
+    fail "$name pairs gzip -t $threads"
+  fi
+}
+
+# forks NAME SCRIPT AGP: two more scripts run as forks beside SCRIPT
+# must each write the agp a run of their own writes, with either engine
+# and on several threads, simplified or not
+forks(){
+  name=$1 script=$2 agp=$3
+
+  for seed in 2 3; do
+    $gen script -r $seed -o 1000 "$agp" > "$data/fork$seed.magpie"
+    run -o "$data/ref$seed.agp" "$data/fork$seed.magpie" "$agp"
+    run -s -o "$data/simple$seed.agp" "$data/fork$seed.magpie" "$agp"
+  done
+
+  for way in "" "-t $threads" "-e tree" "-e tree -t $threads" \
+             "-s -t $threads"; do
+    label="$name${way:+ $way} fork"
+    ref=ref
+    case $way in -s*) ref=simple ;; esac
+
+    if run $way -o /dev/null --fork "$data/fork2.magpie=$data/out2.agp" \
+           --fork "$data/fork3.magpie=$data/out3.agp" "$script" "$agp"; then
+      for seed in 2 3; do
+        same "$label $seed" "$data/$ref$seed.agp" "$data/out$seed.agp"
+      done
+    else
+      fail "$label"
+    fi
+  done
+}
+
+# roundtrip NAME SCRIPT AGP: magpie diff from the agp to its edit must
+# give a script that makes the same scaffolds out of the same
+# components. Scripts don't change gaps, so they aren't compared, and
+# can't join sequences, so when the edit is simplified so is the result
+roundtrip(){
+  name=$1 script=$2 agp=$3
+
+  for simplify in "" "-s"; do
+    label="$name${simplify:+ $simplify}"
+
+    if run $simplify -o "$data/new.agp" "$script" "$agp" &&
+       run diff -t "$threads" -o "$data/diff.magpie" "$agp" "$data/new.agp" &&
+       run $simplify -o "$data/out.agp" "$data/diff.magpie" "$agp"; then
+      components "$data/new.agp" > "$data/new.txt"
+      components "$data/out.agp" > "$data/out.txt"
+      same "$label diff round trip" "$data/new.txt" "$data/out.txt"
+    else
+      fail "$label diff round trip"
+    fi
+  done
+}
+
+# session NAME SCRIPT AGP: undoing every operation of an interactive
+# session must give back the agp as it was read, and redoing them the
+# agp the script makes
+session(){
+  name=$1 script=$2 agp=$3
+  ops=$(wc -l < "$script")
+
+  for way in "" "-e tree"; do
+    label="$name${way:+ $way}"
+
+    if run $way -o "$data/ref.agp" /dev/null "$agp" &&
+       run $way -o "$data/new.agp" "$script" "$agp" &&
+       printf 'UNDO %s\nSAVE %s\nREDO %s\nSAVE %s\nQUIT\n' \
+              "$ops" "$data/undone.agp" "$ops" "$data/redone.agp" |
+         run $way -i -o /dev/null "$script" "$agp"; then
+      same "$label session undo" "$data/ref.agp" "$data/undone.agp"
+      same "$label session redo" "$data/new.agp" "$data/redone.agp"
+    else
+      fail "$label session"
+    fi
+  done
+}
+
+# snapshot NAME SCRIPT AGP: a graph loaded from a snapshot must give
+# the same agp as the file it was saved from, and a snapshot damaged
+# after it was saved must be rejected
+snapshot(){
+  name=$1 script=$2 agp=$3
+
+  if run --save-snapshot "$data/graph.snap" -o "$data/ref.agp" \
+         "$script" "$agp"; then
+    for way in "" "-e tree -t $threads"; do
+      if run $way --load-snapshot "$data/graph.snap" -o "$data/out.agp" \
+             "$script"; then
+        same "$name snapshot round trip${way:+ $way}" \
+             "$data/ref.agp" "$data/out.agp"
+      else
+        fail "$name snapshot round trip${way:+ $way}"
+      fi
+    done
+  else
+    fail "$name snapshot round trip"
+  fi
+
+  size=$(wc -c < "$data/graph.snap")
+  printf 'XXXXXXXX' | dd of="$data/graph.snap" bs=1 seek=$((size / 2)) \
+                         conv=notrunc 2> /dev/null
+  run --load-snapshot "$data/graph.snap" -o "$data/out.agp" "$script"
+  if [ $? -eq 1 ] && grep -q '^Snapshot is corrupt' "$data/stderr"; then
+    pass "$name damaged snapshot"
+  else
+    fail "$name damaged snapshot"
+  fi
+}
+
+# lift NAME SCRIPT AGP: the features of AGP.bed and AGP.gff3 (without
+# .agp) and the chain from AGP to what SCRIPT makes of it must come out
+# as in AGP-out.bed, .gff3 and .chain, with either engine and on
+# several threads, and a feature whose blocks don't fit it is an error
+lift(){
+  name=$1 script=$2 agp=$3
+  base=${agp%.agp}
+
+  for way in "" "-t $threads" "-e tree -t $threads"; do
+    label="$name${way:+ $way}"
+
+    if run $way -o /dev/null --chain-out "$data/out.chain" \
+           --bed-in "$base.bed" --bed-out "$data/out.bed" \
+           --gff-in "$base.gff3" --gff-out "$data/out.gff3.gz" \
+           "$script" "$agp"; then
+      gzip -dc "$data/out.gff3.gz" > "$data/out.gff3"
+      same "$label bed" "$base-out.bed" "$data/out.bed"
+      same "$label gff3" "$base-out.gff3" "$data/out.gff3"
+      same "$label chain" "$base-out.chain" "$data/out.chain"
+    else
+      fail "$label"
+    fi
+  done
+
+  # pairs with a side in a gap or on a sequence the agp doesn't have,
+  # with their positions on the scaffolds or on the contigs
+  for contigs in "" "--pairs-contigs"; do
+    label="$name pairs${contigs:+ $contigs}"
+
+    if run $contigs -o /dev/null --pairs-in "$base${contigs:+-contigs}.pairs" \
+           --pairs-out "$data/out.pairs" "$script" "$agp"; then
+      same "$label" "$base-out.pairs" "$data/out.pairs"
+    else
+      fail "$label"
+    fi
+  done
+
+  # scaffolds from contigs on lines of 17 bases, through the .fai and
+  # indexed in memory
+  cp "$base.fa" "$data/contigs.fa"
+  for fasta in "$base.fa" "$data/contigs.fa"; do
+    label="$name fasta"
+    [ -f "$fasta.fai" ] || label="$label without .fai"
+
+    if run -t "$threads" -o /dev/null --fasta-in "$fasta" \
+           --fasta-out "$data/out.fa" "$script" "$agp"; then
+      same "$label" "$base-out.fa" "$data/out.fa"
+    else
+      fail "$label"
+    fi
+  done
+
+  # the last block ends a base after the feature
+  awk -F '\t' 'NF == 12 { $2 = $2 + 1; print; exit }' OFS='\t' \
+      "$base.bed" > "$data/bad.bed"
+  run -o /dev/null --bed-in "$data/bad.bed" --bed-out "$data/out.bed" \
+      "$script" "$agp"
+  if [ $? -eq 1 ] && grep -q '^BED error: line 1' "$data/stderr"; then
+    pass "$name blocks out of the feature"
+  else
+    fail "$name blocks out of the feature"
+  fi
+}
+
+# libmagpie, through a program of its own
+test/host || failed=1
+
+variants simple test/simple.magpie test/simple.agp
+
+# forward, reversed, split and gap crossing features, BED7 and BED12
+lift lift test/lift.magpie test/lift.agp
+
+# name, scaffolds, sequences per scaffold, operations, sequences per
+# segment. wide is large enough to be read on several threads
+while read -r name scaffolds sequences ops segment; do
+  agp="$data/$name.agp"
+  script="$data/$name.magpie"
+
+  $gen agp -s "$scaffolds" -c "$sequences" > "$agp"
+  $gen script -o "$ops" -l "$segment" "$agp" > "$script"
+
+  variants "$name" "$script" "$agp"
+  pairs "$name" "$script" "$agp"
+  forks "$name" "$script" "$agp"
+  roundtrip "$name" "$script" "$agp"
+  session "$name" "$script" "$agp"
+  snapshot "$name" "$script" "$agp"
+done <<EOF
+wide   2000  10-50      4000  1-5
+long   40    1000-2000  4000  1-50
+EOF
+
+# segments moved next to themselves (these used to crash), and one
+# whose ends aren't connected, made of the first sequences of wide
+set -- $(awk '$5 == "W" { print $6 ":" $7 "-" $8; if(++n == 3) exit }' \
+             "$data/wide.agp")
+
+echo "MOVE $1 AFTER $1" > "$data/bad.magpie"
+rejects "MOVE onto itself" "$data/bad.magpie" "$data/wide.agp"
+
+echo "MOVE $1 THRU $3 BEFORE $2" > "$data/bad.magpie"
+rejects "MOVE into itself" "$data/bad.magpie" "$data/wide.agp"
+
+echo "REV $2 THRU $1" > "$data/bad.magpie"
+rejects "REV of unconnected ends" "$data/bad.magpie" "$data/wide.agp"
+
+exit $failed
@@ -0,0 +1,112 @@
+/* A small program on libmagpie, for make check: it goes through every
+   call of src/magpie.h, errors included, on an agp held in memory, and
+   writes one line per check, as test/check.sh does. Exits with 1 if
+   any check failed. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "magpie.h"
+
+static const char agp[] =
+  "a\t1\t10\t1\tW\tc1\t1\t10\t+\n"
+  "a\t11\t20\t2\tU\t10\tscaffold\tyes\tna\n"
+  "a\t21\t30\t3\tW\tc1\t11\t20\t+\n"
+  "a\t31\t40\t4\tU\t10\tscaffold\tyes\tna\n"
+  "a\t41\t50\t5\tW\tc2\t1\t10\t+\n"
+  "b\t1\t10\t1\tW\tc3\t1\t10\t+\n";
+
+/* after the script and simplify; gaps next to an edit get the default
+   length */
+static const char expected[] =
+  "a\t1\t20\t1\tW\tc1\t1\t20\t+\n"
+  "a\t21\t120\t2\tU\t100\tscaffold\tyes\tna\n"
+  "a\t121\t130\t3\tW\tc2\t1\t10\t-\n"
+  "a\t131\t230\t4\tU\t100\tscaffold\tyes\tna\n"
+  "a\t231\t240\t5\tW\tc3\t1\t10\t+\n";
+
+static int failed = 0;
+
+static void check(const char * name, int ok, magpie_t * m){
+  printf("%s  library %s\n", ok ? "ok  " : "FAIL", name);
+  if(!ok){
+    if(m && *magpie_error(m))
+      printf("      %s\n", magpie_error(m));
+    failed = 1;
+  }
+}
+
+static int count_scaffold(const magpie_scaffold_t * scaffold, void * arg){
+  size_t * n = arg;
+  *n += scaffold->components;
+  return 0;
+}
+
+static int first_gap(const magpie_component_t * component, void * arg){
+  const magpie_component_t ** gap = arg;
+  if(component->type == 'W')
+    return 0;
+  *gap = component;
+  return strcmp(component->gap_type, "scaffold") != 0 ||
+    component->gap_length != 100;
+}
+
+int main(void){
+  magpie_t * m = magpie_open();
+  const magpie_component_t * gap = NULL;
+  size_t done = 0, combined = 0, n = 0, len;
+  char * out;
+  int i;
+
+  if(!m){
+    check("open", 0, NULL);
+    return 1;
+  }
+
+  check("run without a graph",
+        magpie_run(m, "REV c1:1-10", NULL) == MAGPIE_ERROR_NO_GRAPH, m);
+  check("bad agp", magpie_load(m, "a\t1\tx\n", 7) == MAGPIE_ERROR_PARSE &&
+        *magpie_error(m), m);
+
+  check("load", magpie_load(m, agp, sizeof(agp) - 1) == MAGPIE_OK &&
+        !*magpie_error(m), m);
+  check("unknown contig", magpie_run(m, "REV c9:1-10", &done) ==
+        MAGPIE_ERROR_SCRIPT && strstr(magpie_error(m), "line 1"), m);
+
+  /* the REVCOMP stays applied, the MOVE onto itself doesn't run */
+  check("bad operation", magpie_run(m, "REVCOMP c2:1-10\n"
+                                    "MOVE c3:1-10 AFTER c3:1-10", &done) ==
+        MAGPIE_ERROR_SCRIPT && done == 1, m);
+  check("run", magpie_run(m, "MOVE c3:1-10 AFTER c2:1-10", &done) ==
+        MAGPIE_OK && done == 1, m);
+  check("simplify", magpie_simplify(m, &combined) == MAGPIE_OK &&
+        combined == 1, m);
+
+  check("foreach scaffold", magpie_foreach_scaffold(m, count_scaffold, &n) ==
+        MAGPIE_OK && n == 5, m);
+  check("foreach component",
+        magpie_foreach_component(m, "a", first_gap, &gap) == MAGPIE_OK &&
+        gap != NULL, m);
+  check("missing scaffold",
+        magpie_foreach_component(m, "b", first_gap, &gap) ==
+        MAGPIE_ERROR_NOT_FOUND, m);
+
+  check("write", magpie_write(m, &out, &len) == MAGPIE_OK &&
+        len == sizeof(expected) - 1 && strcmp(out, expected) == 0, m);
+  free(out);
+
+  magpie_unload(m);
+  check("unload", magpie_write(m, &out, &len) == MAGPIE_ERROR_NO_GRAPH, m);
+
+  /* the name pool goes and comes back with the graphs */
+  for(i = 0; i < 100; i++){
+    if(magpie_load(m, agp, sizeof(agp) - 1) != MAGPIE_OK ||
+       magpie_run(m, "REVCOMP c1:1-10 THRU c1:11-20", NULL) != MAGPIE_OK)
+      break;
+    magpie_unload(m);
+  }
+  check("load and unload", i == 100, m);
+
+  magpie_close(m);
+  return failed;
+}